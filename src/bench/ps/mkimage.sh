@@ -0,0 +1,106 @@
+#!/bin/sh
+#
+# "mkimage.sh 2021-05-17 15:55:05
+#
+#  Writes the image.ps benchmark fixture of TSC Printer Driver to stdout
+#
+#  Copyright (c) 2005, by TSC Printronix Auto ID .
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# A shipping label with a 432x432 1 bit image in %%BeginData binary bytes.
+# The bytes come from a fixed LCG, so every run writes the same file. They
+# hold newlines, '%' and a "%%Page:" line that the DSC scanner must skip.
+
+cat <<'END'
+%!PS-Adobe-3.0
+%%Creator: TSC driver benchmark fixtures
+%%Title: embedded binary image
+%%BoundingBox: 0 0 288 432
+%%DocumentMedia: w288h432 288 432 0 () ()
+%%Pages: 1
+%%PageOrder: Ascend
+%%EndComments
+%%BeginProlog
+/inch { 72 mul } def
+% x y w h bars -- : Code 128 like bars from a seed
+/bars {
+  /h exch def /w exch def /y exch def /x exch def
+  /s seed def
+  { x w ge { exit } if
+    /s s 75 mul 74 add 65537 mod def
+    /b s 8 idiv 4 mod 1 add def
+    x y b h rectfill
+    /x x b add s 64 idiv 4 mod 1 add add def
+  } loop
+} def
+/label {
+  /n exch def /seed n 7919 mul 65537 mod def
+  gsave
+  1.5 setlinewidth
+  4 4 280 424 rectstroke
+  108 108 324 { 4 exch 280 1.5 rectfill } for
+  /Helvetica-Bold findfont 14 scalefont setfont
+  12 400 moveto (SHIP TO:) show
+  /Helvetica findfont 11 scalefont setfont
+  12 384 moveto (TSC Printronix Auto ID) show
+  12 370 moveto (9F, No.95, Minquan Rd.) show
+  12 356 moveto (New Taipei City 231) show
+  12 336 moveto (Order ) show n 10 string cvs show
+  /Helvetica-Bold findfont 28 scalefont setfont
+  12 290 moveto (1Z 999 AA1) show
+  18 170 266 90 bars
+  /Courier findfont 10 scalefont setfont
+  60 156 moveto (TRACK ) show n 100000 add 12 string cvs show
+  16 0.125 inch 80 { 18 exch 250 4 rectfill } for
+  grestore
+} def
+%%EndProlog
+%%BeginSetup
+<< /PageSize [288 432] >> setpagedevice
+%%EndSetup
+%%Page: 1 1
+%%BeginPageSetup
+%%EndPageSetup
+1 label
+gsave 36 144 translate 216 216 scale
+/picstr 54 string def
+%%BeginData: 23403 Binary Bytes
+432 432 1 [432 0 0 -432 0 432] { currentfile picstr readstring pop } image
+END
+
+# 54 bytes a row as octal escapes, one printf per row. Row 216 starts
+# with "\n%%Page: 2 2\n".
+awk 'BEGIN {
+	n = split("10 37 37 80 97 103 101 58 32 50 32 50 10", page, " ");
+	s = 1;
+	for (y = 0; y < 432; y++) {
+		row = "";
+		for (x = 0; x < 54; x++) {
+			s = (s * 75 + 74) % 65537;
+			b = (y == 216 && x < n) ? page[x + 1] : s % 256;
+			row = row sprintf("\\%03o", b);
+		}
+		print row;
+	}
+}' | while read -r row; do
+	printf "$row"
+done
+echo
+
+cat <<'END'
+%%EndData
+grestore
+showpage
+%%Trailer
+%%EOF
+END
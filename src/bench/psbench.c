@@ -0,0 +1,315 @@
+/*
+ * "psbench.c 2021-05-17 15:55:05
+ *  
+ *  PostScript path benchmark for TSC Printer Driver
+ *  
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ 
+ */
+
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+
+#include <sys/time.h>
+#include <sys/wait.h>
+
+// Runs the PostScript filter over the DSC fixtures, ps/ and the image.ps
+// of ps/mkimage.sh, as CUPS would, and splits each job with the filter's
+// own $TSC_METRICS_FILE and $TSC_TRACE_FILE output: gs startup, per-page
+// rendering, the BMP pipe between ps2bmp and bmp2tspl, and TSPL emission.
+// Needs libgs, one JSON line per fixture goes to stdout, medians over the
+// iterations. A filter that fails, libgs missing included, fails the run.
+
+#define	MAX_PAGES				1024
+
+typedef struct _FIXTURE
+{
+	const char		*szFile;
+	const char		*szCopies;
+	const char		*szOptions;
+} FIXTURE;
+
+typedef struct _PSRESULT
+{
+	long long		llWall;				// us, fork to exit
+	long long		llStartup;			// ps2bmp setup and gsEnable
+	long long		llRender;			// RenderPage spans
+	long long		llPageP50;
+	long long		llPageMax;
+	long long		llPipe;				// ReadBitmap and StreamBitmap spans
+	long long		llEmit;				// TSPL_SendPage spans
+	long long		llPages;			// Pages sent by bmp2tspl
+	long long		llOutputBytes;
+	long long		llMaxRss;			// kB, the larger of the two processes
+} PSRESULT;
+
+#define	RESULT_FIELDS			(sizeof(PSRESULT) / sizeof(long long))
+
+static const FIXTURE	g_Fixtures[] =
+{
+	{ "label.ps",		"1",	"" },
+	{ "batch100.ps",	"1",	"" },
+	{ "collate.ps",		"3",	"Collate=True" },
+	{ "image.ps",		"1",	"" },
+};
+
+static const char	*g_szResultNames[RESULT_FIELDS] =
+{
+	"wall_us", "startup_us", "render_us", "render_page_p50_us", "render_page_max_us",
+	"pipe_us", "emit_us", "pages", "output_bytes", "max_rss_kb"
+};
+
+static long long NowUs(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int CompareLL(const void *a, const void *b)
+{
+	long long		x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// Value of "key":number in a flat JSON line, 0 when missing
+static long long JsonNumber(const char *szLine, const char *szKey)
+{
+	char			key[64];
+	const char		*p;
+
+	snprintf(key, sizeof(key), "\"%s\":", szKey);
+	if ( (p = strstr(szLine, key)) == NULL )
+		return 0;
+	return atoll(p + strlen(key));
+}
+
+static BOOL ParseMetrics(const char *szFile, PSRESULT *result)
+{
+	FILE			*fp;
+	char			line[1024];
+	int				nLines = 0;
+
+	if ( (fp = fopen(szFile, "r")) == NULL )
+		return FALSE;
+
+	while ( fgets(line, sizeof(line), fp) )
+	{
+		if ( strstr(line, "\"filter\":\"ps2bmp\"") )
+		{
+			result->llStartup += JsonNumber(line, "setup_us");
+		}
+		else if ( strstr(line, "\"filter\":\"bmp2tspl\"") )
+		{
+			result->llPages = JsonNumber(line, "pages");
+			result->llOutputBytes = JsonNumber(line, "output_bytes");
+		}
+		else
+		{
+			continue;
+		}
+		if ( JsonNumber(line, "max_rss_kb") > result->llMaxRss )
+			result->llMaxRss = JsonNumber(line, "max_rss_kb");
+		nLines++;
+	}
+	fclose(fp);
+
+	return nLines == 2;
+}
+
+static BOOL ParseTrace(const char *szFile, PSRESULT *result)
+{
+	FILE			*fp;
+	char			line[512];
+	char			name[64];
+	long long		pages[MAX_PAGES];
+	int				nPages = 0;
+
+	if ( (fp = fopen(szFile, "r")) == NULL )
+		return FALSE;
+
+	while ( fgets(line, sizeof(line), fp) )
+	{
+		long long		dur;
+
+		if ( sscanf(line, "{\"name\":\"%63[^\"]\"", name) != 1 )
+			continue;
+		dur = JsonNumber(line, "dur");
+
+		if ( !strcmp(name, "gsEnable") )
+			result->llStartup += dur;
+		else if ( !strcmp(name, "RenderPage") )
+		{
+			result->llRender += dur;
+			if ( nPages < MAX_PAGES )
+				pages[nPages++] = dur;
+		}
+		else if ( !strcmp(name, "ReadBitmap") || !strcmp(name, "StreamBitmap") )
+			result->llPipe += dur;
+		else if ( !strcmp(name, "TSPL_SendPage") )
+			result->llEmit += dur;
+	}
+	fclose(fp);
+
+	if ( nPages > 0 )
+	{
+		qsort(pages, nPages, sizeof(pages[0]), CompareLL);
+		result->llPageP50 = pages[nPages / 2];
+		result->llPageMax = pages[nPages - 1];
+	}
+
+	return TRUE;
+}
+
+// One CUPS style run of the filter, TSPL into /dev/null
+static BOOL RunOnce(const char *szFilter, const char *szPPD, const char *szPath, const FIXTURE *fixture, PSRESULT *result)
+{
+	char			szMetrics[] = "/tmp/psbench-metrics-XXXXXX";
+	char			szTrace[] = "/tmp/psbench-trace-XXXXXX";
+	int				fdMetrics, fdTrace;
+	int				status;
+	pid_t			pid;
+	BOOL			bRtn = FALSE;
+
+	if ( (fdMetrics = mkstemp(szMetrics)) < 0 )
+		return FALSE;
+	if ( (fdTrace = mkstemp(szTrace)) < 0 )
+	{
+		close(fdMetrics);
+		unlink(szMetrics);
+		return FALSE;
+	}
+	close(fdMetrics);
+	close(fdTrace);
+
+	result->llWall = NowUs();
+	if ( (pid = fork()) == 0 )
+	{
+		int				fd = open("/dev/null", O_RDWR);
+
+		dup2(fd, 0);
+		dup2(fd, 1);
+		setenv("TSC_METRICS_FILE", szMetrics, 1);
+		setenv("TSC_TRACE_FILE", szTrace, 1);
+		setenv("PPD", szPPD, 1);
+		if ( getenv("PRINTER") == NULL )
+			setenv("PRINTER", "psbench", 1);
+
+		execl(szFilter, szFilter, "1", "psbench", fixture->szFile, fixture->szCopies, fixture->szOptions, szPath, (char *)NULL);
+		Error_Log(LEVEL_ERROR, "Unable to run %s: %s\n", szFilter, strerror(errno));
+		_exit(127);
+	}
+	if ( pid > 0 && waitpid(pid, &status, 0) == pid )
+	{
+		result->llWall = NowUs() - result->llWall;
+		if ( !WIFEXITED(status) || WEXITSTATUS(status) )
+			Error_Log(LEVEL_ERROR, "%s: filter failed, status 0x%x\n", fixture->szFile, status);
+		else if ( !ParseMetrics(szMetrics, result) || !ParseTrace(szTrace, result) )
+			Error_Log(LEVEL_ERROR, "%s: no metrics or trace from the filter\n", fixture->szFile);
+		else
+			bRtn = TRUE;
+	}
+
+	unlink(szMetrics);
+	unlink(szTrace);
+	return bRtn;
+}
+
+static void Usage(void)
+{
+	fputs("Usage: psbench [-f filter] [-p ppd] [-n iterations] [-t tag] fixture-dir\n", stderr);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char		*szFilter = "./pstobarcodetspl";
+	const char		*szPPD = getenv("PPD");
+	const char		*szTag = "";
+	int				nIterations = 5;
+	int				i, iter, f, opt;
+	int				iRtn = 0;
+
+	while ( (opt = getopt(argc, argv, "f:p:n:t:")) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'f':
+			szFilter = optarg;
+			break;
+		case 'p':
+			szPPD = optarg;
+			break;
+		case 'n':
+			nIterations = atoi(optarg);
+			break;
+		case 't':
+			szTag = optarg;
+			break;
+		default:
+			Usage();
+		}
+	}
+	if ( optind != argc - 1 || nIterations < 1 || szPPD == NULL || !*szPPD )
+		Usage();
+
+	for (i=0; i<sizeof(g_Fixtures)/sizeof(g_Fixtures[0]); i++)
+	{
+		const FIXTURE	*fixture = &g_Fixtures[i];
+		char			szPath[PATH_MAX];
+		long long		*runs;
+		PSRESULT		result;
+
+		snprintf(szPath, sizeof(szPath), "%s/%s", argv[optind], fixture->szFile);
+		if ( (runs = MEMALLOC(sizeof(PSRESULT) * nIterations)) == NULL )
+			return 1;
+
+		for (iter=0; iter<nIterations; iter++)
+		{
+			memset(&result, 0, sizeof(result));
+			if ( !RunOnce(szFilter, szPPD, szPath, fixture, &result) )
+				break;
+			memcpy(runs + iter * RESULT_FIELDS, &result, sizeof(result));
+		}
+		if ( iter < nIterations )
+		{
+			MEMFREE(runs);
+			iRtn = 1;
+			continue;
+		}
+
+		// Median per field, runs are kept in columns for the sort
+		printf("{\"fixture\":\"%s\",\"version\":\"%s\",\"tag\":\"%s\",\"copies\":%s,\"iterations\":%d",
+				fixture->szFile, PACKAGE_VERSION, szTag, fixture->szCopies, nIterations);
+		for (f=0; f<RESULT_FIELDS; f++)
+		{
+			long long		column[nIterations];
+
+			for (iter=0; iter<nIterations; iter++)
+				column[iter] = runs[iter * RESULT_FIELDS + f];
+			qsort(column, nIterations, sizeof(column[0]), CompareLL);
+			printf(",\"%s\":%lld", g_szResultNames[f], column[nIterations / 2]);
+		}
+		printf("}\n");
+		fflush(stdout);
+
+		MEMFREE(runs);
+	}
+
+	return iRtn;
+}
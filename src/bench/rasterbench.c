@@ -0,0 +1,377 @@
+/*
+ * "rasterbench.c 2021-05-17 15:55:05
+ *  
+ *  raster path benchmark for TSC Printer Driver
+ *  
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ 
+ */
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "devmode.h"
+#include "metrics.h"
+#include "tsplenc.h"
+#include "raster.h"
+
+#include <time.h>
+
+// Runs the stages of rastertobarcodetspl over raster files: decode and
+// invert as in ParseDocData(), spool to a temporary file, then replay and
+// emit TSPL into a null sink. The filter needs libcups and a printer, the
+// spool here is a plain file where the filter uses cupsFileWrite().
+
+#define	STAGE_DECODE			0
+#define	STAGE_INVERT			1
+#define	STAGE_SPOOL				2
+#define	STAGE_EMIT				3
+#define	STAGE_NUM				4
+
+#define	DRAWMODE_OR				1
+
+typedef struct _BENCHPAGE
+{
+	unsigned		width;
+	unsigned		height;
+	off_t			offset;
+	size_t			length;
+} BENCHPAGE;
+
+typedef struct _BENCHRESULT
+{
+	int				nPages;
+	long long		llRows;				// Raster rows decoded
+	long long		llRasterBytes;		// cupsBytesPerLine * rows
+	long long		llPlaneBytes;		// Bytes spooled and emitted
+	long long		llNs[STAGE_NUM];
+	long long		llAllocs;
+	long long		llAllocBytes;
+} BENCHRESULT;
+
+static const char	*g_szStages[] = { "decode", "invert", "spool", "emit" };
+
+#ifdef __GLIBC__
+// Count every allocation of the process, libc's own included
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static long long	s_llAllocs = 0;
+static long long	s_llAllocBytes = 0;
+
+void *malloc(size_t size)
+{
+	s_llAllocs++;
+	s_llAllocBytes += size;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	s_llAllocs++;
+	s_llAllocBytes += nmemb * size;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	s_llAllocs++;
+	s_llAllocBytes += size;
+	return __libc_realloc(ptr, size);
+}
+#else
+static long long	s_llAllocs = -1;
+static long long	s_llAllocBytes = -1;
+#endif	// #ifdef __GLIBC__
+
+static long long NowNs(void)
+{
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int OpenSpool(void)
+{
+	const char	*tmpdir;
+	char		filename[1024];
+	int			fd;
+
+	if ( (tmpdir = getenv("TMPDIR")) == NULL )
+		tmpdir = "/tmp";
+
+	snprintf(filename, sizeof(filename), "%s/rasterbenchXXXXXX", tmpdir);
+	if ( (fd = mkstemp(filename)) >= 0 )
+		unlink(filename);
+
+	return fd;
+}
+
+static BOOL WriteAll(int fd, const void *pbuf, size_t cbbuf)
+{
+	const BYTE	*p = pbuf;
+	ssize_t		n;
+
+	while ( cbbuf > 0 )
+	{
+		if ( (n = write(fd, p, cbbuf)) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			return FALSE;
+		}
+		p += n;
+		cbbuf -= n;
+	}
+
+	return TRUE;
+}
+
+// One pass over a raster file, stage times are added to the result
+static BOOL RunOnce(const char *szFile, BENCHRESULT *result)
+{
+	cups_raster_t		*ras;
+	cups_page_header_t	header;
+	DEVMODE				dm;
+	TSPLENC				*penc = NULL;
+	BENCHPAGE			*pages = NULL;
+	int					nPages = 0;
+	int					fd, fdSpool;
+	long long			llStart;
+	long long			llAllocs = s_llAllocs, llAllocBytes = s_llAllocBytes;
+	BOOL				bRtn = TRUE;
+	int					page;
+
+	if ( (fd = open(szFile, O_RDONLY)) < 0 )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to open %s: %s\n", szFile, strerror(errno));
+		return FALSE;
+	}
+	if ( (fdSpool = OpenSpool()) < 0 )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to create spool file: %s\n", strerror(errno));
+		close(fd);
+		return FALSE;
+	}
+
+	memset(&dm, 0, sizeof(dm));
+	dm.dmCopies = 1;
+
+	ras = cupsRasterOpen(fd, CUPS_RASTER_READ);
+	while ( bRtn && ras && cupsRasterReadHeader(ras, &header) )
+	{
+		unsigned char	*RowData;
+		unsigned char	*PlaneData;
+		unsigned		WidthBytes = min(WIDTHBYTES_8(header.cupsWidth), header.cupsBytesPerLine);
+		int				nOutHeight = header.cupsHeight;
+		size_t			cbPlane = (size_t)WidthBytes * nOutHeight;
+		BENCHPAGE		*p;
+		int				y;
+
+		if ( (p = realloc(pages, (nPages + 1) * sizeof(BENCHPAGE))) == NULL )
+		{
+			bRtn = FALSE;
+			break;
+		}
+		pages = p;
+
+		RowData = MEMALLOC(header.cupsBytesPerLine);
+		PlaneData = MEMALLOC(cbPlane);
+		if ( RowData == NULL || PlaneData == NULL )
+		{
+			MEMFREE(RowData);
+			MEMFREE(PlaneData);
+			bRtn = FALSE;
+			break;
+		}
+
+		llStart = NowNs();
+		for (y = 0; y < header.cupsHeight; y ++)
+		{
+			if (cupsRasterReadPixels(ras, RowData, header.cupsBytesPerLine) < 1)
+			{
+				bRtn = FALSE;
+				break;
+			}
+			if (y < nOutHeight )
+				memmove(PlaneData + WidthBytes * y, RowData, WidthBytes);
+		}
+		result->llNs[STAGE_DECODE] += NowNs() - llStart;
+
+		llStart = NowNs();
+		for(y=0; y<cbPlane; y++)
+			PlaneData[y] = ~PlaneData[y];
+		result->llNs[STAGE_INVERT] += NowNs() - llStart;
+
+		llStart = NowNs();
+		pages[nPages].width  = header.cupsWidth;
+		pages[nPages].height = nOutHeight;
+		pages[nPages].offset = lseek(fdSpool, 0, SEEK_CUR);
+		pages[nPages].length = cbPlane;
+		if ( !WriteAll(fdSpool, PlaneData, cbPlane) )
+			bRtn = FALSE;
+		result->llNs[STAGE_SPOOL] += NowNs() - llStart;
+
+		result->llRows += header.cupsHeight;
+		result->llRasterBytes += (long long)header.cupsBytesPerLine * header.cupsHeight;
+		result->llPlaneBytes += cbPlane;
+		nPages++;
+
+		MEMFREE(RowData);
+		MEMFREE(PlaneData);
+	}
+	if ( ras )
+		cupsRasterClose(ras);
+	close(fd);
+
+	// Replay the spool as main() does, stdout is the sink
+	llStart = NowNs();
+	if ( (penc = TSPL_OpenEncoder(&dm, Metrics_WriteStdout, NULL)) == NULL )
+		bRtn = FALSE;
+	for (page=0; page<nPages && bRtn; page++)
+	{
+		unsigned char	*PlaneData = MEMALLOC(pages[page].length);
+		char			szBitmap[64];
+
+		if ( PlaneData == NULL || pread(fdSpool, PlaneData, pages[page].length, pages[page].offset) != pages[page].length )
+		{
+			MEMFREE(PlaneData);
+			bRtn = FALSE;
+			break;
+		}
+
+		TSPL_SendPageStart(penc);
+		snprintf(szBitmap, sizeof(szBitmap), "BITMAP %d,%d,%d,%d,%d,", 0, 0, WIDTHBYTES_8(pages[page].width), pages[page].height, DRAWMODE_OR);
+		WriteAll(fileno(stdout), szBitmap, strlen(szBitmap));
+		WriteAll(fileno(stdout), PlaneData, pages[page].length);
+		WriteAll(fileno(stdout), "\r\n", 2);
+		TSPL_SendPageEnd(penc);
+
+		MEMFREE(PlaneData);
+	}
+	result->llNs[STAGE_EMIT] += NowNs() - llStart;
+	TSPL_CloseEncoder(penc);
+
+	close(fdSpool);
+	MEMFREE(pages);
+
+	result->nPages = nPages;
+	result->llAllocs = s_llAllocs - llAllocs;
+	result->llAllocBytes = s_llAllocBytes - llAllocBytes;
+
+	if ( !bRtn || nPages == 0 )
+		Error_Log(LEVEL_ERROR, "Raster data error in %s\n", szFile);
+
+	return bRtn && nPages > 0;
+}
+
+static double MBps(long long llBytes, long long llNs)
+{
+	return llNs > 0 ? (double)llBytes * 1000.0 / llNs : 0;
+}
+
+static void Usage(void)
+{
+	fputs("Usage: rasterbench [-n iterations] [-o sink] file.ras ...\n", stderr);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char		*szSink = "/dev/null";
+	int				nIterations = 5;
+	int				fdSink;
+	FILE			*fpReport;
+	int				i, iter, s, opt;
+	int				iRtn = 0;
+
+	while ( (opt = getopt(argc, argv, "n:o:")) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'n':
+			nIterations = atoi(optarg);
+			break;
+		case 'o':
+			szSink = optarg;
+			break;
+		default:
+			Usage();
+		}
+	}
+	if ( optind >= argc || nIterations < 1 )
+		Usage();
+
+	// TSPL goes to stdout in the filter, keep the report on the old one
+	if ( (fpReport = fdopen(dup(fileno(stdout)), "w")) == NULL
+		|| (fdSink = open(szSink, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0
+		|| dup2(fdSink, fileno(stdout)) < 0 )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to open sink %s: %s\n", szSink, strerror(errno));
+		return 1;
+	}
+	close(fdSink);
+
+	fprintf(fpReport, "%-28s %5s %7s %8s", "file", "pages", "rows", "MB");
+	for (s=0; s<STAGE_NUM; s++)
+		fprintf(fpReport, " %8s", g_szStages[s]);
+	fprintf(fpReport, " %9s %9s %8s %10s\n", "MB/s", "Mrows/s", "allocs", "alloc KB");
+
+	for (i=optind; i<argc; i++)
+	{
+		BENCHRESULT		best, result;
+		const char		*szName = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+		long long		llTotal = 0;
+
+		// Best of n per stage, the page cache is warm after the first pass
+		memset(&best, 0, sizeof(best));
+		for (iter=0; iter<nIterations; iter++)
+		{
+			memset(&result, 0, sizeof(result));
+			if ( !RunOnce(argv[i], &result) )
+				break;
+			for (s=0; s<STAGE_NUM; s++)
+				if ( iter == 0 || result.llNs[s] < best.llNs[s] )
+					best.llNs[s] = result.llNs[s];
+			best.nPages = result.nPages;
+			best.llRows = result.llRows;
+			best.llRasterBytes = result.llRasterBytes;
+			best.llPlaneBytes = result.llPlaneBytes;
+			best.llAllocs = result.llAllocs;
+			best.llAllocBytes = result.llAllocBytes;
+		}
+		if ( iter < nIterations )
+		{
+			iRtn = 1;
+			continue;
+		}
+
+		// Per stage MB/s over the bytes that stage touches
+		fprintf(fpReport, "%-28s %5d %7lld %8.2f", szName, best.nPages, best.llRows, best.llRasterBytes / 1e6);
+		for (s=0; s<STAGE_NUM; s++)
+		{
+			fprintf(fpReport, " %8.1f", MBps(s == STAGE_DECODE ? best.llRasterBytes : best.llPlaneBytes, best.llNs[s]));
+			llTotal += best.llNs[s];
+		}
+		fprintf(fpReport, " %9.1f %9.2f %8lld %10lld\n",
+				MBps(best.llRasterBytes, llTotal),
+				llTotal > 0 ? best.llRows * 1000.0 / llTotal : 0,
+				best.llAllocs, best.llAllocBytes / 1024);
+	}
+
+	fclose(fpReport);
+	return iRtn;
+}
@@ -0,0 +1,450 @@
+/*
+ * "rastergen.c 2021-05-17 15:55:05
+ *  
+ *  synthetic CUPS raster generator for the TSC Printer Driver benchmarks
+ *  
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ 
+ */
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "raster.h"
+
+#include <sys/stat.h>
+
+// Writes CUPS raster streams shaped like the jobs the filter sees: 1 bit
+// black (cupsColorSpace 3), one header per page, optionally packbits
+// compressed (RaS2). The content is drawn from a fixed seed so every run
+// of the benchmark reads the same bytes.
+
+#define	KIND_SHIPPING			0		// Sparse: border, text lines, barcodes
+#define	KIND_DENSE				1		// Dithered image, little to compress
+#define	KIND_TALL				2		// Continuous media, shipping blocks repeated
+#define	KIND_RECEIPT			3		// Continuous media, text ending before the page
+
+typedef struct _GENPARAM
+{
+	int			nKind;
+	int			nDpi;
+	BOOL		bCompress;
+	float		fWidth;					// Inch
+	float		fLength;				// Inch
+	int			nPages;
+	DWORD		dwSeed;
+} GENPARAM;
+
+typedef struct _CORPUSENTRY
+{
+	int			nKind;
+	int			nDpi;
+	float		fWidth;
+	float		fLength;
+	int			nPages;
+} CORPUSENTRY;
+
+static const char	*g_szKinds[] = { "shipping", "dense", "tall", "receipt" };
+
+// Every entry is written plain and compressed
+static const CORPUSENTRY	g_Corpus[] =
+{
+	{ KIND_SHIPPING,	203,	4,	6,	4 },
+	{ KIND_SHIPPING,	300,	4,	6,	4 },
+	{ KIND_SHIPPING,	600,	4,	6,	2 },
+	{ KIND_DENSE,		203,	4,	6,	2 },
+	{ KIND_DENSE,		300,	4,	6,	2 },
+	{ KIND_DENSE,		600,	4,	6,	1 },
+	{ KIND_TALL,		203,	4,	60,	1 },
+	{ KIND_TALL,		300,	4,	40,	1 },
+	{ KIND_RECEIPT,		203,	3,	12,	4 },
+};
+
+static DWORD Random(DWORD *pdwSeed)
+{
+	*pdwSeed = *pdwSeed * 1103515245 + 12345;
+	return *pdwSeed >> 8;
+}
+
+static void FillRect(LPBYTE pPlane, int nBytesPerLine, int nWidth, int nHeight, int x, int y, int cx, int cy)
+{
+	int		i, j;
+
+	if ( x < 0 ) { cx += x; x = 0; }
+	if ( y < 0 ) { cy += y; y = 0; }
+	if ( x + cx > nWidth )
+		cx = nWidth - x;
+	if ( y + cy > nHeight )
+		cy = nHeight - y;
+
+	for (j=y; j<y+cy; j++)
+	{
+		LPBYTE	pRow = pPlane + (size_t)j * nBytesPerLine;
+
+		for (i=x; i<x+cx; i++)
+			pRow[i >> 3] |= 0x80 >> (i & 7);
+	}
+}
+
+// Text lines from y0 to y1, glyphs are blocks of random strokes
+static void DrawText(LPBYTE pPlane, int nBytesPerLine, int nWidth, int nHeight, int nDpi, int y0, int y1, DWORD *pdwSeed)
+{
+	int		nLine = nDpi / 100 + 1;
+	int		nChar = nDpi / 12;
+	int		x, y, i;
+
+	for (y=y0; y<y1; y+=nChar * 3 / 2)
+	{
+		int		nChars = 8 + Random(pdwSeed) % 24;
+
+		for (i=0, x=nDpi / 8; i<nChars && x + nChar < nWidth - nDpi / 8; i++, x+=nChar * 3 / 4)
+		{
+			int		s;
+
+			if ( Random(pdwSeed) % 6 == 0 )
+				continue;						// space
+			for (s=0; s<3; s++)
+			{
+				if ( Random(pdwSeed) & 1 )
+					FillRect(pPlane, nBytesPerLine, nWidth, nHeight, x, y + s * nChar / 3, nChar / 2, nLine);
+				else
+					FillRect(pPlane, nBytesPerLine, nWidth, nHeight, x + s * nChar / 6, y, nLine, nChar);
+			}
+		}
+	}
+}
+
+// A 4x6 shipping label: frame, address blocks, a 1D and a 2D code
+static void DrawShipping(LPBYTE pPlane, int nBytesPerLine, int nWidth, int nHeight, int nDpi, DWORD *pdwSeed)
+{
+	int		nLine = nDpi / 100 + 1;
+	int		x, y, i;
+
+	// Frame and section rules
+	FillRect(pPlane, nBytesPerLine, nWidth, nHeight, 0, 0, nWidth, nLine);
+	FillRect(pPlane, nBytesPerLine, nWidth, nHeight, 0, nHeight - nLine, nWidth, nLine);
+	FillRect(pPlane, nBytesPerLine, nWidth, nHeight, 0, 0, nLine, nHeight);
+	FillRect(pPlane, nBytesPerLine, nWidth, nHeight, nWidth - nLine, 0, nLine, nHeight);
+	for (i=1; i<4; i++)
+		FillRect(pPlane, nBytesPerLine, nWidth, nHeight, 0, nHeight * i / 4, nWidth, nLine);
+
+	// Text lines
+	DrawText(pPlane, nBytesPerLine, nWidth, nHeight, nDpi, nDpi / 8, nHeight / 2, pdwSeed);
+
+	// Code 128 like bars, one inch tall
+	y = nHeight / 2 + nDpi / 8;
+	for (x=nDpi / 4; x<nWidth - nDpi / 4; )
+	{
+		int		nBar   = (1 + Random(pdwSeed) % 4) * nLine;
+		int		nSpace = (1 + Random(pdwSeed) % 4) * nLine;
+
+		FillRect(pPlane, nBytesPerLine, nWidth, nHeight, x, y, nBar, nDpi);
+		x += nBar + nSpace;
+	}
+
+	// Data matrix like square in the last section
+	{
+		int		nModule = nDpi / 30;
+		int		x0 = nDpi / 4;
+		int		y0 = nHeight * 3 / 4 + nDpi / 8;
+
+		for (y=0; y<24; y++)
+			for (x=0; x<24; x++)
+				if ( x == 0 || y == 23 || (Random(pdwSeed) & 1) )
+					FillRect(pPlane, nBytesPerLine, nWidth, nHeight, x0 + x * nModule, y0 + y * nModule, nModule, nModule);
+	}
+}
+
+// Ordered dither of a diagonal gradient with noise, a photo on a label
+static void DrawDense(LPBYTE pPlane, int nBytesPerLine, int nWidth, int nHeight, DWORD *pdwSeed)
+{
+	static const BYTE	Bayer[4][4] =
+	{
+		{  0, 128,  32, 160 },
+		{ 192,  64, 224,  96 },
+		{  48, 176,  16, 144 },
+		{ 240, 112, 208,  80 },
+	};
+	int		x, y;
+
+	for (y=0; y<nHeight; y++)
+	{
+		LPBYTE	pRow = pPlane + (size_t)y * nBytesPerLine;
+
+		for (x=0; x<nWidth; x++)
+		{
+			int		nLevel = (x + y) * 255 / (nWidth + nHeight) + (int)(Random(pdwSeed) % 64) - 32;
+
+			if ( nLevel > Bayer[y & 3][x & 3] )
+				pRow[x >> 3] |= 0x80 >> (x & 7);
+		}
+	}
+}
+
+static void DrawPage(const GENPARAM *param, LPBYTE pPlane, int nBytesPerLine, int nWidth, int nHeight, DWORD *pdwSeed)
+{
+	int		y, nSection;
+
+	switch ( param->nKind )
+	{
+	case KIND_SHIPPING:
+		DrawShipping(pPlane, nBytesPerLine, nWidth, nHeight, param->nDpi, pdwSeed);
+		break;
+	case KIND_DENSE:
+		DrawDense(pPlane, nBytesPerLine, nWidth, nHeight, pdwSeed);
+		break;
+	case KIND_TALL:
+		// Continuous media, a 6 inch block after another
+		nSection = param->nDpi * 6;
+		for (y=0; y<nHeight; y+=nSection)
+			DrawShipping(pPlane + (size_t)y * nBytesPerLine, nBytesPerLine, nWidth, min(nSection, nHeight - y), param->nDpi, pdwSeed);
+		break;
+	case KIND_RECEIPT:
+		// Between a tenth and the half of the page, the rest is blank
+		nSection = nHeight / 10 + Random(pdwSeed) % (nHeight * 4 / 10 + 1);
+		DrawText(pPlane, nBytesPerLine, nWidth, nHeight, param->nDpi, param->nDpi / 8, nSection, pdwSeed);
+		break;
+	}
+}
+
+// Modified packbits of cupsRasterReadPixels(), 1 byte pixels: a line
+// repeat count, then runs (0..127 = n+1 copies) and literals (257-n)
+static size_t PackRows(const BYTE *pRow, int nBytesPerLine, int nRepeat, LPBYTE pOut)
+{
+	LPBYTE	p = pOut;
+	int		x = 0;
+
+	*p++ = (BYTE)(nRepeat - 1);
+	while ( x < nBytesPerLine )
+	{
+		int		n = 1;
+
+		if ( x + 1 < nBytesPerLine && pRow[x] == pRow[x + 1] )
+		{
+			while ( x + n < nBytesPerLine && n < 128 && pRow[x + n] == pRow[x] )
+				n++;
+			*p++ = (BYTE)(n - 1);
+			*p++ = pRow[x];
+		}
+		else
+		{
+			while ( x + n < nBytesPerLine && n < 128 && !(x + n + 1 < nBytesPerLine && pRow[x + n] == pRow[x + n + 1]) )
+				n++;
+			if ( n == 1 )
+			{
+				*p++ = 0;
+			}
+			else
+			{
+				*p++ = (BYTE)(257 - n);
+			}
+			memcpy(p, pRow + x, n);
+			p += n;
+		}
+		x += n;
+	}
+
+	return p - pOut;
+}
+
+static BOOL WriteRaster(const GENPARAM *param, FILE *fp)
+{
+	cups_page_header2_t	header;
+	unsigned			sync = param->bCompress ? CUPS_RASTER_SYNCv2 : CUPS_RASTER_SYNC;
+	int					nWidth  = (int)(param->fWidth * param->nDpi + 0.5);
+	int					nHeight = (int)(param->fLength * param->nDpi + 0.5);
+	int					nBytesPerLine = WIDTHBYTES_8(nWidth);
+	LPBYTE				pPlane, pPack;
+	DWORD				dwSeed = param->dwSeed;
+	int					page, y;
+	BOOL				bRtn = TRUE;
+
+	memset(&header, 0, sizeof(header));
+	header.HWResolution[0]			= param->nDpi;
+	header.HWResolution[1]			= param->nDpi;
+	header.PageSize[0]				= (unsigned)(param->fWidth * 72 + 0.5);
+	header.PageSize[1]				= (unsigned)(param->fLength * 72 + 0.5);
+	header.ImagingBoundingBox[2]	= header.PageSize[0];
+	header.ImagingBoundingBox[3]	= header.PageSize[1];
+	header.NumCopies				= 1;
+	header.cupsWidth				= nWidth;
+	header.cupsHeight				= nHeight;
+	header.cupsBitsPerColor			= 1;
+	header.cupsBitsPerPixel			= 1;
+	header.cupsBytesPerLine			= nBytesPerLine;
+	header.cupsColorOrder			= CUPS_ORDER_CHUNKED;
+	header.cupsColorSpace			= CUPS_CSPACE_K;
+	header.cupsRowCount				= 8;
+	header.cupsNumColors			= 1;
+
+	pPlane = MEMALLOC((size_t)nBytesPerLine * nHeight);
+	pPack  = MEMALLOC(2 * nBytesPerLine + 1);			// Lone bytes cost two
+	if ( pPlane == NULL || pPack == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "No memory: %s\n", strerror(errno));
+		MEMFREE(pPlane);
+		MEMFREE(pPack);
+		return FALSE;
+	}
+
+	fwrite(&sync, sizeof(sync), 1, fp);
+	for (page=0; page<param->nPages && bRtn; page++)
+	{
+		memset(pPlane, 0, (size_t)nBytesPerLine * nHeight);
+		DrawPage(param, pPlane, nBytesPerLine, nWidth, nHeight, &dwSeed);
+
+		fwrite(&header, sizeof(header), 1, fp);
+		if ( !param->bCompress )
+		{
+			fwrite(pPlane, nBytesPerLine, nHeight, fp);
+		}
+		else
+		{
+			for (y=0; y<nHeight; )
+			{
+				const BYTE	*pRow = pPlane + (size_t)y * nBytesPerLine;
+				int			nRepeat = 1;
+
+				while ( nRepeat < 256 && y + nRepeat < nHeight && !memcmp(pRow, pRow + (size_t)nRepeat * nBytesPerLine, nBytesPerLine) )
+					nRepeat++;
+				fwrite(pPack, 1, PackRows(pRow, nBytesPerLine, nRepeat, pPack), fp);
+				y += nRepeat;
+			}
+		}
+		bRtn = !ferror(fp);
+	}
+
+	MEMFREE(pPlane);
+	MEMFREE(pPack);
+	return bRtn;
+}
+
+static BOOL WriteCorpus(const char *szDir)
+{
+	GENPARAM	param;
+	char		szFile[1024];
+	FILE		*fp;
+	BOOL		bRtn;
+	int			i, c;
+
+	mkdir(szDir, 0755);
+	for (i=0; i<sizeof(g_Corpus) / sizeof(g_Corpus[0]); i++)
+	{
+		for (c=0; c<2; c++)
+		{
+			param.nKind		= g_Corpus[i].nKind;
+			param.nDpi		= g_Corpus[i].nDpi;
+			param.fWidth	= g_Corpus[i].fWidth;
+			param.fLength	= g_Corpus[i].fLength;
+			param.nPages	= g_Corpus[i].nPages;
+			param.bCompress	= c;
+			param.dwSeed	= i + 1;
+
+			snprintf(szFile, sizeof(szFile), "%s/%s-%d-%s.ras", szDir, g_szKinds[param.nKind], param.nDpi, c ? "packed" : "plain");
+			if ( (fp = fopen(szFile, "wb")) == NULL )
+			{
+				Error_Log(LEVEL_ERROR, "Unable to create %s: %s\n", szFile, strerror(errno));
+				return FALSE;
+			}
+			bRtn = WriteRaster(&param, fp);
+			if ( fclose(fp) || !bRtn )
+			{
+				Error_Log(LEVEL_ERROR, "Unable to write %s: %s\n", szFile, strerror(errno));
+				return FALSE;
+			}
+			printf("%s\n", szFile);
+		}
+	}
+
+	return TRUE;
+}
+
+static void Usage(void)
+{
+	fputs("Usage: rastergen [-k shipping|dense|tall|receipt] [-r dpi] [-c] [-w inch] [-l inch]\n"
+		  "                 [-p pages] [-s seed] [file]\n"
+		  "       rastergen -a directory\n", stderr);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	GENPARAM	param;
+	FILE		*fp = stdout;
+	int			i, opt;
+
+	param.nKind		= KIND_SHIPPING;
+	param.nDpi		= 203;
+	param.bCompress	= FALSE;
+	param.fWidth	= 4;
+	param.fLength	= 0;
+	param.nPages	= 1;
+	param.dwSeed	= 1;
+
+	while ( (opt = getopt(argc, argv, "a:k:r:cw:l:p:s:")) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'a':
+			return WriteCorpus(optarg) ? 0 : 1;
+		case 'k':
+			for (i=0; i<sizeof(g_szKinds) / sizeof(g_szKinds[0]); i++)
+				if ( !strcmp(optarg, g_szKinds[i]) )
+					break;
+			if ( i == sizeof(g_szKinds) / sizeof(g_szKinds[0]) )
+				Usage();
+			param.nKind = i;
+			break;
+		case 'r':
+			param.nDpi = atoi(optarg);
+			break;
+		case 'c':
+			param.bCompress = TRUE;
+			break;
+		case 'w':
+			param.fWidth = atof(optarg);
+			break;
+		case 'l':
+			param.fLength = atof(optarg);
+			break;
+		case 'p':
+			param.nPages = atoi(optarg);
+			break;
+		case 's':
+			param.dwSeed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			Usage();
+		}
+	}
+
+	if ( param.fLength <= 0 )
+		param.fLength = param.nKind == KIND_TALL ? 40 : 6;
+	if ( param.nDpi <= 0 || param.fWidth <= 0 || param.nPages <= 0 )
+		Usage();
+
+	if ( optind < argc && (fp = fopen(argv[optind], "wb")) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to create %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+
+	if ( !WriteRaster(&param, fp) )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to write raster: %s\n", strerror(errno));
+		return 1;
+	}
+
+	return fclose(fp) ? 1 : 0;
+}
@@ -0,0 +1,659 @@
+/*
+ * "tsplemu.c 2021-05-17 15:55:05
+ *  
+ *  TSPL printer emulator for TSC Printer Driver
+ *  
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ 
+ */
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "raster.h"
+
+// A stand-in printer for what tspl.c and rastertotspl.c send: the stream
+// is interpreted into a 1 bit label image (1 = black) per PRINT, timed
+// against a link and print head model, and optionally compared pixel by
+// pixel with the raster the job was made from.
+
+#define	DRAWMODE_OVERWRITE		0
+#define	DRAWMODE_OR				1
+#define	DRAWMODE_XOR			2
+
+#define	MAX_FILES				32
+
+typedef struct _EMUFILE
+{
+	char			szName[64];
+	LPBYTE			pData;				// Points into the stream
+	DWORD			cbData;
+} EMUFILE;
+
+typedef struct _EMULATOR
+{
+	int				nDpi;
+	double			dLinkBps;			// Bits per second
+	double			dSpeedIps;			// Print head, 0 = from SPEED
+	BOOL			bSpeedFixed;
+
+	double			dWidth;				// Label, inch, 0 until SIZE
+	double			dLength;
+	double			dGap;
+
+	int				cx;					// Canvas, dot
+	int				cy;
+	int				cbLine;
+	LPBYTE			pCanvas;
+
+	EMUFILE			files[MAX_FILES];
+	int				nFiles;
+
+	// Results
+	long long		llLabels;
+	long long		llPrints;			// PRINT commands, one image each
+	long long		llUnknown;
+	double			dPrinterEnd;		// Head model, seconds
+	double			dPrinterBusy;
+	double			dLastArrival;
+
+	// Compare
+	LPBYTE			*ppPages;			// Raster pages, 1 = black
+	int				*pcxPages;
+	int				*pcyPages;
+	int				nPages;
+	long long		llMismatch;
+	long long		llLabelsBad;
+
+	const char		*szPbmPrefix;
+} EMULATOR;
+
+static BOOL SetCanvas(EMULATOR *emu, int cx, int cy, BOOL bKeep)
+{
+	int		cbLine = WIDTHBYTES_8(cx);
+	LPBYTE	pCanvas;
+	int		y;
+
+	if ( cx <= 0 || cy <= 0 )
+		return FALSE;
+
+	if ( (pCanvas = MEMALLOC((size_t)cbLine * cy)) == NULL )
+		return FALSE;
+
+	if ( bKeep && emu->pCanvas )
+		for (y=0; y<min(cy, emu->cy); y++)
+			memcpy(pCanvas + (size_t)y * cbLine, emu->pCanvas + (size_t)y * emu->cbLine, min(cbLine, emu->cbLine));
+
+	MEMFREE(emu->pCanvas);
+	emu->pCanvas = pCanvas;
+	emu->cx = cx;
+	emu->cy = cy;
+	emu->cbLine = cbLine;
+	return TRUE;
+}
+
+// Without SIZE the canvas grows to what is drawn
+static BOOL FitCanvas(EMULATOR *emu, int right, int bottom)
+{
+	if ( emu->pCanvas && right <= emu->cx && bottom <= emu->cy )
+		return TRUE;
+	if ( emu->dWidth > 0 && emu->pCanvas )
+		return TRUE;					// Clipped to the label
+	return SetCanvas(emu, max(right, emu->cx), max(bottom, emu->cy), TRUE);
+}
+
+static void FillRect(EMULATOR *emu, int x, int y, int cx, int cy, BOOL bInvert)
+{
+	int		i, j;
+
+	if ( !FitCanvas(emu, x + cx, y + cy) )
+		return;
+	if ( x < 0 ) { cx += x; x = 0; }
+	if ( y < 0 ) { cy += y; y = 0; }
+	cx = min(cx, emu->cx - x);
+	cy = min(cy, emu->cy - y);
+
+	for (j=y; j<y+cy; j++)
+	{
+		LPBYTE	pRow = emu->pCanvas + (size_t)j * emu->cbLine;
+
+		for (i=x; i<x+cx; i++)
+		{
+			if ( bInvert )
+				pRow[i >> 3] ^= 0x80 >> (i & 7);
+			else
+				pRow[i >> 3] |= 0x80 >> (i & 7);
+		}
+	}
+}
+
+// TSPL bitmaps print 0 bits
+static void DrawBitmap(EMULATOR *emu, int x, int y, int cbWidth, int cy, int nMode, const BYTE *pBits, int cbStride, BOOL bBottomUp)
+{
+	int		i, j;
+
+	if ( !FitCanvas(emu, x + cbWidth * 8, y + cy) )
+		return;
+
+	for (j=0; j<cy; j++)
+	{
+		const BYTE	*pSrc = pBits + (size_t)(bBottomUp ? cy - 1 - j : j) * cbStride;
+		LPBYTE		pRow;
+
+		if ( y + j < 0 || y + j >= emu->cy )
+			continue;
+		pRow = emu->pCanvas + (size_t)(y + j) * emu->cbLine;
+
+		for (i=0; i<cbWidth * 8; i++)
+		{
+			int		px = x + i;
+			BOOL	bBlack = !(pSrc[i >> 3] & (0x80 >> (i & 7)));
+			BYTE	mask = 0x80 >> (px & 7);
+
+			if ( px < 0 || px >= emu->cx )
+				continue;
+
+			switch ( nMode )
+			{
+			case DRAWMODE_OVERWRITE:
+				if ( bBlack )
+					pRow[px >> 3] |= mask;
+				else
+					pRow[px >> 3] &= ~mask;
+				break;
+			case DRAWMODE_OR:
+				if ( bBlack )
+					pRow[px >> 3] |= mask;
+				break;
+			case DRAWMODE_XOR:
+				if ( bBlack )
+					pRow[px >> 3] ^= mask;
+				break;
+			}
+		}
+	}
+}
+
+static double ParseLength(EMULATOR *emu, const char *s, BOOL bDots)
+{
+	double	v = atof(s);
+
+	while ( *s == ' ' || *s == '-' || *s == '.' || isdigit((unsigned char)*s) )
+		s++;
+	if ( !strncasecmp(s, "mm", 2) )
+		return v / 25.4;
+	if ( !strncasecmp(s, "dot", 3) || bDots )
+		return v / emu->nDpi;
+	return v;
+}
+
+static EMUFILE* FindFile(EMULATOR *emu, const char *szName)
+{
+	int		i;
+
+	for (i=0; i<emu->nFiles; i++)
+		if ( !strcasecmp(emu->files[i].szName, szName) )
+			return &emu->files[i];
+	return NULL;
+}
+
+// Copy a quoted argument, returns the character after the closing quote
+static const char* ParseQuoted(const char *s, char *szOut, size_t cbOut)
+{
+	size_t	n = 0;
+
+	while ( *s && *s != '"' )
+		s++;
+	if ( *s == '"' )
+		s++;
+	while ( *s && *s != '"' && *s != '\r' && *s != '\n' )
+	{
+		if ( n + 1 < cbOut )
+			szOut[n++] = *s;
+		s++;
+	}
+	szOut[n] = 0;
+	return *s == '"' ? s + 1 : s;
+}
+
+// 1 bit BMP from DOWNLOAD, placed like a BITMAP in overwrite mode
+static void PutBmp(EMULATOR *emu, int x, int y, const EMUFILE *file)
+{
+	const BYTE	*p = file->pData;
+	DWORD		dwOffBits, dwWidth;
+	LONG		nHeight;
+	WORD		wBits;
+
+	if ( file->cbData < 54 || p[0] != 'B' || p[1] != 'M' )
+		return;
+
+	dwOffBits = p[10] | p[11] << 8 | p[12] << 16 | (DWORD)p[13] << 24;
+	dwWidth   = p[18] | p[19] << 8 | p[20] << 16 | (DWORD)p[21] << 24;
+	nHeight   = p[22] | p[23] << 8 | p[24] << 16 | (DWORD)p[25] << 24;
+	wBits     = p[28] | p[29] << 8;
+
+	if ( wBits != 1 || dwOffBits + WIDTHBYTES_32(dwWidth) * (DWORD)abs(nHeight) > file->cbData )
+		return;
+
+	// Palette entry 0 is taken as black, as the driver's BMPs have it
+	{
+		BYTE	*pBits = MEMALLOC(WIDTHBYTES_32(dwWidth) * abs(nHeight));
+		DWORD	i;
+
+		if ( pBits == NULL )
+			return;
+		for (i=0; i<WIDTHBYTES_32(dwWidth) * abs(nHeight); i++)
+			pBits[i] = p[dwOffBits + i];
+		DrawBitmap(emu, x, y, WIDTHBYTES_8(dwWidth), abs(nHeight), DRAWMODE_OVERWRITE, pBits, WIDTHBYTES_32(dwWidth), nHeight > 0);
+		MEMFREE(pBits);
+	}
+}
+
+static void WritePbm(EMULATOR *emu)
+{
+	char	szFile[1024];
+	FILE	*fp;
+
+	snprintf(szFile, sizeof(szFile), "%s%04lld.pbm", emu->szPbmPrefix, emu->llPrints);
+	if ( (fp = fopen(szFile, "wb")) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to create %s: %s\n", szFile, strerror(errno));
+		return;
+	}
+	fprintf(fp, "P4\n%d %d\n", emu->cx, emu->cy);
+	fwrite(emu->pCanvas, emu->cbLine, emu->cy, fp);
+	fclose(fp);
+}
+
+// Collated copies cycle through the pages, so print n is page n % pages
+static void ComparePage(EMULATOR *emu)
+{
+	int			nPage = (int)((emu->llPrints - 1) % emu->nPages);
+	const BYTE	*pPage = emu->ppPages[nPage];
+	int			cbPage = WIDTHBYTES_8(emu->pcxPages[nPage]);
+	long long	llBad = 0;
+	int			x, y;
+
+	for (y=0; y<max(emu->cy, emu->pcyPages[nPage]); y++)
+	{
+		for (x=0; x<max(emu->cx, emu->pcxPages[nPage]); x++)
+		{
+			BOOL	bLabel = x < emu->cx && y < emu->cy && (emu->pCanvas[(size_t)y * emu->cbLine + (x >> 3)] & (0x80 >> (x & 7)));
+			BOOL	bPage  = x < emu->pcxPages[nPage] && y < emu->pcyPages[nPage] && (pPage[(size_t)y * cbPage + (x >> 3)] & (0x80 >> (x & 7)));
+
+			// The label may be smaller than the raster, it is cut there
+			if ( bPage && (x >= emu->cx || y >= emu->cy) )
+				continue;
+			if ( !bLabel != !bPage )
+				llBad++;
+		}
+	}
+
+	if ( llBad )
+	{
+		Error_Log(LEVEL_INFO, "Label %lld differs from page %d in %lld pixels\n", emu->llPrints, nPage + 1, llBad);
+		emu->llLabelsBad++;
+		emu->llMismatch += llBad;
+	}
+}
+
+static void Print(EMULATOR *emu, int nSets, int nCopies, size_t cbArrived)
+{
+	double	dArrival = cbArrived * 8.0 / emu->dLinkBps;
+	double	dFeed = (emu->dLength > 0 ? emu->dLength : (double)emu->cy / emu->nDpi) + emu->dGap;
+	double	dIps = emu->dSpeedIps > 0 ? emu->dSpeedIps : 4;
+	long long	llLabels = (long long)max(nSets, 1) * max(nCopies, 1);
+	double	dBusy = llLabels * dFeed / dIps;
+
+	if ( emu->pCanvas == NULL )
+		return;
+
+	// The head starts once the PRINT is in and the last label is out
+	emu->dPrinterEnd = max(emu->dPrinterEnd, dArrival) + dBusy;
+	emu->dPrinterBusy += dBusy;
+	emu->dLastArrival = dArrival;
+
+	emu->llPrints++;
+	emu->llLabels += llLabels;
+
+	if ( emu->szPbmPrefix )
+		WritePbm(emu);
+	if ( emu->nPages )
+		ComparePage(emu);
+}
+
+static size_t LineEnd(const BYTE *pData, size_t cbData, size_t pos)
+{
+	while ( pos < cbData && pData[pos] != '\r' && pData[pos] != '\n' )
+		pos++;
+	return pos;
+}
+
+static size_t SkipLineEnd(const BYTE *pData, size_t cbData, size_t pos)
+{
+	while ( pos < cbData && (pData[pos] == '\r' || pData[pos] == '\n') )
+		pos++;
+	return pos;
+}
+
+static void Interpret(EMULATOR *emu, LPBYTE pData, size_t cbData)
+{
+	size_t		pos = SkipLineEnd(pData, cbData, 0);
+
+	while ( pos < cbData )
+	{
+		size_t		end = LineEnd(pData, cbData, pos);
+		char		szLine[1024];
+		char		szCmd[32];
+		const char	*pArgs;
+		int			a[5];
+
+		snprintf(szLine, sizeof(szLine), "%.*s", (int)min(end - pos, sizeof(szLine) - 1), (const char *)pData + pos);
+		if ( sscanf(szLine, "%31[A-Za-z~!]", szCmd) != 1 )
+		{
+			emu->llUnknown++;
+			pos = SkipLineEnd(pData, cbData, end);
+			continue;
+		}
+		pArgs = szLine + strlen(szCmd);
+		while ( *pArgs == ' ' )
+			pArgs++;
+
+		if ( !strcasecmp(szCmd, "BITMAP") )
+		{
+			// The data follows the 5th comma and may hold CR/LF bytes
+			size_t	data = pos;
+			int		nComma = 0;
+
+			while ( data < cbData && nComma < 5 )
+				if ( pData[data++] == ',' )
+					nComma++;
+			if ( nComma < 5 || sscanf(pArgs, "%d,%d,%d,%d,%d", &a[0], &a[1], &a[2], &a[3], &a[4]) != 5
+				|| a[2] <= 0 || a[3] <= 0 || data + (size_t)a[2] * a[3] > cbData )
+			{
+				Error_Log(LEVEL_ERROR, "Bad BITMAP at byte %zu\n", pos);
+				break;
+			}
+			DrawBitmap(emu, a[0], a[1], a[2], a[3], a[4], pData + data, a[2], FALSE);
+			pos = SkipLineEnd(pData, cbData, data + (size_t)a[2] * a[3]);
+			continue;
+		}
+		else if ( !strcasecmp(szCmd, "DOWNLOAD") )
+		{
+			// DOWNLOAD [F,]"NAME",size,data
+			char		szName[64];
+			const char	*p = ParseQuoted(pArgs, szName, sizeof(szName));
+			size_t		data, cb;
+
+			if ( *p == ',' )
+			{
+				cb = strtoul(p + 1, NULL, 10);
+				data = pos + (strchr(p + 1, ',') ? strchr(p + 1, ',') + 1 - szLine : end - pos);
+				if ( data + cb <= cbData && emu->nFiles < MAX_FILES )
+				{
+					EMUFILE	*file = FindFile(emu, szName) ? FindFile(emu, szName) : &emu->files[emu->nFiles++];
+
+					snprintf(file->szName, sizeof(file->szName), "%s", szName);
+					file->pData = pData + data;
+					file->cbData = cb;
+				}
+				pos = SkipLineEnd(pData, cbData, data + cb);
+				continue;
+			}
+			// A BASIC program up to EOP, nothing to draw
+			while ( pos < cbData && strncasecmp((const char *)pData + pos, "EOP", 3) )
+				pos = SkipLineEnd(pData, cbData, LineEnd(pData, cbData, pos));
+			end = LineEnd(pData, cbData, pos);
+		}
+		else if ( !strcasecmp(szCmd, "SIZE") )
+		{
+			const char	*p = strchr(pArgs, ',');
+
+			emu->dWidth = ParseLength(emu, pArgs, FALSE);
+			emu->dLength = p ? ParseLength(emu, p + 1, FALSE) : emu->dLength;
+			if ( emu->dWidth > 0 && emu->dLength > 0 )
+				SetCanvas(emu, (int)(emu->dWidth * emu->nDpi + 0.5), (int)(emu->dLength * emu->nDpi + 0.5), FALSE);
+		}
+		else if ( !strcasecmp(szCmd, "GAP") || !strcasecmp(szCmd, "BLINE") )
+		{
+			emu->dGap = ParseLength(emu, pArgs, FALSE);
+		}
+		else if ( !strcasecmp(szCmd, "SPEED") )
+		{
+			if ( !emu->bSpeedFixed )
+				emu->dSpeedIps = atof(pArgs);
+		}
+		else if ( !strcasecmp(szCmd, "CLS") )
+		{
+			if ( emu->pCanvas )
+				memset(emu->pCanvas, 0, (size_t)emu->cbLine * emu->cy);
+		}
+		else if ( !strcasecmp(szCmd, "BAR") )
+		{
+			if ( sscanf(pArgs, "%d,%d,%d,%d", &a[0], &a[1], &a[2], &a[3]) == 4 )
+				FillRect(emu, a[0], a[1], a[2], a[3], FALSE);
+		}
+		else if ( !strcasecmp(szCmd, "BOX") )
+		{
+			// BOX x,y,x_end,y_end,thickness
+			if ( sscanf(pArgs, "%d,%d,%d,%d,%d", &a[0], &a[1], &a[2], &a[3], &a[4]) == 5 )
+			{
+				FillRect(emu, a[0], a[1], a[2] - a[0], a[4], FALSE);
+				FillRect(emu, a[0], a[3] - a[4], a[2] - a[0], a[4], FALSE);
+				FillRect(emu, a[0], a[1], a[4], a[3] - a[1], FALSE);
+				FillRect(emu, a[2] - a[4], a[1], a[4], a[3] - a[1], FALSE);
+			}
+		}
+		else if ( !strcasecmp(szCmd, "REVERSE") )
+		{
+			if ( sscanf(pArgs, "%d,%d,%d,%d", &a[0], &a[1], &a[2], &a[3]) == 4 )
+				FillRect(emu, a[0], a[1], a[2], a[3], TRUE);
+		}
+		else if ( !strcasecmp(szCmd, "PUTBMP") )
+		{
+			char		szName[64];
+			EMUFILE		*file;
+
+			if ( sscanf(pArgs, "%d,%d", &a[0], &a[1]) == 2 )
+			{
+				ParseQuoted(pArgs, szName, sizeof(szName));
+				if ( (file = FindFile(emu, szName)) != NULL )
+					PutBmp(emu, a[0], a[1], file);
+				else
+					Error_Log(LEVEL_WARNING, "PUTBMP of unknown file %s\n", szName);
+			}
+		}
+		else if ( !strcasecmp(szCmd, "PRINT") )
+		{
+			a[0] = 1;
+			a[1] = 1;
+			sscanf(pArgs, "%d,%d", &a[0], &a[1]);
+			Print(emu, a[0], a[1], end);
+		}
+		else if ( strcasecmp(szCmd, "DIRECTION") && strcasecmp(szCmd, "REFERENCE") && strcasecmp(szCmd, "OFFSET")
+				&& strcasecmp(szCmd, "SHIFT") && strcasecmp(szCmd, "SET") && strcasecmp(szCmd, "DENSITY")
+				&& strcasecmp(szCmd, "KILL") && strcasecmp(szCmd, "EOP") && strcasecmp(szCmd, "MOVE") )
+		{
+			DebugPrintf("Unknown command '%s'\n", szLine);
+			emu->llUnknown++;
+		}
+
+		pos = SkipLineEnd(pData, cbData, end);
+	}
+}
+
+// The job's raster pages, black bits set, for the pixel compare
+static BOOL LoadRaster(EMULATOR *emu, const char *szFile)
+{
+	cups_raster_t		*ras;
+	cups_page_header_t	header;
+	int					fd, y;
+	BOOL				bRtn = TRUE;
+
+	if ( (fd = open(szFile, O_RDONLY)) < 0 || (ras = cupsRasterOpen(fd, CUPS_RASTER_READ)) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to open raster %s: %s\n", szFile, strerror(errno));
+		if ( fd >= 0 )
+			close(fd);
+		return FALSE;
+	}
+
+	while ( bRtn && cupsRasterReadHeader(ras, &header) )
+	{
+		int		cbLine = WIDTHBYTES_8(header.cupsWidth);
+		LPBYTE	pRow = MEMALLOC(header.cupsBytesPerLine);
+		LPBYTE	pPage = MEMALLOC((size_t)cbLine * header.cupsHeight);
+
+		emu->ppPages = realloc(emu->ppPages, (emu->nPages + 1) * sizeof(LPBYTE));
+		emu->pcxPages = realloc(emu->pcxPages, (emu->nPages + 1) * sizeof(int));
+		emu->pcyPages = realloc(emu->pcyPages, (emu->nPages + 1) * sizeof(int));
+		if ( pRow == NULL || pPage == NULL || !emu->ppPages || !emu->pcxPages || !emu->pcyPages )
+		{
+			MEMFREE(pRow);
+			MEMFREE(pPage);
+			bRtn = FALSE;
+			break;
+		}
+
+		for (y=0; y<header.cupsHeight; y++)
+		{
+			if ( cupsRasterReadPixels(ras, pRow, header.cupsBytesPerLine) < 1 )
+			{
+				bRtn = FALSE;
+				break;
+			}
+			memcpy(pPage + (size_t)y * cbLine, pRow, min(cbLine, header.cupsBytesPerLine));
+		}
+		MEMFREE(pRow);
+
+		emu->ppPages[emu->nPages] = pPage;
+		emu->pcxPages[emu->nPages] = header.cupsWidth;
+		emu->pcyPages[emu->nPages] = header.cupsHeight;
+		emu->nPages++;
+	}
+
+	cupsRasterClose(ras);
+	close(fd);
+	return bRtn && emu->nPages > 0;
+}
+
+static LPBYTE ReadAll(const char *szFile, size_t *pcbData)
+{
+	int		fd = szFile ? open(szFile, O_RDONLY) : 0;
+	LPBYTE	pData = NULL;
+	size_t	cbAlloc = 0;
+	ssize_t	n;
+
+	*pcbData = 0;
+	if ( fd < 0 )
+		return NULL;
+
+	do
+	{
+		if ( *pcbData == cbAlloc )
+		{
+			LPBYTE	p = realloc(pData, cbAlloc = cbAlloc ? cbAlloc * 2 : 1 << 20);
+
+			if ( p == NULL )
+			{
+				MEMFREE(pData);
+				break;
+			}
+			pData = p;
+		}
+		n = read(fd, pData + *pcbData, cbAlloc - *pcbData);
+		if ( n > 0 )
+			*pcbData += n;
+	} while ( n > 0 || (n < 0 && errno == EINTR) );
+
+	if ( fd != 0 )
+		close(fd);
+	return pData;
+}
+
+static void Usage(void)
+{
+	fputs("Usage: tsplemu [-r dpi] [-b link-bps] [-s ips] [-c input.ras] [-o pbm-prefix] [file.tspl]\n", stderr);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	EMULATOR	emu;
+	LPBYTE		pData;
+	size_t		cbData;
+	const char	*szRaster = NULL;
+	int			opt;
+
+	memset(&emu, 0, sizeof(emu));
+	emu.nDpi = 203;
+	emu.dLinkBps = 12e6;				// USB full speed
+
+	while ( (opt = getopt(argc, argv, "r:b:s:c:o:")) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'r':
+			emu.nDpi = atoi(optarg);
+			break;
+		case 'b':
+			emu.dLinkBps = atof(optarg);
+			break;
+		case 's':
+			emu.dSpeedIps = atof(optarg);
+			emu.bSpeedFixed = TRUE;
+			break;
+		case 'c':
+			szRaster = optarg;
+			break;
+		case 'o':
+			emu.szPbmPrefix = optarg;
+			break;
+		default:
+			Usage();
+		}
+	}
+	if ( emu.nDpi <= 0 || emu.dLinkBps <= 0 || optind < argc - 1 )
+		Usage();
+
+	if ( szRaster && !LoadRaster(&emu, szRaster) )
+		return 1;
+
+	if ( (pData = ReadAll(optind < argc ? argv[optind] : NULL, &cbData)) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to read %s: %s\n", optind < argc ? argv[optind] : "stdin", strerror(errno));
+		return 1;
+	}
+
+	Interpret(&emu, pData, cbData);
+
+	{
+		double	dLink = cbData * 8.0 / emu.dLinkBps;
+		double	dTotal = max(emu.dPrinterEnd, dLink);
+
+		printf("labels           %lld (%lld images)\n", emu.llLabels, emu.llPrints);
+		printf("bytes            %zu, %.0f per label\n", cbData, emu.llLabels ? (double)cbData / emu.llLabels : 0);
+		printf("link             %.3f s at %.0f bit/s\n", dLink, emu.dLinkBps);
+		printf("print            %.3f s at %.1f ips, %.3f s total\n", emu.dPrinterBusy, emu.dSpeedIps > 0 ? emu.dSpeedIps : 4, dTotal);
+		printf("labels/s         %.2f\n", dTotal > 0 ? emu.llLabels / dTotal : 0);
+		printf("printer idle     %.1f%%\n", dTotal > 0 ? 100 * (1 - emu.dPrinterBusy / dTotal) : 0);
+		if ( emu.llUnknown )
+			printf("unknown          %lld commands\n", emu.llUnknown);
+		if ( emu.nPages )
+			printf("compare          %lld of %lld images differ, %lld pixels\n", emu.llLabelsBad, emu.llPrints, emu.llMismatch);
+	}
+
+	MEMFREE(pData);
+	return emu.llLabelsBad || (emu.nPages && emu.llPrints == 0) ? 2 : 0;
+}
@@ -97,8 +97,8 @@ void Encode(const unsigned char *pSrc, int srclen, char *szOut)
 	*r = 0;
 }
 
-// Base64
-void Decode(const char *szCoded, unsigned char *pOut)
+// Base64, returns the bytes written before the terminating 0
+int Decode(const char *szCoded, unsigned char *pOut)
 {      
 	short nDecTab[256];
 	short i;
@@ -143,6 +143,8 @@ void Decode(const char *szCoded, unsigned char *pOut)
 		*r++ = buf & 0xFF;
 	}      
 	*r = 0;
+
+	return r - pOut;
 }
 
 #ifdef __IS_TRIAL_VERSION__
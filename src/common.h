@@ -170,6 +170,9 @@ extern "C" {
 WORD	ENDIEN16(WORD x);
 DWORD	ENDIEN32(DWORD x);
 
+void	Encode(const unsigned char *pSrc, int srclen, char *szOut);
+int		Decode(const char *szCoded, unsigned char *pOut);
+
 #ifndef HAVE_STRLCPY
 	size_t my_strlcpy(char *dst, const char *src, size_t dst_sz);
 	#define strlcpy		my_strlcpy
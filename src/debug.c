@@ -30,6 +30,8 @@
 	#define	IS_DEBUG
 #endif
 #include "debug.h"
+#include <sys/time.h>
+#include <pthread.h>
 
 struct {
 	short		level;
@@ -51,16 +53,126 @@ struct {
 	#define		PRE_MSG		""
 #endif	// #ifdef IS_DEBUG
 
-static char* Error_Format_Message(int ErrorLevel, const char *strfmt);
+// Debug lines are collected and written in batches, anything at INFO or
+// above goes out at once together with what is pending. The batch is
+// locked, encoders on several threads log through it.
+#define		LOG_MSG_MAX			2048
+#define		LOG_BATCH_SIZE		8192
+
+int				g_nLogLevel = 0;
+static char		s_szBatch[LOG_BATCH_SIZE];
+static size_t	s_nBatch = 0;
+static pthread_mutex_t	s_mtxBatch = PTHREAD_MUTEX_INITIALIZER;
+
 static int Error_Log_v(int ErrorLevel, const char* strfmt, va_list args);
+static void Log_FlushBatch(void);
+
+// Taken before main, the closest to exec we get without the loader's help
+static struct timeval	s_tvStart;
 
-void DebugPrintf(const char* pstrFormat, ... )
+__attribute__((constructor)) static void RecordStartTime(void)
 {
-	va_list args;
+	gettimeofday(&s_tvStart, NULL);
+}
 
-	va_start(args, pstrFormat);
-	Error_Log_v(LEVEL_DEBUG, pstrFormat, args);
-	va_end(args);
+// Called on every write to the printer, logs only the first one
+void Log_FirstOutputByte(void)
+{
+	static BOOL		bLogged = FALSE;
+	struct timeval	tv;
+
+	if ( bLogged || !Log_Enabled(LEVEL_DEBUG) )
+		return;
+	bLogged = TRUE;
+
+	gettimeofday(&tv, NULL);
+	Error_Log(LEVEL_DEBUG, "Startup: first output byte %ld us after exec\n",
+		(long)((tv.tv_sec - s_tvStart.tv_sec) * 1000000 + (tv.tv_usec - s_tvStart.tv_usec)));
+}
+
+static int Log_LevelFromName(const char *szName)
+{
+	if ( !strncasecmp(szName, "debug2", 6) )
+		return LEVEL_DEBUG2;
+	if ( !strncasecmp(szName, "debug", 5) )
+		return LEVEL_DEBUG;
+	return LEVEL_INFO;
+}
+
+// $TSC_LOGLEVEL, else the LogLevel of cupsd.conf. Without either a debug
+// build logs everything and a release build nothing below INFO.
+static void Log_InitOnce(void)
+{
+	const char	*val;
+	char		filename[1024];
+	char		line[256];
+	FILE		*fp;
+	int			nLevel;
+
+#ifdef IS_DEBUG
+	nLevel = LEVEL_DEBUG2;
+#else
+	nLevel = LEVEL_INFO;
+#endif
+
+	if ( (val = getenv("TSC_LOGLEVEL")) != NULL )
+	{
+		nLevel = Log_LevelFromName(val);
+	}
+	else
+	{
+		if ( (val = getenv("CUPS_SERVERROOT")) == NULL )
+			val = "/etc/cups";
+		snprintf(filename, sizeof(filename), "%s/cupsd.conf", val);
+		if ( (fp = fopen(filename, "r")) != NULL )
+		{
+			while ( fgets(line, sizeof(line), fp) )
+			{
+				for (val=line; isspace(*val); val++);
+				if ( !strncasecmp(val, "LogLevel", 8) && isspace(val[8]) )
+				{
+					for (val+=8; isspace(*val); val++);
+					nLevel = Log_LevelFromName(val);
+					break;
+				}
+			}
+			fclose(fp);
+		}
+	}
+
+	atexit(Log_Flush);
+	__atomic_store_n(&g_nLogLevel, nLevel, __ATOMIC_RELAXED);
+}
+
+int Log_Init(void)
+{
+	static pthread_once_t	once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&once, Log_InitOnce);
+	return Log_Level();
+}
+
+// Also to be called before fork(), or the child writes the batch again
+void Log_Flush(void)
+{
+	pthread_mutex_lock(&s_mtxBatch);
+	Log_FlushBatch();
+	pthread_mutex_unlock(&s_mtxBatch);
+}
+
+static void Log_FlushBatch(void)
+{
+	size_t		done = 0;
+	ssize_t		n;
+
+	while ( done < s_nBatch )
+	{
+		if ( (n = write(STDERR_FILENO, s_szBatch + done, s_nBatch - done)) > 0 )
+			done += n;
+		else if ( n == 0 || errno != EINTR )
+			break;
+	}
+	s_nBatch = 0;
 }
 
 int Error_Log(int ErrorLevel, const char* strfmt, ... )
@@ -68,6 +180,9 @@ int Error_Log(int ErrorLevel, const char* strfmt, ... )
 	int		nRtn = 0;
 	va_list args;
 
+	if ( !Log_Enabled(ErrorLevel) )
+		return nRtn;
+
 	va_start(args, strfmt);
 	nRtn = Error_Log_v(ErrorLevel, strfmt, args);
 	va_end(args);
@@ -75,16 +190,21 @@ int Error_Log(int ErrorLevel, const char* strfmt, ... )
 	return nRtn;
 }
 
-char* Error_Format_Message(int ErrorLevel, const char *strfmt)
+// Every line gets the level prefix, '\r' is dropped and the message always
+// ends with a newline
+int Error_Log_v(int ErrorLevel, const char* strfmt, va_list args)
 {
 	int			i;
-	int			nLineCnt = 0;
+	int			nRtn;
 	size_t		nPreLen;
-	int			nPreLen2;
+	size_t		nPreLen2 = strlen(PRE_MSG);
 	const char	*szPre = "";
 	const char	*s;
-	char		*p;
-	char		*buff = NULL;
+	char		szMsg[LOG_MSG_MAX];
+	BOOL		bLineStart = TRUE;
+
+	if ( (nRtn = vsnprintf(szMsg, sizeof(szMsg), strfmt, args)) < 0 )
+		return 0;
 
 	for (i=0; i<sizeof(ListErrorLevel)/sizeof(ListErrorLevel[0]); i++)
 	{
@@ -95,67 +215,39 @@ char* Error_Format_Message(int ErrorLevel, const char *strfmt)
 		}
 	}
 	nPreLen = strlen(szPre);
-	nPreLen2 = strlen(PRE_MSG);
 
-	for (s=strfmt, nLineCnt=0; *s; s++)
+	pthread_mutex_lock(&s_mtxBatch);
+	for (s=szMsg; ; s++)
 	{
-		if ( *s == '\n' )
-			nLineCnt ++;
-	}
-	nLineCnt++;
-
-	buff = (char*)MEMALLOC(strlen(strfmt) + nLineCnt * (nPreLen + nPreLen2)+ 5 );
-	if ( buff )
-	{
-		p=buff;
-		strcpy(p, szPre);
-		p += nPreLen;
-		strcpy(p, PRE_MSG);
-		p += nPreLen2;
-
-		for (s=strfmt; *s; s++)
+		if ( *s == '\r' )
+			continue;
+		if ( bLineStart )
 		{
-			switch ( *s )
-			{
-			case '\r':
-				break;
-			case '\n':
-				if ( *(s+1) )
-				{
-					*p ++ = *s;
-					strcpy(p, szPre);
-					p += nPreLen;
-					strcpy(p, PRE_MSG);
-					p += nPreLen2;
-				}
-				break;
-			default:
-				*p ++ = *s;
+			if ( *s == 0 && s != szMsg )
 				break;
-			}
+			if ( s_nBatch + nPreLen + nPreLen2 + 2 > sizeof(s_szBatch) )
+				Log_FlushBatch();
+			memcpy(s_szBatch + s_nBatch, szPre, nPreLen);
+			memcpy(s_szBatch + s_nBatch + nPreLen, PRE_MSG, nPreLen2);
+			s_nBatch += nPreLen + nPreLen2;
+			bLineStart = FALSE;
 		}
-
-		if ( p != buff && *(p-1) != '\n')
-			*p ++ = '\n';
-
-		*p = 0;
+		if ( s_nBatch + 2 > sizeof(s_szBatch) )
+			Log_FlushBatch();
+		if ( *s == 0 )
+		{
+			s_szBatch[s_nBatch++] = '\n';
+			break;
+		}
+		s_szBatch[s_nBatch++] = *s;
+		if ( *s == '\n' )
+			bLineStart = TRUE;
 	}
-	return buff;
-}
 
-int Error_Log_v(int ErrorLevel, const char* strfmt, va_list args)
-{
-	int		nRtn = 0;
-	char	*buff = NULL;
-	char	*pre = "";
-	char	*fmtbuff = NULL;
+	if ( ErrorLevel >= LEVEL_INFO )
+		Log_FlushBatch();
+	pthread_mutex_unlock(&s_mtxBatch);
 
-	fmtbuff = Error_Format_Message(ErrorLevel, strfmt);
-	if ( fmtbuff )
-	{
-		nRtn = vfprintf(stderr, fmtbuff, args);
-		MEMFREE(fmtbuff);
-	}
 	return nRtn;
 }
 
@@ -197,6 +289,10 @@ void DumpDevmode(DEVMODE *pdm)
 
 		Error_Log(ErrorLevel, "DEVMODE.dmFeedOffset       = %f\n", pdm->dmFeedOffset);
 		Error_Log(ErrorLevel, "DEVMODE.dmVerticalOffset   = %f\n", pdm->dmVerticalOffset);
+		Error_Log(ErrorLevel, "DEVMODE.dmColumns          = %d\n", pdm->dmColumns);
+		Error_Log(ErrorLevel, "DEVMODE.dmColumnGap        = %f\n", pdm->dmColumnGap);
+		Error_Log(ErrorLevel, "DEVMODE.dmAutoLength       = %d\n", pdm->dmAutoLength);
+		Error_Log(ErrorLevel, "DEVMODE.dmAutoLengthMargin = %f\n", pdm->dmAutoLengthMargin);
 
 		Error_Log(ErrorLevel, "DEVMODE.dmPrintSpeed       = %d\n", pdm->dmPrintSpeed);
 		Error_Log(ErrorLevel, "DEVMODE.dmDarkness         = %d\n", pdm->dmDarkness);
@@ -25,8 +25,9 @@
 extern "C" {
 #endif
 
-#define LEVEL_DEBUG			1
-#define LEVEL_DEBUG2		2
+// Ordered by verbosity, DEBUG2 is the chattiest as in cupsd's LogLevel
+#define LEVEL_DEBUG2		1
+#define LEVEL_DEBUG			2
 #define LEVEL_INFO			3
 #define LEVEL_NOTICE		4
 #define LEVEL_WARNING		5
@@ -35,16 +36,28 @@ extern "C" {
 #define LEVEL_EMERG			8
 #define LEVEL_CRIT			9
 
+// Lowest level written to stderr, 0 until the first message reads it from
+// $TSC_LOGLEVEL or cupsd.conf. INFO and above are never dropped, cupsd uses
+// them for the job state. Set once, a relaxed load on any thread.
+extern int g_nLogLevel;
+
+#define	Log_Level()				__atomic_load_n(&g_nLogLevel, __ATOMIC_RELAXED)
+#define	Log_Enabled(level)		((level) >= (Log_Level() ? Log_Level() : Log_Init()))
+
+// The arguments are not evaluated when the level is filtered out
+#define	DebugPrintf(...)		((void)(Log_Enabled(LEVEL_DEBUG) && Error_Log(LEVEL_DEBUG, __VA_ARGS__)))
+
 int Error_Log(int ErrorLevel, const char* strfmt, ... );
+int Log_Init(void);
+void Log_Flush(void);
+void Log_FirstOutputByte(void);
 
 #ifdef _DEBUG
 	#include "devmode.h"
 
-	void DebugPrintf(const char* pstrFormat, ... );
 	void DumpRESUID();
 	void DumpDevmode(DEVMODE *pdm);
 #else
-	#define	DebugPrintf
 	#define	DumpRESUID
 	#define	DumpDevmode
 #endif	// #ifdef _DEBUG
@@ -23,9 +23,7 @@
 #include "debug.h"
 #include "devmode.h"
 #include "devoption.h"
-
-float			g_fCurPaperSizeHeight = 0.0;
-float			g_fCurPaperSizeWidth = 0.0;
+#include "trace.h"
 
 BOOL get_option_name_byID(char* szOptionName, int opID)
 {
@@ -61,7 +59,47 @@ float OnValidValue(float fSrcValue, float fMin, float fMax)
 	return fRet;
 }
 
-int GetPrinterOptions(const char* szPrnName, cups_option_t **options, CUPSLIB_FUNCTION *cups)
+// In PPDCACHE_CMD_* order, which is also their order after a piped DEVMODE
+void GetDevmodeCommands(DEVMODE *pdm, LPBYTE *ppCmd[PPDCACHE_NUM_COMMANDS], WORD *pwLength[PPDCACHE_NUM_COMMANDS])
+{
+	ppCmd[PPDCACHE_CMD_STARTJOB] = &pdm->dmCmdStartJob;
+	pwLength[PPDCACHE_CMD_STARTJOB] = &pdm->dmCmdStartJobLength;
+	ppCmd[PPDCACHE_CMD_STARTLABEL] = &pdm->dmCmdStartLable;
+	pwLength[PPDCACHE_CMD_STARTLABEL] = &pdm->dmCmdStartLabelLength;
+	ppCmd[PPDCACHE_CMD_ENDLABEL] = &pdm->dmCmdEndLable;
+	pwLength[PPDCACHE_CMD_ENDLABEL] = &pdm->dmCmdEndLabelLength;
+	ppCmd[PPDCACHE_CMD_ENDJOB] = &pdm->dmCmdEndJob;
+	pwLength[PPDCACHE_CMD_ENDJOB] = &pdm->dmCmdEndJobLength;
+}
+
+// CUPS hands filters the queue's PPD in $PPD. Fetching a copy from
+// cupsd is only the fallback for running outside the scheduler.
+// The queue's PPD is compiled once and mmap'ed by later jobs, a fetched
+// copy is a temp file and is compiled in memory only.
+PPDCACHE* OpenPrinterPPD(const char* szPrnName, CUPSLIB_FUNCTION *cups)
+{
+	PPDCACHE		*ppd = NULL;
+	const char		*filename;
+	TRACETIME		tStart = Trace_Begin();
+
+	if ( (filename = getenv("PPD")) != NULL && *filename )
+	{
+		ppd = PpdCacheOpen(filename, TRUE, cups);
+	}
+	else if ( szPrnName && (filename = cups->cupsGetPPD(szPrnName)) != NULL )
+	{
+		ppd = PpdCacheOpen(filename, FALSE, cups);
+
+		// Delete temp PPD file
+		unlink(filename);
+	}
+
+	DebugPrintf("OpenPrinterPPD(%s) = %p\n", filename ? filename : "(null)", ppd);
+	Trace_End("OpenPrinterPPD", tStart, TRACE_NO_ARG);
+	return ppd;
+}
+
+int GetPrinterOptions(ppd_file_t *ppd, cups_option_t **options, CUPSLIB_FUNCTION *cups)
 {
 	int					num = 0;
 
@@ -87,20 +125,6 @@ int GetPrinterOptions(const char* szPrnName, cups_option_t **options, CUPSLIB_FU
 
 	*options = NULL;
 	{
-		ppd_file_t		*ppd = NULL;
-		const char		*filename;
-
-		// Create temp PPD file by printer name
-		if ( (filename = cups->cupsGetPPD(szPrnName)) != NULL )
-		{
-			// Open the PPD file
-			ppd = cups->ppdOpenFile(filename);
-			cups->ppdLocalize(ppd);
-			cups->ppdMarkDefaults(ppd);
-
-			// Delete temp PPD file
-			unlink(filename);
-		}
 		if ( ppd )
 		{
 			ppd_option_t	*option;
@@ -134,17 +158,11 @@ int GetPrinterOptions(const char* szPrnName, cups_option_t **options, CUPSLIB_FU
 				case OPTID_USERCMDSTARTLABEL:
 				case OPTID_USERCMDENDLABEL:
 				case OPTID_USERCMDENDJOB:
-				case OPTID_USERCMDSTARTJOBNOCTRL:
-				case OPTID_USERCMDSTARTLABELNOCTRL:
-				case OPTID_USERCMDENDLABELNOCTRL:
-				case OPTID_USERCMDENDJOBNOCTRL:
 					GetPrinterOptionsCommand(options, cups, ppd, g_tsc_options[i].name, &num);
 					break;
 				}
 			}
-
-			cups->ppdClose(ppd);		
-		}		
+		}
 	}
 
 	return num;
@@ -190,43 +208,40 @@ int GetPrinterOptionsCommand(cups_option_t **options, CUPSLIB_FUNCTION *cups, pp
 }
 
 int 
-GetOptionIndexByChoice(CUPSLIB_FUNCTION* cups, ppd_file_t* ppd, int opID, char* szOpKey)
+GetOptionIndexByChoice(CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, int opID, char* szOpKey)
 {	
 	int				index = -1;
 	char 			szOpName[128];
-	ppd_option_t	*option;
+	int				n;
 
 	if ( szOpKey == NULL )
 		return index;
 
 	if ( get_option_name_byID(szOpName, opID) )
 	{
-		if ( (option = cups->ppdFindOption(ppd, szOpName)) != NULL )
+		if ( (n = PpdCacheFindOption(ppd, szOpName)) >= 0 )
 		{
-			int		i;
-			int		j = 0;
+			const PPDCACHE_OPTION	*option = PPDCACHE_OPT(ppd, n);
+			const char				*choice;
+			DWORD					i;
+			int						j = 0;
 
 			for(i=0;i<option->num_choices;i++)
 			{
+				choice = PPDCACHE_STR(ppd, PPDCACHE_CHO(ppd, option->first_choice + i)->choice);
 				if ( opID == OPTID_PAGESETUPNAME )
 				{
-					ppd_size_t		*pagesize;
-
-					if ( strcmp(option->choices[i].choice, "Custom") )
+					if ( strcmp(choice, "Custom") )
 					{
-						if ( !strcmp(option->choices[i].choice, szOpKey) )
+						if ( !strcmp(choice, szOpKey) )
 							index = j;
 
-						pagesize = cups->ppdPageSize(ppd, szOpKey);
-						g_fCurPaperSizeHeight = pagesize->length;
-						g_fCurPaperSizeWidth = pagesize->width;
-
 						j++;
 					}
 				}	
 				else
 				{
-					if ( !strcmp(option->choices[i].choice, szOpKey) )
+					if ( !strcmp(choice, szOpKey) )
 					{
 						index = i;
 					}
@@ -239,47 +254,33 @@ GetOptionIndexByChoice(CUPSLIB_FUNCTION* cups, ppd_file_t* ppd, int opID, char*
 }
 
 BOOL 
-GetOptionCodeByChoice(CUPSLIB_FUNCTION* cups, ppd_file_t* ppd, int opID, char* szOpKey, char* szOpCode)
+GetOptionCodeByChoice(CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, int opID, char* szOpKey, char* szOpCode)
 {	
 	int				bRet = FALSE;
 	char 			szOpName[128];
-	ppd_option_t	*option;
+	const char		*code;
 
 	if ( szOpKey == NULL )
 		return bRet;
 
 	if ( get_option_name_byID(szOpName, opID) )
 	{
-		if ( (option = cups->ppdFindOption(ppd, szOpName)) != NULL )
+		if ( opID == OPTID_PAGESETUPNAME )
 		{
-			int		i;
-			int		j = 0;
-
-			for(i=0;i<option->num_choices;i++)
+			if ( PpdCacheFindOption(ppd, szOpName) >= 0 )
 			{
-				if ( opID == OPTID_PAGESETUPNAME )
-				{
-					ppd_size_t		*pagesize;
-
-					if ( strcmp(option->choices[i].choice, "Custom") )
-					{
-						if ( !strcmp(option->choices[i].choice, szOpKey) )
-							strcpy(szOpCode, option->choices[i].code);
+				if ( strcmp(szOpKey, "Custom") && (code = PpdCacheChoiceCode(ppd, szOpName, szOpKey)) != NULL )
+					strcpy(szOpCode, code);
 
-						bRet = TRUE;
-					}
-				}	
-				else
-				{
-					if ( !strcmp(option->choices[i].choice, szOpKey) )
-					{
-						strcpy(szOpCode, option->choices[i].code);
-						
-						bRet = TRUE;
-					}
-				}
+				bRet = TRUE;
 			}
 		}
+		else if ( (code = PpdCacheChoiceCode(ppd, szOpName, szOpKey)) != NULL )
+		{
+			strcpy(szOpCode, code);
+
+			bRet = TRUE;
+		}
 	}
 
 	return bRet;
@@ -288,112 +289,16 @@ GetOptionCodeByChoice(CUPSLIB_FUNCTION* cups, ppd_file_t* ppd, int opID, char* s
 int 
 GetItemIndexByValue(int opID, char* szOpValue)
 {
-	int			sel = 0;
+	const TSC_OPTION_NAME_T		*pOpt;
 
-	if ( szOpValue == NULL )
-		return sel;
-	
-	switch ( opID ) {
-	case OPTID_STOCKMETHOD:
-		{
-			if ( !strcmp(szOpValue, STR_MEDIAMETHOD_NORMAL ) )
-				sel = DMMEDIAMETHOD_NORMAL;
-			else if ( !strcmp(szOpValue, STR_MEDIAMETHOD_DIRECT ) )
-				sel = DMMEDIAMETHOD_DIRECT;
-			else if ( !strcmp(szOpValue, STR_MEDIAMETHOD_TRANSFER ) )
-				sel = DMMEDIAMETHOD_TRANSFER;
-			else
-				sel = DMMEDIAMETHOD_NORMAL;
-		}
-		break;
-	case OPTID_STOCKTYPE:
-		{
-			if ( !strcmp(szOpValue, STR_MEDIATYPE_LBLGAPS ) )
-				sel = DMMEDIATYPE_GAPS;
-			else if ( !strcmp(szOpValue, STR_MEDIATYPE_LBLMARK ) )
-				sel = DMMEDIATYPE_MARK;
-			else if ( !strcmp(szOpValue, STR_MEDIATYPE_CONTINUE ) )
-				sel = DMMEDIATYPE_CONTINUE;
-			else
-				sel = DMMEDIATYPE_GAPS;
-		}
-		break;
-	case OPTID_STOCKPOSTSCRIPTACTION:
-		{
-			if ( !strcmp(szOpValue, STR_POSTACTION_NONE ) )
-				sel = DMPOSTACTION_NONE;
-			else if ( !strcmp(szOpValue, STR_POSTACTION_TEAROFF ) )
-				sel = DMPOSTACTION_TEAROFF;
-			else if ( !strcmp(szOpValue, STR_POSTACTION_PEELOFF ) )
-				sel = DMPOSTACTION_PEELOFF;
-			else if ( !strcmp(szOpValue, STR_POSTACTION_CUT ) )
-				sel = DMPOSTACTION_CUT;
-			else if ( !strcmp(szOpValue, STR_POSTACTION_PARTIALCUT ) )
-				sel = DMPOSTACTION_PARTIAL;
-			else
-				sel = DMPOSTACTION_NONE;
-		}
-		break;
-	case OPTID_STOCKOCCURRENCE:
-		{
-			if ( !strcmp(szOpValue, STR_OCCURRENCE_EVERY ) )
-				sel = DMOCCURRENCE_EVERY;
-			else if ( !strcmp(szOpValue, STR_OCCURRENCE_COPIES ) )
-				sel = DMOCCURRENCE_COPIES;
-			else if ( !strcmp(szOpValue, STR_OCCURRENCE_JOB ) )
-				sel = DMOCCURRENCE_JOB;
-			else if ( !strcmp(szOpValue, STR_OCCURRENCE_SPECIFIED ) )
-				sel = DMOCCURRENCE_SPECIFIED;
-			else
-				sel = DMOCCURRENCE_EVERY;
-		}
-		break;
-	case OPTID_OPTIONPRINTERSPEED:
-		{
-			sel = atoi(szOpValue);
-		}
-		break;
-	case OPTID_OPTIONDIRECTTOBUFFER:
-		{
-			if ( !strcmp(szOpValue, STR_DIRECTBUFFER_AUTO ) )
-				sel = DMDIRECTBUFFER_AUTO;
-			else if ( !strcmp(szOpValue, STR_DIRECTBUFFER_8BIT ) )
-				sel = DMDIRECTBUFFER_8BIT;
-			else if ( !strcmp(szOpValue, STR_DIRECTBUFFER_REL ) )
-				sel = DMDIRECTBUFFER_REL;
-			else if ( !strcmp(szOpValue, STR_DIRECTBUFFER_DISABLE ) )
-				sel = DMDIRECTBUFFER_DISABLE;
-			else
-				sel = DMDIRECTBUFFER_AUTO;
-		}
-		break;
-	case OPTID_OPTIONSTOREDGRAPHICS:
-		{
-			if ( !strcmp(szOpValue, STR_STOREDGRIPHICS_AUTO ) )
-				sel = DMSTOREDGRIPHICS_AUTO;
-			else if ( !strcmp(szOpValue, STR_STOREDGRIPHICS_PCX ) )
-				sel = DMSTOREDGRIPHICS_PCX;
-			else
-				sel = DMSTOREDGRIPHICS_AUTO;
-		}
-		break;
-	case OPTID_OPTIONPRINTQUALITY:
-		{
-			if ( !strcmp(szOpValue, STR_RESOLUTION_203DPI ) )
-				sel = DPI_203;
-			else if ( !strcmp(szOpValue, STR_RESOLUTION_300DPI ) )
-				sel = DPI_300;
-			else if ( !strcmp(szOpValue, STR_RESOLUTION_600DPI ) )
-				sel = DPI_600;
-			else
-				sel = DPI_203;
-		}
-		break;
-	default:
-		break;
-	}
+	if ( szOpValue == NULL || (pOpt = GetOptionTypeByID(opID)) == NULL )
+		return 0;
 
-	return sel;
+	if ( pOpt->type == OPTTYPE_INT )
+		return atoi(szOpValue);
+	if ( pOpt->type == OPTTYPE_ENUM )
+		return GetOptionChoiceValue(pOpt, szOpValue);
+	return 0;
 }
 
 int GetOptionIDByName(char* szName)
@@ -409,24 +314,6 @@ int GetOptionIDByName(char* szName)
 	return nID;
 }
 
-const TSC_OPTION_NAME_T * GetOptionTypeByName(char* szName)
-{
-	const TSC_OPTION_NAME_T *pOpt = NULL;
-	int						nID = 0;
-	int						i;
-
-	for (i=0; i<g_tsc_options_num; i++)
-	{
-		if ( !strcmp(g_tsc_options[i].name, szName))
-		{
-			pOpt = &g_tsc_options[i];
-			break;
-		}
-	}
-
-	return pOpt;
-}
-
 int bGetPpdGroupOptions(ppd_group_t *groups, int num_options, ppd_option_t ***options)
 {
 	int				nRtn = 0;
@@ -489,94 +376,111 @@ int GetPpdOptions(ppd_file_t *ppd, ppd_option_t ***options)
 }
 
 BOOL 
-SetDevmodeFromOptions(CUPSLIB_FUNCTION* cups, ppd_file_t* ppd, DEVMODE* devMode, int num_options, cups_option_t *options)
+SetDevmodeFromOptions(CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, int num_options, cups_option_t *options)
 {
 	BOOL			bRet = TRUE;
 	int				i;
-	char			szBuf[128];
 	int				num_ppdoptions;
-	ppd_option_t	**ppdoption = NULL;
-	ppd_choice_t	*ppdchoice;
+	const char		*ppdchoice;
+	const TSC_OPTION_NAME_T	*pOpt;
+	float			fPaperWidth = 0.0, fPaperHeight = 0.0;
+	TRACETIME		tStart = Trace_Begin();
 
 	// Restore the default
-	cups->ppdMarkDefaults(ppd);
+	PpdCacheMarkDefaults(ppd);
 	// Mark PPD options by printer options
-	cups->cupsMarkOptions(ppd, num_options, options);
+	PpdCacheMarkOptions(ppd, num_options, options, cups);
 
 //	DebugPrintf("over to mark the devMode.\n");
 //	memset(devMode, 0, sizeof(DEVMODE));
 	
 	devMode->dmGapHeight = 0.12*72;
 	
-	num_ppdoptions = GetPpdOptions(ppd, &ppdoption);
+	num_ppdoptions = PPDCACHE_HDR(ppd)->num_options;
 	for (i = 0; i < num_ppdoptions; i ++)
 	{
-		if ( (ppdchoice = cups->ppdFindMarkedChoice(ppd, ppdoption[i]->keyword)) != NULL )
-//		if ( (ppdchoice = cups->ppdFindMarkedChoice(ppd, options[i].name)) != NULL )
+		if ( ppd->marked[i] != PPDCACHE_NONE &&
+			(pOpt = GetOptionTypeByName((char *)PPDCACHE_STR(ppd, PPDCACHE_OPT(ppd, i)->keyword))) != NULL )
 		{
-			int				nOptID;
-
-			nOptID = GetOptionIDByName(ppdoption[i]->keyword);
-//			nOptID = GetOptionIDByName(options[i].name);
-			if ( nOptID )
-			{
-//				DebugPrintf("SET(PPD) %s=%s\n", ppdoption[i]->keyword, ppdchoice->choice);	
-				bRet &= SetDevmodeFromOption(cups, ppd, devMode, nOptID, ppdchoice->choice);
-			}
+			ppdchoice = PPDCACHE_STR(ppd, PPDCACHE_CHO(ppd, ppd->marked[i])->choice);
+//			DebugPrintf("SET(PPD) %s=%s\n", pOpt->name, ppdchoice);	
+			bRet &= ApplyOption(pOpt, cups, ppd, devMode, (char *)ppdchoice);
 		}
 	}
 
 	for (i = 0; i < num_options; i ++)
 	{
-		if ( (ppdchoice = cups->ppdFindMarkedChoice(ppd, options[i].name)) == NULL )
+		if ( (pOpt = GetOptionTypeByName(options[i].name)) != NULL &&
+			PpdCacheMarkedChoice(ppd, options[i].name) == NULL )
 		{
-			const TSC_OPTION_NAME_T *	pID;
-			pID = GetOptionTypeByName(options[i].name);
-//			if ( pID && ((pID->flag & OPTION_FLG_NOSAVE) != OPTION_FLG_NOSAVE ) )
-			if ( pID )
-			{
-//				DebugPrintf("SET(OPT) %s=%s\n", options[i].name, options[i].value);
-				bRet &= SetDevmodeFromOption(cups, ppd, devMode, pID->id, options[i].value);
-			}
+//			DebugPrintf("SET(OPT) %s=%s\n", options[i].name, options[i].value);
+			bRet &= ApplyOption(pOpt, cups, ppd, devMode, options[i].value);
 		}
 	}
 
-	// Valid the value to check whether is on the range or not
+	// User commands point into the cache, no copy per job
 	{
-		float			fValueTmp;
-
-		// dmGapOffset
-		fValueTmp = devMode->dmGapHeight;
-		devMode->dmGapHeight = OnValidValue(fValueTmp, GAPHEIGHT_MIN_VALUE*72, GAPHEIGHT_MAX_VALUE*72);
+		static const DWORD	fields[PPDCACHE_NUM_COMMANDS] = {DM_CMDSTARTJOB, DM_CMDSTARTLABEL, DM_CMDENDLABEL, DM_CMDENDJOB};
+		LPBYTE				*ppCmd[PPDCACHE_NUM_COMMANDS];
+		WORD				*pwLength[PPDCACHE_NUM_COMMANDS];
+		DWORD				dwLength;
 
-		// dmGapOffset
-		fValueTmp = devMode->dmGapOffset;
-		if ( devMode->dmMediaType == DMMEDIATYPE_GAPS )
-		{
-			devMode->dmGapOffset = OnValidValue(fValueTmp, ((-1)*g_fCurPaperSizeHeight), g_fCurPaperSizeHeight);
-		}
-		else if ( devMode->dmMediaType == DMMEDIATYPE_MARK )
+		GetDevmodeCommands(devMode, ppCmd, pwLength);
+		for (i = 0; i < PPDCACHE_NUM_COMMANDS; i ++)
 		{
-			devMode->dmGapOffset = OnValidValue(fValueTmp, 0, g_fCurPaperSizeHeight);
+			if ( (*ppCmd[i] = (LPBYTE)PpdCacheCommand(ppd, i, &dwLength)) != NULL )
+			{
+				// Len* is what the dialog stored, never past the block
+				if ( *pwLength[i] > dwLength )
+					*pwLength[i] = dwLength;
+				devMode->dmFields |= fields[i];
+			}
+			else
+			{
+				*pwLength[i] = 0;
+			}
 		}
+	}
 
-		// dmFeedOffset
-		fValueTmp = devMode->dmFeedOffset;
-		devMode->dmFeedOffset = OnValidValue(fValueTmp, (FEEDOFFSET_MIN_VALUE)*72, FEEDOFFSET_MAX_VALUE*72);
+	// Valid the value to check whether is on the range or not, paper
+	// ranges against the marked page size
+	PpdCachePageSize(ppd, NULL, &fPaperWidth, &fPaperHeight);
+	for (i = 0; i < g_tsc_options_num; i ++)
+	{
+		float			*pValue;
+		float			fUnit = 0.0;
+		float			fMin;
 
-		// dmVerOffset
-		fValueTmp = devMode->dmVerticalOffset;
-		devMode->dmVerticalOffset = OnValidValue(fValueTmp, (VEROFFSET_MIN_VALUE)*72, VEROFFSET_MAX_VALUE*72);
+		pOpt = &g_tsc_options[i];
+		pValue = (float *)((LPBYTE)devMode + pOpt->offset);
+		fMin = pOpt->fMin;
 
-		// dmAdjustHorizontal
-		fValueTmp = devMode->dmAdjustHorizontal;
-		devMode->dmAdjustHorizontal = OnValidValue(fValueTmp, 0, g_fCurPaperSizeWidth);
+		switch ( pOpt->range ) {
+		case OPTRANGE_INCH:
+			fUnit = 72;
+			break;
+		case OPTRANGE_PAPERWIDTH:
+			fUnit = fPaperWidth;
+			break;
+		case OPTRANGE_PAPERHEIGHT:
+			fUnit = fPaperHeight;
+			break;
+		case OPTRANGE_GAPOFFSET:
+			// A mark is found after the label top, a gap may be either side
+			if ( devMode->dmMediaType == DMMEDIATYPE_MARK )
+				fMin = 0;
+			else if ( devMode->dmMediaType != DMMEDIATYPE_GAPS )
+				continue;
+			fUnit = fPaperHeight;
+			break;
+		default:
+			continue;
+		}
 
-		// dmAdjustHorizontal
-		fValueTmp = devMode->dmAdjustVertical;
-		devMode->dmAdjustVertical = OnValidValue(fValueTmp, 0, g_fCurPaperSizeHeight);
+		*pValue = OnValidValue(*pValue, fMin*fUnit, pOpt->fMax*fUnit);
 	}
 
+	Trace_End("SetDevmodeFromOptions", tStart, TRACE_NO_ARG);
 	return bRet;
 }
 
@@ -618,476 +522,88 @@ SetMetricString(char* szSysLang, CUPSLIB_FUNCTION* cups)
 }
 
 BOOL 
-SetDevmodeFromOption(CUPSLIB_FUNCTION* cups, ppd_file_t* ppd, DEVMODE* devMode, int opID, char* szOpValue)
+SetDevmodeFromOption(CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, int opID, char* szOpValue)
 {
-	BOOL			bRet = TRUE;
-	float			fValue = 0.0;
-	char 			szOpCmdValue[DM_USER_COMMOND_LENGTH];
-
+	const TSC_OPTION_NAME_T		*pOpt;
 
-	switch ( opID ) {
-	case OPTID_PAGESETUPNAME:
-		{
-//			DebugPrintf("dmPaperSize_key=%s\n", szOpValue);
-			if ( szOpValue )
-				devMode->dmPaperSize = GetOptionIndexByChoice(cups, ppd, opID, szOpValue);
-			else
-				devMode->dmPaperSize = -1;
+	if ( (pOpt = GetOptionTypeByID(opID)) == NULL )
+		return TRUE;
 
-//			DebugPrintf("dmPaperSize=%d\n", devMode->dmPaperSize);
-		}
-		break;
-	case OPTID_PAGEMIRRORIMAGE:
-		{
-//			DebugPrintf("show->dmMirrorImage=%s\n", szOpValue);
-			devMode->dmFields |= DM_MIRRORIMAGE;
+	return ApplyOption(pOpt, cups, ppd, devMode, szOpValue);
+}
 
-			if ( szOpValue == NULL )
-			{
-				devMode->dmMirrorImage = DMMIRRORIMAGE_OFF;
-			}
-			else
-			{				
-				if ( !strcmp(szOpValue, DMBOOL_FALSE) )
-					devMode->dmMirrorImage = DMMIRRORIMAGE_OFF;
-				else
-					devMode->dmMirrorImage = DMMIRRORIMAGE_ON;
-			}
-//			DebugPrintf("show->dmMirrorImage=%d\n", devMode->dmMirrorImage);
-		}
-		break;
-	case OPTID_PAGENEGATIVEIMAGE:
-		{
-//			DebugPrintf("show->dmNegativeImage=%s\n", szOpValue);
-			devMode->dmFields |= DM_NEGATIVEIMAGE;
+// One registry entry to its DEVMODE member, szOpValue NULL is the default
+BOOL 
+ApplyOption(const TSC_OPTION_NAME_T *pOpt, CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, char* szOpValue)
+{
+	if ( pOpt->parse )
+		return pOpt->parse(pOpt, cups, ppd, devMode, szOpValue);
 
-			if ( szOpValue == NULL )
-			{
-				devMode->dmNegativeImage = DMNEGATIVEIMAGE_OFF;
-			}
-			else
-			{
-				if ( !strcmp(szOpValue, DMBOOL_FALSE) )
-					devMode->dmNegativeImage = DMNEGATIVEIMAGE_OFF;
-				else
-					devMode->dmNegativeImage = DMNEGATIVEIMAGE_ON;
-			}
-		}
-		break;
-	case OPTID_PAGORIENTATION:
-		{
-//			DebugPrintf("szOpValue->dmOrientation=%s\n", szOpValue);
-			devMode->dmFields |= DM_ORIENTATION;
+	// Picked up with the PPD's blocks by SetDevmodeFromOptions()
+	if ( pOpt->type == OPTTYPE_COMMAND )
+		return szOpValue ? PpdCacheSetCommand(ppd, GetOptionCommandIndex(pOpt), szOpValue) : TRUE;
 
-			if ( szOpValue == NULL )
-			{
-				devMode->dmOrientation = DMORIENT_PORTRAIT;
-			}
-			else
-			{
-				int 	index = atoi(szOpValue);
-
-				if ( index == DMORIENT_PORTRAIT )
-					devMode->dmOrientation = DMORIENT_PORTRAIT;
-				else if ( index == DMORIENT_LANDSCAPE )
-					devMode->dmOrientation = DMORIENT_LANDSCAPE;
-				else if ( index == DMORIENT_PORTRAIT_180 )
-					devMode->dmOrientation = DMORIENT_PORTRAIT_180;
-				else if ( index == DMORIENT_LANDSCAPE_180 )
-					devMode->dmOrientation = DMORIENT_LANDSCAPE_180;
-				else 
-					devMode->dmOrientation = DMORIENT_PORTRAIT;
-				DebugPrintf("devMode->dmOrientation=%d\n", devMode->dmOrientation);
-			}
-		}
-		break;
-		// Stock
-	case OPTID_STOCKMETHOD:
-		{
-//			devMode->dmMediaMethod = GetOptionIndexByChoice(cups, ppd, opID, szOpValue);
-			devMode->dmMediaMethod = GetItemIndexByValue(opID, szOpValue);
-			devMode->dmFields |= DM_MEDIAMETHOD;
-//			DebugPrintf("show->dmMediaMethod=%d\n", devMode->dmMediaMethod);
-		}
-		break;
-	case OPTID_STOCKTYPE:
-		{
-//			DebugPrintf("show->dmMediaType=%s\n", szOpValue);
-//			devMode->dmMediaType = GetOptionIndexByChoice(cups, ppd, opID, szOpValue);
-			devMode->dmFields |= DM_MEDIATYPE;
-			devMode->dmMediaType = GetItemIndexByValue(opID, szOpValue);
-		}
-		break;
-	case OPTID_STOCKMARKHEIGHT:
-		{
-			devMode->dmFields |= DM_GAPHEIGHT;
+	return SetOptionValue(pOpt, devMode, szOpValue);
+}
 
-			if ( szOpValue == NULL )
-			{
-				devMode->dmGapHeight = 0.0; 
-			}
-			else
-			{
-				fValue = atof(szOpValue);
-				devMode->dmGapHeight = fValue; 
-			
-///				DebugPrintf("opValue->dmGapHeight=%.5f\n", fValue);
-//				if ( devMode->dmMetric == DMMETRIC_INCH )
-//					devMode->dmGapHeight = POINT2INCH(fValue); 
-//				else
-//					devMode->dmGapHeight = POINT2MM(fValue); 
-//				DebugPrintf("show->dmGapHeight=%.2f\n", devMode->dmGapHeight);
-			}
-		}
-		break;
-	case OPTID_STOCKMARKOFFSET:
-		{
-			devMode->dmFields |= DM_GAPOFFSET;
+BOOL 
+ParsePageSize(const TSC_OPTION_NAME_T *pOpt, CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, char* szOpValue)
+{
+//	DebugPrintf("dmPaperSize_key=%s\n", szOpValue);
+	if ( szOpValue )
+		devMode->dmPaperSize = GetOptionIndexByChoice(cups, ppd, pOpt->id, szOpValue);
+	else
+		devMode->dmPaperSize = -1;
 
-			if ( szOpValue == NULL )
-			{
-				devMode->dmGapOffset = 0.0; 
-			}
-			else
-			{
-				fValue = atof(szOpValue);
-				devMode->dmGapOffset = fValue;
-//				DebugPrintf("opValue->dmGapOffset=%.5f\n", fValue);
-
-//				if ( devMode->dmMetric == DMMETRIC_INCH )
-//					devMode->dmGapOffset = POINT2INCH(fValue);
-//				else
-//					devMode->dmGapOffset = POINT2MM(fValue); 
-//				DebugPrintf("show->dmGapHeight=%.2f\n", devMode->dmGapHeight);
-			}
-		}
-		break;
-	case OPTID_STOCKPOSTSCRIPTACTION:
-		{
-//			DebugPrintf("show->dmPostAction=%s\n", szOpValue);
-//			devMode->dmPostAction = GetOptionIndexByChoice(cups, ppd, opID, szOpValue);
-			devMode->dmFields |= DM_POSTACTION;
-			devMode->dmPostAction = GetItemIndexByValue(opID, szOpValue);
-		}
-		break;
-	case OPTID_STOCKOCCURRENCE:
-		{
-//			DebugPrintf("show->dmOccurrence=%s\n", szOpValue);
-//			devMode->dmOccurrence = GetOptionIndexByChoice(cups, ppd, opID, szOpValue);
-			devMode->dmFields |= DM_OCCURRENCE;
-			devMode->dmOccurrence = GetItemIndexByValue(opID, szOpValue);
-		}
-		break;
-	case OPTID_STOCKINTERVAL:
-		{
-			devMode->dmFields |= DM_CUTINTERVAL;
-			if ( szOpValue == NULL )
-				devMode->dmCutInterval = 1; 
-			else
-				devMode->dmCutInterval = atoi(szOpValue);
-//			DebugPrintf("show->dmCutInterval=%d\n", devMode->dmCutInterval);
-		}
-		break;
-	case OPTID_STOCKFEEDOFFSET:
-		{
-//			DebugPrintf("show->dmFeedOffset=%s\n", szOpValue);
-			devMode->dmFields |= DM_FEEDOFFSET;
-			if ( szOpValue == NULL )
-			{
-				devMode->dmFeedOffset = 0.0;
-			}
-			else
-			{
-				fValue = atof(szOpValue);
-				devMode->dmFeedOffset = fValue; 
+	return TRUE;
+}
 
-//				if ( devMode->dmMetric == DMMETRIC_INCH )
-//					devMode->dmFeedOffset = POINT2INCH(fValue); 
-//				else
-//					devMode->dmFeedOffset = POINT2MM(fValue); 
-			}
-		}
-		break;
-	case OPTID_STOCKVERTICALOFFSET:
-		{
-			devMode->dmFields |= DM_VERTICALOFFSET;
-			if ( szOpValue == NULL )
-			{
-				devMode->dmVerticalOffset = 0.0;
-			}
-			else
-			{
-				fValue = atof(szOpValue);
-				devMode->dmVerticalOffset = fValue; 
-//				DebugPrintf("fValue=%.5f\n", fValue);
-
-//				if ( devMode->dmMetric == DMMETRIC_INCH )
-//					devMode->dmVerticalOffset = POINT2INCH(fValue); 
-//				else
-//					devMode->dmVerticalOffset = POINT2MM(fValue); 
-//				DebugPrintf("show->dmVerticalOffset=%s\n", devMode->dmVerticalOffset);
-			}
-		}
-		break;
+BOOL 
+ParseResolution(const TSC_OPTION_NAME_T *pOpt, CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, char* szOpValue)
+{
+	int			xRes, yRes;
+	char		szCode[256];
 
-		// Option
-	case OPTID_OPTIONPRINTQUALITY:
-		{
-			int			xRes, yRes;
-			char		szCode[256];
-			
-			memset(szCode, 0, sizeof(szCode));
-//			DebugPrintf("show->dmPrintQuality=%s\n", szOpValue);
-//			devMode->dmPrintQuality = GetOptionIndexByChoice(cups, ppd, opID, szOpValue);
-			devMode->dmPrintQuality = GetItemIndexByValue(opID, szOpValue);
-			
-			if ( GetOptionCodeByChoice(cups, ppd, OPTID_OPTIONPRINTQUALITY, szOpValue, szCode) )
-			{
-				if ( sscanf(szCode, "<</HWResolution[%d %d]", &xRes, &yRes) == 2 )
-				{
-					devMode->dmPrintQuality = xRes;
-					devMode->dmYResolution = yRes;
-					devMode->dmFields |= DM_PRINTQUALITY;
-					devMode->dmFields |= DM_YRESOLUTION;
-				}
-//				DebugPrintf("show->dmXResolution=%s\n", szOpValue);
-			}
-		}
-		break;
-/*	case OPTID_OPTIONXRESOLUTION:
-		{
-			if ( szOpValue == NULL )
-				devMode->dmXResolution = 0;
-			else
-				devMode->dmXResolution = atoi(szOpValue); 
-		}
-		break;
-	case OPTID_OPTIONYRESOLUTION:
-		{
-			devMode->dmFields |= DM_DM_PRINTQUALITY;
+	memset(szCode, 0, sizeof(szCode));
+	devMode->dmPrintQuality = szOpValue ? GetOptionChoiceValue(pOpt, szOpValue) : 0;
 
-			if ( szOpValue == NULL )
-				devMode->dmYResolution = 0;
-			else
-				devMode->dmYResolution = atoi(szOpValue); 
-		}
-		break;
-*/
-	case OPTID_OPTIONPRINTERSPEED:
-		{
-//			DebugPrintf("show->dmPrintSpeed=%s\n", szOpValue);
-//			devMode->dmPrintSpeed = GetOptionIndexByChoice(cups, ppd, opID, szOpValue);
-			devMode->dmFields |= DM_PRINTSPEED;
-			if ( szOpValue )
-				devMode->dmPrintSpeed = atoi(szOpValue);
-			else
-				devMode->dmPrintSpeed = 20;
-		}
-		break;
-	case OPTID_OPTIONDARKNESS:
-		{
-//			DebugPrintf("show->dmDarkness=%s\n", szOpValue);
-			devMode->dmFields |= DM_DARKNESS;
-			if ( szOpValue == NULL )
-				devMode->dmDarkness = 1;
-			else
-				devMode->dmDarkness = atoi(szOpValue);
-		}
-		break;
-	case OPTID_OPTIONDIRECTTOBUFFER:
-		{
-//			DebugPrintf("show->dmDirectBuffer=%s\n", szOpValue);
-//			devMode->dmDirectBuffer = GetOptionIndexByChoice(cups, ppd, opID, szOpValue);
-			devMode->dmFields |= DM_DIRECTBUFFER;
-			devMode->dmDirectBuffer = GetItemIndexByValue(opID, szOpValue);
-		}
-		break;
-	case OPTID_OPTIONSTOREDGRAPHICS:
+	// The PPD code has the real resolution, "<</HWResolution[x y]>>setpagedevice"
+	if ( GetOptionCodeByChoice(cups, ppd, pOpt->id, szOpValue, szCode) )
+	{
+		if ( sscanf(szCode, "<</HWResolution[%d %d]", &xRes, &yRes) == 2 )
 		{
-//			DebugPrintf("show->dmStoredGriphics=%s\n", szOpValue);
-//			devMode->dmStoredGriphics = GetOptionIndexByChoice(cups, ppd, opID, szOpValue);
-			devMode->dmFields |= DM_STOREDGRIPHICS;
-			devMode->dmStoredGriphics = GetItemIndexByValue(opID, szOpValue);
+			devMode->dmPrintQuality = xRes;
+			devMode->dmYResolution = yRes;
+			devMode->dmFields |= DM_PRINTQUALITY;
+			devMode->dmFields |= DM_YRESOLUTION;
 		}
-		break;
+	}
 
-		// Printing Postion
-	case OPTID_PRNPOSHORIZONTALOFFSET:
-		{
-//			DebugPrintf("show->dmAdjustHorizontal=%s\n", szOpValue);
-			devMode->dmFields |= DM_ADJUSTHORIZONTAL;
-			if ( szOpValue == NULL )
-			{
-				devMode->dmAdjustHorizontal = 0.0;
-			}
-			else
-			{
-				fValue = atof(szOpValue);
-				devMode->dmAdjustHorizontal = fValue; 
+	return TRUE;
+}
 
-//				if ( devMode->dmMetric == DMMETRIC_INCH )
-//					devMode->dmAdjustHorizontal = POINT2INCH(fValue); 
-//				else
-//					devMode->dmAdjustHorizontal = POINT2MM(fValue); 
-			}
-		}
-		break;
-	case OPTID_PRNPOSVERTICALOFFSET:
+BOOL 
+ParseMetric(const TSC_OPTION_NAME_T *pOpt, CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, char* szOpValue)
+{
+	if ( szOpValue )
+	{
+		if ( !strcmp(szOpValue, STR_PPDMETRIC_AUTO) )
 		{
-//			DebugPrintf("show->dmAdjustVertical=%s\n", szOpValue);
-			devMode->dmFields |= DM_ADJUSTVERTICAL;
-			if ( szOpValue == NULL )
-			{
-				devMode->dmAdjustVertical = 0.0;
-			}
-			else
-			{
-				fValue = atof(szOpValue);
-				devMode->dmAdjustVertical = fValue; 
+			char			syslang[128];
 
-//				if ( devMode->dmMetric == DMMETRIC_INCH )
-//					devMode->dmAdjustVertical = POINT2INCH(fValue); 
-//				else
-//					devMode->dmAdjustVertical = POINT2MM(fValue); 
-			}
-		}
-		break;
+			memset(syslang, 0, sizeof(syslang));
 
-		// User Command
-	case OPTID_USERCMDFUNCHARACTER:
-		{
-//			DebugPrintf("show->dmCmdFuncChar=%s\n", szOpValue);
-			devMode->dmFields |= DM_CMDFUNCCHAR;
-			if ( szOpValue == NULL )
-				devMode->dmCmdFuncChar = ' ';
-			else
-				devMode->dmCmdFuncChar = szOpValue[0];
-		}
-		break;
-	case OPTID_LENUSERCMDSTARTJOB:		//"LenStartJob"
-		{
-			if ( szOpValue == NULL )
-				devMode->dmCmdStartJobLength = 0; 
-			else
-				devMode->dmCmdStartJobLength = atoi(szOpValue);
-		}
-		break;
-	case OPTID_LENUSERCMDSTARTLABEL:	//"LenStartLabel"
-		{
-			if ( szOpValue == NULL )
-				devMode->dmCmdStartLabelLength = 0; 
-			else
-				devMode->dmCmdStartLabelLength = atoi(szOpValue);
-		}
-		break;
-	case OPTID_LENUSERCMDENDLABEL:		// "LenEndLabel"
-		{
-			if ( szOpValue == NULL )
-				devMode->dmCmdEndLabelLength = 0; 
-			else
-				devMode->dmCmdEndLabelLength = atoi(szOpValue);
-		}
-		break;
-	case OPTID_LENUSERCMDENDJOB:		// "LenEndJob"
-		{
-			if ( szOpValue == NULL )
-				devMode->dmCmdEndJobLength = 0; 
-			else
-				devMode->dmCmdEndJobLength = atoi(szOpValue);
-		}
-		break;
-	case OPTID_USERCMDSTARTJOB:
-		{
-//			char strStartJob[DM_USER_COMMOND_LENGTH];
-		
-			devMode->dmFields |= DM_CMDSTARTJOB;
-			memset(szOpCmdValue, 0, sizeof(szOpCmdValue));			
-			Decode(szOpValue, devMode->dmCmdStartJob);
-		}
-		break;
-	case OPTID_USERCMDSTARTLABEL:
-		{
-//			char strStartLabel[DM_USER_COMMOND_LENGTH];
-			devMode->dmFields |= DM_CMDSTARTLABEL;
-		
-			memset(szOpCmdValue, 0, sizeof(szOpCmdValue));			
-			Decode(szOpValue, devMode->dmCmdStartLable);
-		}
-		break;
-	case OPTID_USERCMDENDLABEL:
-		{
-			devMode->dmFields |= DM_CMDENDLABEL;
-			memset(szOpCmdValue, 0, sizeof(szOpCmdValue));			
-			Decode(szOpValue, devMode->dmCmdEndLable);
-		}
-		break;
-	case OPTID_USERCMDENDJOB:
-		{
-//			DebugPrintf("USERCMDENDJOB, No1\n");
-			devMode->dmFields |= DM_CMDENDJOB;
-			memset(szOpCmdValue, 0, sizeof(szOpCmdValue));			
-			Decode(szOpValue, devMode->dmCmdEndJob);
-		}
-		break;
-	case OPTID_USERCMDSTARTJOBNOCTRL:	//			"OriStartJob"
-		{
-//			memset(oriCmdEndLabel, 0, sizeof(oriCmdStartJob));
-			if ( szOpValue )
-				Decode(szOpValue, devMode->dmCmdOriStartJob);
-//			DebugPrintf("Load, devMode->dmCmdOriStartJob=%s\n", devMode->dmCmdOriStartJob);
-		}
-		break;
-	case OPTID_USERCMDSTARTLABELNOCTRL: // 			"OriStartLabel"
-		{
-			if ( szOpValue )
-				Decode(szOpValue, devMode->dmCmdOriStartLable);
-//			DebugPrintf("Load, devMode->dmCmdOriStartLable=%s\n", devMode->dmCmdOriStartLable);
-		}
-		break;
-	case OPTID_USERCMDENDLABELNOCTRL:	// 			"OriEndLabel"
-		{
-			if ( szOpValue )
-				Decode(szOpValue, devMode->dmCmdOriEndLable);
-//			DebugPrintf("Load, devMode->dmCmdOriEndLable=%s\n", devMode->dmCmdOriEndLable);
+			devMode->dmMetric = SetMetricString(syslang, cups);
 		}
-		break;
-	case OPTID_USERCMDENDJOBNOCTRL:		// 			"OriEndJob"
+		else if ( !strcmp(szOpValue, STR_PPDMETRIC_MM) )
 		{
-			if ( szOpValue )
-				Decode(szOpValue, devMode->dmCmdOriEndJob);
-//			DebugPrintf("Load, devMode->dmCmdOriEndJob=%s\n", devMode->dmCmdOriEndJob);
+			devMode->dmMetric = DMMETRIC_MM;
 		}
-		break;
-	case OPTID_METRIC:
+		else
 		{
-			if ( szOpValue )
-			{
-				if ( !strcmp(szOpValue, STR_PPDMETRIC_AUTO) )
-				{
-					char			syslang[128];
-
-					memset(syslang, 0, sizeof(syslang));
-
-					devMode->dmMetric = SetMetricString(syslang, cups);
-				}
-				else if ( !strcmp(szOpValue, STR_PPDMETRIC_MM) )
-				{
-					devMode->dmMetric = DMMETRIC_MM;
-				}
-				else
-				{
-					devMode->dmMetric = DMMETRIC_INCH;
-				}
-			}
+			devMode->dmMetric = DMMETRIC_INCH;
 		}
-		break;
-	default:
-		break;
 	}
 
-	return bRet;
+	return TRUE;
 }
-
-
-
-
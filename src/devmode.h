@@ -28,12 +28,17 @@
 #include <stdlib.h>
 #include "libloader.h"
 #include "devoption.h"
+#include "ppdcache.h"
 
 #define DM_HEADER_MARKER   ((WORD) ('M' << 8) | 'D')
 
-#define DM_USER_COMMOND_LENGTH			1024
+#ifndef _DEVMODE_DECLARED_
+#define _DEVMODE_DECLARED_
+typedef struct _DEVMODE DEVMODE;
+#endif
 
-typedef struct {
+// Opaque to libtsplenc's callers, see TSPL_CreateDevmode()
+struct _DEVMODE {
 	WORD	dmType;					// DM_HEADER_MARKER
 	WORD	dmSize;					// sizeof(DEVMODE)
 	WORD	dmSizeExtra;			//
@@ -59,6 +64,11 @@ typedef struct {
 	float	dmFeedOffset;			// Point (1/72inch)
 	float	dmVerticalOffset;		// Point (1/72inch)
 
+	WORD	dmColumns;				// Labels across the liner
+	float	dmColumnGap;			// Point (1/72inch), between two columns
+	WORD	dmAutoLength;			// Continuous media, trim to the content
+	float	dmAutoLengthMargin;		// Point (1/72inch), kept below the content
+
 	WORD	dmPrintSpeed;			// 1/10 inch/sec
 	WORD	dmDarkness;				// 0 - 15
 
@@ -72,17 +82,14 @@ typedef struct {
 	WORD	dmCmdStartLabelLength;		// Bytes Length of User Command StartLabel
 	WORD	dmCmdEndLabelLength;		// Bytes Length of User Command EndLabel
 	WORD	dmCmdEndJobLength;			// Bytes Length of User Command EndJob
-	BYTE	dmCmdStartJob[DM_USER_COMMOND_LENGTH];		//  User Command StartJob
-	BYTE	dmCmdStartLable[DM_USER_COMMOND_LENGTH];	//  User Command StartJob
-	BYTE	dmCmdEndLable[DM_USER_COMMOND_LENGTH];		//  User Command StartJob
-	BYTE	dmCmdEndJob[DM_USER_COMMOND_LENGTH];		//  User Command StartJob
+	// The blocks are in the PPD cache, or follow the DEVMODE (dmSizeExtra)
+	// when it is read from a pipe. See GetDevmodeCommands().
+	LPBYTE	dmCmdStartJob;				//  User Command StartJob
+	LPBYTE	dmCmdStartLable;			//  User Command StartLabel
+	LPBYTE	dmCmdEndLable;				//  User Command EndLabel
+	LPBYTE	dmCmdEndJob;				//  User Command EndJob
 	CHAR	dmCmdFuncChar;
 
-	BYTE	dmCmdOriStartJob[DM_USER_COMMOND_LENGTH];		//  User Command StartJob
-	BYTE	dmCmdOriStartLable[DM_USER_COMMOND_LENGTH];		//  User Command StartJob
-	BYTE	dmCmdOriEndLable[DM_USER_COMMOND_LENGTH];		//  User Command StartJob
-	BYTE	dmCmdOriEndJob[DM_USER_COMMOND_LENGTH];			//  User Command StartJob
-
 	WORD	dmMetric;
 	WORD	dmPrintQuality;
 	WORD	dmXResolution;
@@ -94,7 +101,7 @@ typedef struct {
 	WORD	dmOutPages;
 	WORD	dmCollate;
 
-} DEVMODE;
+};
 
 // dmFields
 #define DM_ORIENTATION      	0x00000001L
@@ -127,6 +134,8 @@ typedef struct {
 #define	DM_YRESOLUTION			0x08000000L
 #define	DM_COPIES				0x10000000L
 #define DM_PAPERSIZE	      	0x20000000L
+#define	DM_COLUMNS				0x40000000L		// dmColumns and dmColumnGap
+// 0x80000000 is the last free bit, options added since have no flag and are always set
 
 // dmOrientation
 #define DMORIENT_PORTRAIT			1
@@ -138,6 +147,10 @@ typedef struct {
 #define DMMIRRORIMAGE_OFF			0
 #define DMMIRRORIMAGE_ON			1
 
+// dmAutoLength
+#define DMAUTOLENGTH_OFF			0
+#define DMAUTOLENGTH_ON				1
+
 // dmNegativeImage;
 #define DMNEGATIVEIMAGE_OFF			0
 #define DMNEGATIVEIMAGE_ON			1
@@ -245,23 +258,40 @@ typedef struct {
 #define VEROFFSET_MAX_VALUE			1		//(in)
 #define VEROFFSET_MIN_VALUE			-1
 
-extern float			g_fCurPaperSizeHeight;
-extern float			g_fCurPaperSizeWidth;
+// range of dmColumns, dmColumnGap value
+#define COLUMNS_MAX_VALUE			8
+#define COLUMNGAP_MAX_VALUE			1		//(in)
+#define COLUMNGAP_MIN_VALUE			0
+
+// range of dmAutoLengthMargin value
+#define AUTOLENGTHMARGIN_MAX_VALUE	1		//(in)
+#define AUTOLENGTHMARGIN_MIN_VALUE	0
 
 
 BOOL get_option_name_byID(char* szOptionName, int opID);
-int	GetPrinterOptions(const char* szPrnName, cups_option_t **options, CUPSLIB_FUNCTION *cups);
+PPDCACHE* OpenPrinterPPD(const char* szPrnName, CUPSLIB_FUNCTION *cups);
+int	GetPrinterOptions(ppd_file_t *ppd, cups_option_t **options, CUPSLIB_FUNCTION *cups);
 int GetItemIndexByValue(int opID, char* szOpValue);
-int GetOptionIndexByChoice(CUPSLIB_FUNCTION* cups, ppd_file_t* ppd, int opID, char* szOpKey);
-BOOL GetOptionCodeByChoice(CUPSLIB_FUNCTION* cups, ppd_file_t* ppd, int opID, char* szOpKey, char* szOpCode);
+int GetOptionIndexByChoice(CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, int opID, char* szOpKey);
+BOOL GetOptionCodeByChoice(CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, int opID, char* szOpKey, char* szOpCode);
 int GetOptionIDByName(char* szName);
 const TSC_OPTION_NAME_T* GetOptionTypeByName(char* szName);
-BOOL SetDevmodeFromOptions(CUPSLIB_FUNCTION* cups, ppd_file_t* ppd, DEVMODE* devMode, int num_options, cups_option_t *options);
-BOOL SetDevmodeFromOption(CUPSLIB_FUNCTION* cups, ppd_file_t* ppd, DEVMODE* devMode, int opID, char* szOpValue);
-
+const TSC_OPTION_NAME_T* GetOptionTypeByID(int opID);
+int GetOptionCommandIndex(const TSC_OPTION_NAME_T *pOpt);
+WORD GetOptionChoiceValue(const TSC_OPTION_NAME_T *pOpt, const char *szOpValue);
+BOOL SetOptionValue(const TSC_OPTION_NAME_T *pOpt, DEVMODE* devMode, const char* szOpValue);
+BOOL SetDevmodeFromOptions(CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, int num_options, cups_option_t *options);
+BOOL SetDevmodeFromOption(CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, int opID, char* szOpValue);
+BOOL ApplyOption(const TSC_OPTION_NAME_T *pOpt, CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, char* szOpValue);
+BOOL ParsePageSize(const TSC_OPTION_NAME_T *pOpt, CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, char* szOpValue);
+BOOL ParseResolution(const TSC_OPTION_NAME_T *pOpt, CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, char* szOpValue);
+BOOL ParseMetric(const TSC_OPTION_NAME_T *pOpt, CUPSLIB_FUNCTION* cups, PPDCACHE* ppd, DEVMODE* devMode, char* szOpValue);
+
+int GetPpdOptions(ppd_file_t *ppd, ppd_option_t ***options);
 int GetPrinterOptionsCommand(cups_option_t **options, CUPSLIB_FUNCTION *cups, ppd_file_t *ppd, char *OptionKey, int *num);
 
 float OnValidValue(float fSrcValue, float fMin, float fMax);
+void GetDevmodeCommands(DEVMODE *pdm, LPBYTE *ppCmd[PPDCACHE_NUM_COMMANDS], WORD *pwLength[PPDCACHE_NUM_COMMANDS]);
 WORD SetMetricString(char* szSysLang, CUPSLIB_FUNCTION* cups);
 
 #endif	// #ifndef _DEVMODE_H_
@@ -0,0 +1,299 @@
+/*
+ * "devoption.c 2021-05-17 15:55:05
+ *
+ *  ppd option registry for TSC Printer Driver
+ *
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "devmode.h"
+#include "devoption.h"
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define DMOFFSET(m)		offsetof(DEVMODE, m)
+
+static const TSC_OPTION_CHOICE_T g_orientation_choices[] = {
+	{"1",							DMORIENT_PORTRAIT},
+	{"2",							DMORIENT_LANDSCAPE},
+	{"3",							DMORIENT_PORTRAIT_180},
+	{"4",							DMORIENT_LANDSCAPE_180},
+	{NULL}
+};
+
+static const TSC_OPTION_CHOICE_T g_mediamethod_choices[] = {
+	{STR_MEDIAMETHOD_NORMAL,		DMMEDIAMETHOD_NORMAL},
+	{STR_MEDIAMETHOD_DIRECT,		DMMEDIAMETHOD_DIRECT},
+	{STR_MEDIAMETHOD_TRANSFER,		DMMEDIAMETHOD_TRANSFER},
+	{NULL}
+};
+
+static const TSC_OPTION_CHOICE_T g_mediatype_choices[] = {
+	{STR_MEDIATYPE_LBLGAPS,			DMMEDIATYPE_GAPS},
+	{STR_MEDIATYPE_LBLMARK,			DMMEDIATYPE_MARK},
+	{STR_MEDIATYPE_CONTINUE,		DMMEDIATYPE_CONTINUE},
+	{NULL}
+};
+
+static const TSC_OPTION_CHOICE_T g_postaction_choices[] = {
+	{STR_POSTACTION_NONE,			DMPOSTACTION_NONE},
+	{STR_POSTACTION_TEAROFF,		DMPOSTACTION_TEAROFF},
+	{STR_POSTACTION_PEELOFF,		DMPOSTACTION_PEELOFF},
+	{STR_POSTACTION_CUT,			DMPOSTACTION_CUT},
+	{STR_POSTACTION_PARTIALCUT,		DMPOSTACTION_PARTIAL},
+	{NULL}
+};
+
+static const TSC_OPTION_CHOICE_T g_occurrence_choices[] = {
+	{STR_OCCURRENCE_EVERY,			DMOCCURRENCE_EVERY},
+	{STR_OCCURRENCE_COPIES,			DMOCCURRENCE_COPIES},
+	{STR_OCCURRENCE_JOB,			DMOCCURRENCE_JOB},
+	{STR_OCCURRENCE_SPECIFIED,		DMOCCURRENCE_SPECIFIED},
+	{NULL}
+};
+
+static const TSC_OPTION_CHOICE_T g_directbuffer_choices[] = {
+	{STR_DIRECTBUFFER_AUTO,			DMDIRECTBUFFER_AUTO},
+	{STR_DIRECTBUFFER_8BIT,			DMDIRECTBUFFER_8BIT},
+	{STR_DIRECTBUFFER_REL,			DMDIRECTBUFFER_REL},
+	{STR_DIRECTBUFFER_DISABLE,		DMDIRECTBUFFER_DISABLE},
+	{NULL}
+};
+
+static const TSC_OPTION_CHOICE_T g_storedgraphics_choices[] = {
+	{STR_STOREDGRIPHICS_AUTO,		DMSTOREDGRIPHICS_AUTO},
+	{STR_STOREDGRIPHICS_PCX,		DMSTOREDGRIPHICS_PCX},
+	{NULL}
+};
+
+static const TSC_OPTION_CHOICE_T g_resolution_choices[] = {
+	{STR_RESOLUTION_203DPI,			DPI_203},
+	{STR_RESOLUTION_300DPI,			DPI_300},
+	{STR_RESOLUTION_600DPI,			DPI_600},
+	{NULL}
+};
+
+#ifdef _TSPLENC_LIB
+// libtsplenc has no PPD and no libcups. The options that need them parse
+// to nothing there, TSPL_SetDevmodeOption() turns them down.
+static BOOL ParseNeedsPPD(const TSC_OPTION_NAME_T *pOpt, CUPSLIB_FUNCTION *cups, PPDCACHE *ppd, DEVMODE *devMode, char *szOpValue)
+{
+	return FALSE;
+}
+
+#define	ParsePageSize			ParseNeedsPPD
+#define	ParseResolution			ParseNeedsPPD
+#define	ParseMetric				ParseNeedsPPD
+#endif
+
+// Looked up by name through the hash below, the order does not matter
+const TSC_OPTION_NAME_T g_tsc_options[] = {
+	// Page Setup
+	{OPTID_PAGESETUPNAME,			0,	"PageSize",				OPTTYPE_NONE,	DMOFFSET(dmPaperSize),			0,						0,		NULL,						OPTRANGE_NONE,	0, 0,	ParsePageSize},
+	{OPTID_PAGEMIRRORIMAGE,			0,	"MirrorImage",			OPTTYPE_BOOL,	DMOFFSET(dmMirrorImage),		DM_MIRRORIMAGE,			DMMIRRORIMAGE_OFF,		NULL,		OPTRANGE_NONE,	0, 0,	NULL},
+	{OPTID_PAGENEGATIVEIMAGE,		0,	"NegativeImage",		OPTTYPE_BOOL,	DMOFFSET(dmNegativeImage),		DM_NEGATIVEIMAGE,		DMNEGATIVEIMAGE_OFF,	NULL,		OPTRANGE_NONE,	0, 0,	NULL},
+	{OPTID_PAGORIENTATION,			0,	"Orientation",			OPTTYPE_ENUM,	DMOFFSET(dmOrientation),		DM_ORIENTATION,			DMORIENT_PORTRAIT,		g_orientation_choices,		OPTRANGE_NONE,	0, 0,	NULL},
+
+	// Stock
+	{OPTID_STOCKMETHOD,				0,	"MediaMethod",			OPTTYPE_ENUM,	DMOFFSET(dmMediaMethod),		DM_MEDIAMETHOD,			DMMEDIAMETHOD_NORMAL,	g_mediamethod_choices,		OPTRANGE_NONE,	0, 0,	NULL},
+	{OPTID_STOCKTYPE,				0,	"PaperType",			OPTTYPE_ENUM,	DMOFFSET(dmMediaType),			DM_MEDIATYPE,			DMMEDIATYPE_GAPS,		g_mediatype_choices,		OPTRANGE_NONE,	0, 0,	NULL},
+	{OPTID_STOCKMARKHEIGHT,			0,	"MarkHeight",			OPTTYPE_FLOAT,	DMOFFSET(dmGapHeight),			DM_GAPHEIGHT,			0,		NULL,	OPTRANGE_INCH,			GAPHEIGHT_MIN_VALUE, GAPHEIGHT_MAX_VALUE,	NULL},
+	{OPTID_STOCKMARKOFFSET,			0,	"MarkOffset",			OPTTYPE_FLOAT,	DMOFFSET(dmGapOffset),			DM_GAPOFFSET,			0,		NULL,	OPTRANGE_GAPOFFSET,		-1, 1,		NULL},
+	{OPTID_STOCKPOSTSCRIPTACTION,	0,	"PostAction",			OPTTYPE_ENUM,	DMOFFSET(dmPostAction),			DM_POSTACTION,			DMPOSTACTION_NONE,		g_postaction_choices,		OPTRANGE_NONE,	0, 0,	NULL},
+	{OPTID_STOCKOCCURRENCE,			0,	"Occurrence",			OPTTYPE_ENUM,	DMOFFSET(dmOccurrence),			DM_OCCURRENCE,			DMOCCURRENCE_EVERY,		g_occurrence_choices,		OPTRANGE_NONE,	0, 0,	NULL},
+	{OPTID_STOCKINTERVAL,			0,	"Interval",				OPTTYPE_INT,	DMOFFSET(dmCutInterval),		DM_CUTINTERVAL,			1,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_STOCKFEEDOFFSET,			0,	"FeedOffset",			OPTTYPE_FLOAT,	DMOFFSET(dmFeedOffset),			DM_FEEDOFFSET,			0,		NULL,	OPTRANGE_INCH,			FEEDOFFSET_MIN_VALUE, FEEDOFFSET_MAX_VALUE,	NULL},
+	{OPTID_STOCKVERTICALOFFSET,		0,	"VerticalOffset",		OPTTYPE_FLOAT,	DMOFFSET(dmVerticalOffset),		DM_VERTICALOFFSET,		0,		NULL,	OPTRANGE_INCH,			VEROFFSET_MIN_VALUE, VEROFFSET_MAX_VALUE,	NULL},
+
+	// Option
+	{OPTID_OPTIONPRINTERSPEED,		0,	"PrintSpeed",			OPTTYPE_INT,	DMOFFSET(dmPrintSpeed),			DM_PRINTSPEED,			20,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_OPTIONDARKNESS,			0,	"Darkness",				OPTTYPE_INT,	DMOFFSET(dmDarkness),			DM_DARKNESS,			1,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_OPTIONDIRECTTOBUFFER,	0,	"DirectBuffer",			OPTTYPE_ENUM,	DMOFFSET(dmDirectBuffer),		DM_DIRECTBUFFER,		DMDIRECTBUFFER_AUTO,	g_directbuffer_choices,		OPTRANGE_NONE,	0, 0,	NULL},
+	{OPTID_OPTIONSTOREDGRAPHICS,	0,	"StoredGraphics",		OPTTYPE_ENUM,	DMOFFSET(dmStoredGriphics),		DM_STOREDGRIPHICS,		DMSTOREDGRIPHICS_AUTO,	g_storedgraphics_choices,	OPTRANGE_NONE,	0, 0,	NULL},
+	{OPTID_OPTIONPRINTQUALITY,		0,	"Resolution",			OPTTYPE_ENUM,	DMOFFSET(dmPrintQuality),		0,						DPI_203,				g_resolution_choices,		OPTRANGE_NONE,	0, 0,	ParseResolution},
+	{OPTID_OPTIONXRESOLUTION,		0,	"XResolution",			OPTTYPE_NONE,	DMOFFSET(dmXResolution),		0,						0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_OPTIONYRESOLUTION,		0,	"YResolution",			OPTTYPE_NONE,	DMOFFSET(dmYResolution),		0,						0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+
+	// Printing Postion
+	{OPTID_PRNPOSHORIZONTALOFFSET,	0,	"AdjustHoriaontal",		OPTTYPE_FLOAT,	DMOFFSET(dmAdjustHorizontal),	DM_ADJUSTHORIZONTAL,	0,		NULL,	OPTRANGE_PAPERWIDTH,	0, 1,		NULL},
+	{OPTID_PRNPOSVERTICALOFFSET,	0,	"AdjustVertical",		OPTTYPE_FLOAT,	DMOFFSET(dmAdjustVertical),		DM_ADJUSTVERTICAL,		0,		NULL,	OPTRANGE_PAPERHEIGHT,	0, 1,		NULL},
+
+	// User Command
+	{OPTID_USERCMDFUNCHARACTER,		0,	"FunctionCharacter",	OPTTYPE_CHAR,	DMOFFSET(dmCmdFuncChar),		DM_CMDFUNCCHAR,			' ',	NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_USERCMDSTARTJOB,			0,	"StartJob",				OPTTYPE_COMMAND,	DMOFFSET(dmCmdStartJob),	DM_CMDSTARTJOB,			0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_USERCMDSTARTLABEL,		0,	"StartLabel",			OPTTYPE_COMMAND,	DMOFFSET(dmCmdStartLable),	DM_CMDSTARTLABEL,		0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_USERCMDENDLABEL,			0,	"EndLabel",				OPTTYPE_COMMAND,	DMOFFSET(dmCmdEndLable),	DM_CMDENDLABEL,			0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_USERCMDENDJOB,			0,	"EndJob",				OPTTYPE_COMMAND,	DMOFFSET(dmCmdEndJob),		DM_CMDENDJOB,			0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_LENUSERCMDSTARTJOB,		0,	"LenStartJob",			OPTTYPE_INT,	DMOFFSET(dmCmdStartJobLength),	0,						0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_LENUSERCMDSTARTLABEL,	0,	"LenStartLabel",		OPTTYPE_INT,	DMOFFSET(dmCmdStartLabelLength),	0,					0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_LENUSERCMDENDLABEL,		0,	"LenEndLabel",			OPTTYPE_INT,	DMOFFSET(dmCmdEndLabelLength),	0,						0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_LENUSERCMDENDJOB,		0,	"LenEndJob",			OPTTYPE_INT,	DMOFFSET(dmCmdEndJobLength),	0,						0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+
+	{OPTID_USERCMDSTARTJOBNOCTRL,	0,	"OriStartJob",			OPTTYPE_NONE,		0,		0,				0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_USERCMDSTARTLABELNOCTRL,	0,	"OriStartLabel",		OPTTYPE_NONE,		0,	0,				0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_USERCMDENDLABELNOCTRL,	0,	"OriEndLabel",			OPTTYPE_NONE,		0,		0,				0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_USERCMDENDJOBNOCTRL,		0,	"OriEndJob",			OPTTYPE_NONE,		0,		0,				0,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_METRIC,					0,	"OptionDisplayUnit",	OPTTYPE_NONE,	DMOFFSET(dmMetric),				0,						0,		NULL,	OPTRANGE_NONE,			0, 0,		ParseMetric},
+
+	// Multi-across and continuous stock
+	{OPTID_STOCKCOLUMNS,			0,	"Columns",				OPTTYPE_INT,	DMOFFSET(dmColumns),			DM_COLUMNS,				1,		NULL,	OPTRANGE_NONE,			0, 0,		NULL},
+	{OPTID_STOCKCOLUMNGAP,			0,	"ColumnGap",			OPTTYPE_FLOAT,	DMOFFSET(dmColumnGap),			DM_COLUMNS,				0,		NULL,	OPTRANGE_INCH,			COLUMNGAP_MIN_VALUE, COLUMNGAP_MAX_VALUE,	NULL},
+	{OPTID_STOCKAUTOLENGTH,			0,	"AutoLength",			OPTTYPE_BOOL,	DMOFFSET(dmAutoLength),			0,						DMAUTOLENGTH_OFF,		NULL,		OPTRANGE_NONE,	0, 0,	NULL},
+	{OPTID_STOCKAUTOLENGTHMARGIN,	0,	"AutoLengthMargin",		OPTTYPE_FLOAT,	DMOFFSET(dmAutoLengthMargin),	0,						0,		NULL,	OPTRANGE_INCH,			AUTOLENGTHMARGIN_MIN_VALUE, AUTOLENGTHMARGIN_MAX_VALUE,	NULL}
+};
+
+const int g_tsc_options_num = sizeof(g_tsc_options)/sizeof(TSC_OPTION_NAME_T);
+
+// Hash of the keywords above, FNV-1a with linear probing. The slots are
+// built from g_tsc_options on the first lookup, each holds the table
+// index + 1 of a name, 0 for none.
+#define OPTION_HASH_BITS		7
+#define OPTION_HASH_MASK		((1 << OPTION_HASH_BITS) - 1)
+
+// Keep some slots free so that probing stays short
+typedef char option_slots_fit[ARRAYCOUNT(g_tsc_options) * 2 <= (1 << OPTION_HASH_BITS) ? 1 : -1];
+
+static BYTE g_option_slots[1 << OPTION_HASH_BITS];
+static pthread_once_t g_option_once = PTHREAD_ONCE_INIT;
+
+static DWORD OptionHash(const char *szName)
+{
+	DWORD		hash = 0x811c9dc5u;
+
+	for ( ; *szName; szName++)
+		hash = (hash ^ (BYTE)*szName) * 16777619u;
+
+	return hash >> (32 - OPTION_HASH_BITS);
+}
+
+// A name listed twice would be shadowed by the first one and never reach
+// the DEVMODE, that is reported in every build
+static void BuildOptionSlots(void)
+{
+	DWORD		slot;
+	int			i;
+
+	for (i=0; i<g_tsc_options_num; i++)
+	{
+		for (slot=OptionHash(g_tsc_options[i].name); g_option_slots[slot]; slot=(slot + 1) & OPTION_HASH_MASK)
+		{
+			if ( !strcmp(g_tsc_options[g_option_slots[slot] - 1].name, g_tsc_options[i].name) )
+			{
+				Error_Log(LEVEL_ERROR, "Option registry: '%s' is listed twice\n", g_tsc_options[i].name);
+				break;
+			}
+		}
+		if ( g_option_slots[slot] == 0 )
+			g_option_slots[slot] = (BYTE)(i + 1);
+	}
+}
+
+const TSC_OPTION_NAME_T * GetOptionTypeByName(char* szName)
+{
+	const TSC_OPTION_NAME_T *pOpt;
+	DWORD					slot;
+
+	if ( szName == NULL )
+		return NULL;
+
+	pthread_once(&g_option_once, BuildOptionSlots);
+
+	for (slot=OptionHash(szName); g_option_slots[slot]; slot=(slot + 1) & OPTION_HASH_MASK)
+	{
+		pOpt = &g_tsc_options[g_option_slots[slot] - 1];
+		if ( !strcmp(pOpt->name, szName) )
+			return pOpt;
+	}
+	return NULL;
+}
+
+const TSC_OPTION_NAME_T * GetOptionTypeByID(int opID)
+{
+	int			i;
+
+	for (i=0; i<g_tsc_options_num; i++)
+	{
+		if ( g_tsc_options[i].id == opID )
+			return &g_tsc_options[i];
+	}
+	return NULL;
+}
+
+// PPDCACHE_CMD_* of a user command option, -1 for others
+int GetOptionCommandIndex(const TSC_OPTION_NAME_T *pOpt)
+{
+	switch ( pOpt->id ) {
+	case OPTID_USERCMDSTARTJOB:
+		return PPDCACHE_CMD_STARTJOB;
+	case OPTID_USERCMDSTARTLABEL:
+		return PPDCACHE_CMD_STARTLABEL;
+	case OPTID_USERCMDENDLABEL:
+		return PPDCACHE_CMD_ENDLABEL;
+	case OPTID_USERCMDENDJOB:
+		return PPDCACHE_CMD_ENDJOB;
+	}
+	return -1;
+}
+
+// Value of a choice, the option default if it is not one
+WORD GetOptionChoiceValue(const TSC_OPTION_NAME_T *pOpt, const char *szOpValue)
+{
+	const TSC_OPTION_CHOICE_T	*choice;
+
+	if ( szOpValue && pOpt->choices )
+	{
+		for (choice=pOpt->choices; choice->name; choice++)
+		{
+			if ( !strcmp(choice->name, szOpValue) )
+				return choice->value;
+		}
+	}
+	return (WORD)pOpt->fDefault;
+}
+
+// An entry of a plain type to its DEVMODE member, szOpValue NULL is the
+// default. Those with a parse callback and user commands are left to
+// ApplyOption().
+BOOL SetOptionValue(const TSC_OPTION_NAME_T *pOpt, DEVMODE* devMode, const char* szOpValue)
+{
+	LPBYTE			pField = (LPBYTE)devMode + pOpt->offset;
+
+	switch ( pOpt->type ) {
+	case OPTTYPE_BOOL:
+		*(WORD *)pField = (szOpValue && strcmp(szOpValue, DMBOOL_FALSE)) ? 1 : 0;
+		break;
+	case OPTTYPE_ENUM:
+		*(WORD *)pField = GetOptionChoiceValue(pOpt, szOpValue);
+		break;
+	case OPTTYPE_INT:
+		*(WORD *)pField = szOpValue ? atoi(szOpValue) : (WORD)pOpt->fDefault;
+		break;
+	case OPTTYPE_FLOAT:
+		*(float *)pField = szOpValue ? atof(szOpValue) : pOpt->fDefault;
+		break;
+	case OPTTYPE_CHAR:
+		*(CHAR *)pField = szOpValue ? szOpValue[0] : (CHAR)pOpt->fDefault;
+		break;
+	default:
+		return TRUE;
+	}
+
+	devMode->dmFields |= pOpt->field;
+	return TRUE;
+}
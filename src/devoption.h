@@ -22,6 +22,8 @@
 #define _DEVOPTION_H
 
 #include "common.h"
+#include "libloader.h"
+#include "ppdcache.h"
 
 #define	PPD_TSC_ATTR			"TscAttr"
 #define	PPD_ATTR_SPCFILE		"SPCFILE"
@@ -53,6 +55,10 @@
 #define	OPTID_STOCKINTERVAL						107		// PPD Interval
 #define	OPTID_STOCKFEEDOFFSET					108		// PPD Feed Offset
 #define	OPTID_STOCKVERTICALOFFSET				109		// PPD Vertical Offset
+#define	OPTID_STOCKCOLUMNS						110		// PPD Labels Across
+#define	OPTID_STOCKCOLUMNGAP					111		// PPD Column Gap
+#define	OPTID_STOCKAUTOLENGTH					112		// PPD Trim Continuous Labels
+#define	OPTID_STOCKAUTOLENGTHMARGIN				113		// PPD Trim Margin
 
 // Option
 #define	OPTID_OPTIONPRINTERSPEED				201		// PPD Printer Speed
@@ -95,70 +101,50 @@
 #define OPTID_METRIC							601
 
 
+// Option value types, see SetDevmodeFromOption()
+#define OPTTYPE_NONE			0		// Known, not applied
+#define OPTTYPE_BOOL			1		// WORD, "False" is 0, anything else 1
+#define OPTTYPE_ENUM			2		// WORD, from the choice table
+#define OPTTYPE_INT				3		// WORD
+#define OPTTYPE_FLOAT			4		// float
+#define OPTTYPE_CHAR			5		// CHAR, first character
+#define OPTTYPE_COMMAND			6		// User command block, base64 decoded
+
+// Range of a value, fMin/fMax are multiples of the unit
+#define OPTRANGE_NONE			0
+#define OPTRANGE_INCH			1		// 72 points
+#define OPTRANGE_PAPERWIDTH		2
+#define OPTRANGE_PAPERHEIGHT	3
+#define OPTRANGE_GAPOFFSET		4		// Paper height, gaps or mark only
+
+struct _DEVMODE;
+struct _TSC_OPTION_NAME_T;
+
+typedef BOOL (*PFN_OPTION_PARSE)(const struct _TSC_OPTION_NAME_T *pOpt, CUPSLIB_FUNCTION *cups,
+	PPDCACHE *ppd, struct _DEVMODE *devMode, char *szOpValue);
+
 typedef struct {
+	char*	name;
+	WORD	value;
+} TSC_OPTION_CHOICE_T;
+
+typedef struct _TSC_OPTION_NAME_T {
 	DWORD	id;
 	WORD	flag;
 	char*	name;
-} TSC_OPTION_NAME_T;
 
-//#ifdef _DEF_GLOBAL_DEVOPTION_
-static TSC_OPTION_NAME_T g_tsc_options[] = {
-		// Page Setup
-		{OPTID_PAGESETUPNAME, 						0,	"PageSize"},
-		{OPTID_PAGEMIRRORIMAGE,						0,	"MirrorImage"},
-		{OPTID_PAGENEGATIVEIMAGE,					0,	"NegativeImage"},
-		{OPTID_PAGORIENTATION,						0,	"Orientation"},
-
-		// Stock
-		{OPTID_STOCKMETHOD,	 						0,	"MediaMethod"},				// PPD Method
-		{OPTID_STOCKTYPE, 							0,	"PaperType"},				// PPD Type
-		{OPTID_STOCKMARKHEIGHT,						0,	"MarkHeight"},				// PPD Mark Height
-		{OPTID_STOCKMARKOFFSET,						0,	"MarkOffset"},				// PPD Mark Offset
-		{OPTID_STOCKPOSTSCRIPTACTION,				0,	"PostAction"},				// PPD Mark Post Script Action
-		{OPTID_STOCKOCCURRENCE,						0,	"Occurrence"},				// PPD Occurrence
-		{OPTID_STOCKINTERVAL, 						0,	"Interval"},				// PPD Interval
-		{OPTID_STOCKFEEDOFFSET,						0,	"FeedOffset"},				// PPD Feed Offset
-		{OPTID_STOCKVERTICALOFFSET,					0,	"VerticalOffset"},			// PPD Vertical Offset
-
-		// Option
-		{OPTID_OPTIONPRINTERSPEED, 					0,	"PrintSpeed"},				// PPD Printer Speed
-		{OPTID_OPTIONDARKNESS, 						0,	"Darkness"},				// PPD Darkness
-		{OPTID_OPTIONDIRECTTOBUFFER, 				0,	"DirectBuffer"},			// PPD Direct to Buffer
-		{OPTID_OPTIONSTOREDGRAPHICS, 				0,	"StoredGraphics"},			// PPD Store Graphics
-		{OPTID_OPTIONPRINTQUALITY, 					0,	"Resolution"},				// PPD Print Quality
-		{OPTID_OPTIONXRESOLUTION,					0,	"XResolution"},
-		{OPTID_OPTIONYRESOLUTION,					0,	"YResolution"},
-
-		// Printing Postion
-		{OPTID_PRNPOSHORIZONTALOFFSET,				0,	"AdjustHoriaontal"},		// PPD Horiaontal Offset
-		{OPTID_PRNPOSVERTICALOFFSET, 				0,	"AdjustVertical"},			// PPD Vertical Offset
-
-		// User Command
-		{OPTID_USERCMDFUNCHARACTER,					0,	"FunctionCharacter"},		// PPD User Command Fun Character
-		{OPTID_USERCMDSTARTJOB,						0,	"StartJob"},
-		{OPTID_USERCMDSTARTLABEL,					0,	"StartLabel"},
-		{OPTID_USERCMDENDLABEL,						0,	"EndLabel"},
-		{OPTID_USERCMDENDJOB,						0,	"EndJob"},
-		{OPTID_LENUSERCMDSTARTJOB,					0,	"LenStartJob"},
-		{OPTID_LENUSERCMDSTARTLABEL,				0,	"LenStartLabel"},
-		{OPTID_LENUSERCMDENDLABEL,					0,	"LenEndLabel"},
-		{OPTID_LENUSERCMDENDJOB,					0,	"LenEndJob"},
-
-		{OPTID_USERCMDSTARTJOBNOCTRL,				0,	"OriStartJob"},
-		{OPTID_USERCMDSTARTLABELNOCTRL,				0,	"OriStartLabel"},
-		{OPTID_USERCMDENDLABELNOCTRL,				0,	"OriEndLabel"},
-		{OPTID_USERCMDENDJOBNOCTRL,					0,	"OriEndJob"},
-		{OPTID_METRIC,								0,  "OptionDisplayUnit"}
-
-};
-
-static int						g_tsc_options_num = sizeof(g_tsc_options)/sizeof(TSC_OPTION_NAME_T);
-
-//#else
-
-//extern TSC_OPTION_NAME_T		g_tsc_options[];
-//extern int 						g_tsc_options_num;
-//#endif
+	WORD	type;					// OPTTYPE_*
+	WORD	offset;					// DEVMODE member
+	DWORD	field;					// dmFields bit set when applied
+	float	fDefault;				// Value when the option has none
+	const TSC_OPTION_CHOICE_T	*choices;		// OPTTYPE_ENUM, NULL name ends it
+	WORD	range;					// OPTRANGE_*
+	float	fMin;
+	float	fMax;
+	PFN_OPTION_PARSE	parse;		// Replaces the type handling
+} TSC_OPTION_NAME_T;
 
+extern const TSC_OPTION_NAME_T	g_tsc_options[];
+extern const int				g_tsc_options_num;
 
 #endif /* _DEVOPTION_H */
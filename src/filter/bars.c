@@ -0,0 +1,327 @@
+/*
+ * "bars.c 2021-05-17 15:55:05
+ *  
+ *  solid rectangles as BAR for TSC Printer Driver
+ *  
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ 
+ */
+
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "device.h"
+
+// A label plane is inverted 1 bit, 0 is black. The solid rectangles are
+// found with one scan of the black runs of each row: a rectangle stays
+// open while its span is all black in the next row, a maximal run no
+// open rectangle spans opens one. Rectangles worth a BAR are cleared from
+// the plane and what is left goes as BITMAPs around the rows still inked.
+// The rules of a frame stay four BARs: a BOX would be shorter, but its
+// corners are not checked against a printer.
+
+#define	DRAWMODE_OR				1
+
+#define	BARS_MIN_AREA			256			// Dots, a BAR costs about 20 bytes
+#define	BARS_MAX_OPEN			1024
+#define	BARS_MAX				1024
+#define	BARS_CMD_MAX			48			// "BITMAP x,y,w,h,1," or a BAR line
+
+typedef struct _BARRECT
+{
+	int			x, y;
+	int			cx, cy;
+} BARRECT;
+
+// All black from x0 to x1, dots
+static BOOL IsSolid(const BYTE *pLine, int x0, int x1)
+{
+	int		b0 = x0 >> 3, b1 = (x1 - 1) >> 3;
+	BYTE	m0 = 0xFF >> (x0 & 7);
+	BYTE	m1 = 0xFF << (7 - ((x1 - 1) & 7));
+	int		i;
+
+	if ( b0 == b1 )
+		return (pLine[b0] & m0 & m1) == 0;
+	if ( pLine[b0] & m0 || pLine[b1] & m1 )
+		return FALSE;
+	for (i=b0+1; i<b1; i++)
+	{
+		if ( pLine[i] )
+			return FALSE;
+	}
+	return TRUE;
+}
+
+// Next black run from x, -1 when there is none
+static int NextRun(const BYTE *pLine, int cx, int x, int *pEnd)
+{
+	while ( x < cx && (pLine[x >> 3] & (0x80 >> (x & 7))) )
+	{
+		// White bytes at once
+		if ( (x & 7) == 0 && pLine[x >> 3] == 0xFF )
+			x += 8;
+		else
+			x++;
+	}
+	if ( x >= cx )
+		return -1;
+
+	*pEnd = x;
+	while ( *pEnd < cx && !(pLine[*pEnd >> 3] & (0x80 >> (*pEnd & 7))) )
+	{
+		if ( (*pEnd & 7) == 0 && pLine[*pEnd >> 3] == 0 )
+			*pEnd += 8;
+		else
+			(*pEnd)++;
+	}
+	if ( *pEnd > cx )
+		*pEnd = cx;
+	return x;
+}
+
+static int FindBars(const BYTE *pPlane, unsigned cbLine, int cx, int cy, BARRECT *pBars)
+{
+	BARRECT		*pList = MEMALLOC(sizeof(BARRECT) * BARS_MAX_OPEN * 2);
+	BARRECT		*pOpen = pList, *pNext = pList + BARS_MAX_OPEN;
+	int			nOpen = 0, nNext, nBars = 0;
+	int			x, x1, y, i, j;
+
+	if ( pList == NULL )
+		return 0;
+
+	for (y=0; y<=cy; y++)
+	{
+		const BYTE	*pLine = pPlane + (size_t)cbLine * y;
+
+		// Close what does not go on, keep those worth a command
+		for (i=j=0; i<nOpen; i++)
+		{
+			BARRECT	*r = &pOpen[i];
+
+			if ( y < cy && IsSolid(pLine, r->x, r->x + r->cx) )
+			{
+				r->cy++;
+				pOpen[j++] = *r;
+			}
+			else if ( r->cx * r->cy >= BARS_MIN_AREA && nBars < BARS_MAX )
+			{
+				pBars[nBars++] = *r;
+			}
+		}
+		nOpen = j;
+		if ( y == cy )
+			break;
+
+		// Both lists go by x then width, so the runs are merged in
+		for (i=nNext=0, x=NextRun(pLine, cx, 0, &x1); x>=0; x=NextRun(pLine, cx, x1, &x1))
+		{
+			while ( i < nOpen && (pOpen[i].x < x || (pOpen[i].x == x && pOpen[i].cx < x1 - x)) )
+				pNext[nNext++] = pOpen[i++];
+			if ( i < nOpen && pOpen[i].x == x && pOpen[i].cx == x1 - x )
+				continue;
+			if ( nNext + nOpen - i >= BARS_MAX_OPEN )
+				break;
+
+			memset(&pNext[nNext], 0, sizeof(BARRECT));
+			pNext[nNext].x = x;
+			pNext[nNext].y = y;
+			pNext[nNext].cx = x1 - x;
+			pNext[nNext].cy = 1;
+			nNext++;
+		}
+		while ( i < nOpen )
+			pNext[nNext++] = pOpen[i++];
+
+		{
+			BARRECT	*pSwap = pOpen;
+
+			pOpen = pNext;
+			pNext = pSwap;
+			nOpen = nNext;
+		}
+	}
+
+	MEMFREE(pList);
+	return nBars;
+}
+
+static void FillPlane(LPBYTE pPlane, unsigned cbLine, int x, int y, int cx, int cy, BOOL bBlack)
+{
+	int		i, j;
+
+	for (j=y; j<y+cy; j++)
+	{
+		LPBYTE	pLine = pPlane + (size_t)cbLine * j;
+
+		for (i=x; i<x+cx; i++)
+		{
+			if ( bBlack )
+				pLine[i >> 3] &= ~(0x80 >> (i & 7));
+			else
+				pLine[i >> 3] |= 0x80 >> (i & 7);
+		}
+	}
+}
+
+// Rectangles and residual drawn again, against the page as it came
+static BOOL CheckPlane(const BYTE *pPlane, const BYTE *pResidual, unsigned cbLine, int cy, const BARRECT *pBars, int nBars)
+{
+	LPBYTE		pCheck = MEMALLOC((size_t)cbLine * cy);
+	BOOL		bRtn;
+	int			i;
+
+	if ( pCheck == NULL )
+		return FALSE;
+
+	memcpy(pCheck, pResidual, (size_t)cbLine * cy);
+	for (i=0; i<nBars; i++)
+		FillPlane(pCheck, cbLine, pBars[i].x, pBars[i].y, pBars[i].cx, pBars[i].cy, TRUE);
+
+	bRtn = !memcmp(pCheck, pPlane, (size_t)cbLine * cy);
+	MEMFREE(pCheck);
+	return bRtn;
+}
+
+static BOOL IsBlankRow(const BYTE *pLine, unsigned cbLine)
+{
+	unsigned	i;
+
+	for (i=0; i<cbLine; i++)
+	{
+		if ( pLine[i] != 0xFF )
+			return FALSE;
+	}
+	return TRUE;
+}
+
+// BITMAP of rows y0 to y1, cut to the bytes inked in any of them
+static size_t AppendBitmap(LPBYTE pOut, const BYTE *pPlane, unsigned cbLine, unsigned y0, unsigned y1)
+{
+	unsigned	b0 = cbLine, b1 = 0;
+	size_t		cb;
+	unsigned	y, i;
+
+	for (y=y0; y<y1; y++)
+	{
+		const BYTE	*pLine = pPlane + (size_t)cbLine * y;
+
+		for (i=0; i<b0; i++)
+		{
+			if ( pLine[i] != 0xFF )
+			{
+				b0 = i;
+				break;
+			}
+		}
+		for (i=cbLine; i>b1 + 1; i--)
+		{
+			if ( pLine[i - 1] != 0xFF )
+			{
+				b1 = i - 1;
+				break;
+			}
+		}
+	}
+	b1 = max(b0, b1);
+
+	cb = sprintf((char *)pOut, "BITMAP %u,%u,%u,%u,%d,", b0 * 8, y0, b1 - b0 + 1, y1 - y0, DRAWMODE_OR);
+	for (y=y0; y<y1; y++)
+	{
+		memcpy(pOut + cb, pPlane + (size_t)cbLine * y + b0, b1 - b0 + 1);
+		cb += b1 - b0 + 1;
+	}
+	pOut[cb++] = '\r';
+	pOut[cb++] = '\n';
+	return cb;
+}
+
+// The plane of a label, nRows of cbLine bytes, inverted 1 bit. With bBars
+// the solid rectangles go as BAR and the plane keeps the rest,
+// unless that is not smaller or does not draw the same. Returns the bytes
+// sent.
+size_t TSPL_SendPlane(TSPLENC *penc, LPBYTE pPlane, unsigned cbLine, unsigned nRows, int bBars)
+{
+	size_t		cbPlain = (size_t)cbLine * nRows;
+	BARRECT		*pBars = NULL;
+	LPBYTE		pOrig = NULL, pOut = NULL;
+	int			nBars = 0, nBitmaps = 0;
+	size_t		cb = 0;
+	unsigned	y, y0;
+	int			i;
+
+	if ( bBars && nRows > 0 )
+	{
+		pBars = MEMALLOC(sizeof(BARRECT) * BARS_MAX);
+		pOrig = MEMALLOC(cbPlain);
+	}
+
+	if ( pBars && pOrig )
+	{
+		nBars = FindBars(pPlane, cbLine, cbLine * 8, nRows, pBars);
+
+		memcpy(pOrig, pPlane, cbPlain);
+		for (i=0; i<nBars; i++)
+			FillPlane(pPlane, cbLine, pBars[i].x, pBars[i].y, pBars[i].cx, pBars[i].cy, FALSE);
+
+		if ( !CheckPlane(pOrig, pPlane, cbLine, nRows, pBars, nBars) )
+		{
+			Error_Log(LEVEL_WARNING, "Solid rectangles do not draw the label, sent as a bitmap\n");
+		}
+		// At most a BITMAP every other row
+		else if ( (pOut = MEMALLOC(cbPlain + BARS_CMD_MAX * (nBars + nRows / 2 + 1))) != NULL )
+		{
+			for (i=0; i<nBars; i++)
+				cb += sprintf((char *)pOut + cb, "BAR %d,%d,%d,%d\r\n", pBars[i].x, pBars[i].y, pBars[i].cx, pBars[i].cy);
+
+			// A BITMAP for each run of inked rows
+			for (y=0; y<nRows; )
+			{
+				while ( y < nRows && IsBlankRow(pPlane + (size_t)cbLine * y, cbLine) )
+					y++;
+				if ( y == nRows )
+					break;
+				for (y0=y; y<nRows && !IsBlankRow(pPlane + (size_t)cbLine * y, cbLine); y++)
+					;
+				cb += AppendBitmap(pOut + cb, pPlane, cbLine, y0, y);
+				nBitmaps++;
+			}
+		}
+	}
+	if ( pOut && cb < cbPlain )
+	{
+		TSPL_SendCommands(penc, (const char *)pOut, cb);
+		TSPL_AddSaved(penc, cbPlain - cb);
+		Error_Log(LEVEL_DEBUG, "%d BAR, %d BITMAP, %zu bytes saved\n", nBars, nBitmaps, cbPlain - cb);
+	}
+	else
+	{
+		char	szCmd[BARS_CMD_MAX];
+
+		// The plane as it came
+		if ( pBars && pOrig )
+			memcpy(pPlane, pOrig, cbPlain);
+		cb = sprintf(szCmd, "BITMAP %d,%d,%u,%u,%d,", 0, 0, cbLine, nRows, DRAWMODE_OR);
+		TSPL_SendCommands(penc, szCmd, cb);
+		TSPL_SendCommands(penc, (const char *)pPlane, cbPlain);
+		TSPL_SendCommands(penc, "\r\n", 2);
+		cb += cbPlain + 2;
+	}
+
+	MEMFREE(pBars);
+	MEMFREE(pOut);
+	MEMFREE(pOrig);
+	return cb;
+}
@@ -22,24 +22,57 @@
 #include "debug.h"
 #include "devmode.h"
 #include "device.h"
+#include "trace.h"
+#include "metrics.h"
 
-static size_t ReadPipe(int fd, void* buffer, size_t size);
-static size_t SkipPipe(int fd, size_t size);
-static int ReadDevmode(int fdIn, DEVMODE **pdm);
-static int ReadBitmapData(int fdIn, BITMAPFILEHEADER *pbmfHeader, BITMAPINFOHEADER *pbiHeader, RGBQUAD **ppColorTable, LPVOID* ppBits);
+// Input pipe with a large read-ahead block, rows and headers are copied
+// out of it so a page costs a handful of read() calls instead of one per row
+#define PIPE_BUFFER_SIZE		65536
+
+typedef struct _PIPEBUF
+{
+	int			fd;
+	size_t		pos;						// Next unread byte in buffer
+	size_t		len;						// Valid bytes in buffer
+	BYTE		buffer[PIPE_BUFFER_SIZE];
+} PIPEBUF;
+
+static size_t ReadPipe(PIPEBUF *pipe, void* buffer, size_t size);
+static size_t SkipPipe(PIPEBUF *pipe, size_t size);
+static int ReadDevmode(PIPEBUF *pipe, DEVMODE **pdm);
+static int ReadBitmapHeader(PIPEBUF *pipe, BITMAPFILEHEADER *pbmfHeader, BITMAPINFOHEADER *pbiHeader, RGBQUAD **ppColorTable);
+static int ReadBitmapData(PIPEBUF *pipe, BITMAPINFOHEADER *pbiHeader, LPVOID* ppBits);
+static int StreamBitmapData(PIPEBUF *pipe, TSPLENC *penc, BITMAPINFOHEADER *pbiHeader);
 
 int bmp2tspl(int fdIn)
 {
 	DEVMODE				*pdm = NULL;
+	TSPLENC				*penc = NULL;
+	TSPLENC_STATS		stats;
 	int					iRtn = -1;
 	BITMAPFILEHEADER	bmfHeader;
 	BITMAPINFOHEADER	biHeader;
 	RGBQUAD				*pColorTable = NULL;
 	LPVOID				pBits = NULL;
+	PIPEBUF				*pipe;
+	int					nPage = 0;
+	long long			llStart = Metrics_Now();
 
 	DebugPrintf("Enter bmp2tspl\n");
 
-	iRtn = ReadDevmode(fdIn, &pdm);
+	if ( (pipe = MEMALLOC(sizeof(PIPEBUF))) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Can not Alloc Memory %d Bytes\n", sizeof(PIPEBUF));
+		return iRtn;
+	}
+	pipe->fd = fdIn;
+
+	iRtn = ReadDevmode(pipe, &pdm);
+	if ( iRtn < 0 )
+	{
+		MEMFREE(pipe);
+		return iRtn;
+	}
 
 	if ( pdm->dmCopies == 0 )
 		pdm->dmCopies = 1;
@@ -56,33 +89,64 @@ int bmp2tspl(int fdIn)
 		pdm->dmYResolution = pdm->dmPrintQuality ;
 	}
 
-	pdm->dmOutPages = 0;
+	Metrics_Set(METRIC_COPIES, pdm->dmCopies);
+
+	if ( (penc = TSPL_OpenEncoder(pdm, Metrics_WriteStdout, NULL)) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Can not Alloc Memory %d Bytes\n", sizeof(DEVMODE));
+		MEMFREE(pdm);
+		MEMFREE(pipe);
+		return -1;
+	}
 
 	for ( ; iRtn > 0 ;)
 	{
-		iRtn = ReadBitmapData(fdIn, &bmfHeader, &biHeader, &pColorTable, &pBits);
+		TRACETIME	tStart = Trace_Begin();
+
+		iRtn = ReadBitmapHeader(pipe, &bmfHeader, &biHeader, &pColorTable);
 		if ( iRtn == 0 )
 		{
 			// Input stream end
 			// Send Job End
-			TSPL_SendJobEnd(pdm);
+			if ( !TSPL_SendJobEnd(penc) )
+				iRtn = -1;
+		}
+		else if ( iRtn > 0 && biHeader.biHeight < 0 && biHeader.biBitCount == 1 )
+		{
+			// Top-down rows arrive in print order, send them as they come
+			iRtn = StreamBitmapData(pipe, penc, &biHeader);
+			Trace_End("StreamBitmap", tStart, ++nPage);
+			Metrics_Add(METRIC_PAGES, 1);
+			Metrics_Add(METRIC_PIXELS, (long long)biHeader.biWidth * -biHeader.biHeight);
 		}
-		else if ( iRtn > 0 )
+		else if ( iRtn > 0 && (iRtn = ReadBitmapData(pipe, &biHeader, &pBits)) > 0 )
 		{
+			Trace_End("ReadBitmap", tStart, ++nPage);
+			Metrics_Add(METRIC_PAGES, 1);
+			Metrics_Add(METRIC_PIXELS, (long long)biHeader.biWidth * abs(biHeader.biHeight));
+
 			// Send Page
-			TSPL_SendPage(pdm, &biHeader, pColorTable, pBits);
+			tStart = Trace_Begin();
+			TSPL_SendPage(penc, &biHeader, pColorTable, pBits);
+			Trace_End("TSPL_SendPage", tStart, nPage);
 		}
 		MEMFREE(pColorTable);
 		MEMFREE(pBits);
 	}
+
+	TSPL_EncoderStats(penc, &stats);
+	Metrics_Add(METRIC_SPOOL_BYTES, stats.llSpooled);
+	TSPL_CloseEncoder(penc);
 	MEMFREE(pdm);
+	MEMFREE(pipe);
 
+	Metrics_Time(METRIC_US_OUTPUT, llStart);
 	DebugPrintf("Leave bmp2tspl, return %d\n", iRtn);
 	return iRtn;
 }
 
 int ReadDevmode(
-	int			fdIn,
+	PIPEBUF		*pipe,
 	DEVMODE		**ppdm
 )
 {
@@ -92,7 +156,7 @@ int ReadDevmode(
 	DebugPrintf("Enter ReadDevmode\n");
 
 	*ppdm = NULL;
-	cbReaded = ReadPipe(fdIn, &dm, sizeof(DEVMODE));
+	cbReaded = ReadPipe(pipe, &dm, sizeof(DEVMODE));
 	if ( sizeof(DEVMODE) != cbReaded || sizeof(DEVMODE) != dm.dmSize || dm.dmType != DM_HEADER_MARKER )
 	{
 		return -1;
@@ -104,38 +168,53 @@ int ReadDevmode(
 		return -1;
 	}
 	memcpy(*ppdm, &dm, sizeof(DEVMODE));
-	cbReaded = ReadPipe(fdIn, ((LPBYTE)*ppdm) + sizeof(DEVMODE), dm.dmSizeExtra);
+	cbReaded = ReadPipe(pipe, ((LPBYTE)*ppdm) + sizeof(DEVMODE), dm.dmSizeExtra);
 	if ( cbReaded != dm.dmSizeExtra )
 	{
 		return -1;
 	}
 
+	{
+		// The user command blocks follow, in OutputDevmode() order
+		LPBYTE		*ppCmd[PPDCACHE_NUM_COMMANDS];
+		WORD		*pwLength[PPDCACHE_NUM_COMMANDS];
+		LPBYTE		pExtra = ((LPBYTE)*ppdm) + sizeof(DEVMODE);
+		int			i;
+
+		GetDevmodeCommands(*ppdm, ppCmd, pwLength);
+		for (i=0; i<PPDCACHE_NUM_COMMANDS; i++)
+		{
+			if ( pExtra + *pwLength[i] > ((LPBYTE)*ppdm) + sizeof(DEVMODE) + dm.dmSizeExtra )
+				return -1;
+			*ppCmd[i] = *pwLength[i] ? pExtra : NULL;
+			pExtra += *pwLength[i];
+		}
+	}
+
 	DebugPrintf("==== DEVMODE from pipe ====\n");
 	DumpDevmode(&dm);
 	
 	return 1;
 }
 
-int ReadBitmapData(
-	int					fdIn,
+// Reads the headers and color table, leaves the pipe at the first row
+int ReadBitmapHeader(
+	PIPEBUF				*pipe,
 	BITMAPFILEHEADER	*pbmfHeader,
 	BITMAPINFOHEADER	*pbiHeader,
-	RGBQUAD				**ppColorTable,
-	LPVOID				*ppBits
+	RGBQUAD				**ppColorTable
 )
 {
-	int					iRtn = -1;
 	size_t				cbReaded;
 	size_t				cbPageRemainSize;
 
-	DebugPrintf("Enter ReadBitmapData\n");
+	DebugPrintf("Enter ReadBitmapHeader\n");
 
-	*ppBits = NULL;
 	if ( ppColorTable )
 		*ppColorTable = NULL;
 
 	// read bitmap file header
-	cbReaded = ReadPipe(fdIn, pbmfHeader, sizeof(BITMAPFILEHEADER));
+	cbReaded = ReadPipe(pipe, pbmfHeader, sizeof(BITMAPFILEHEADER));
 	if ( cbReaded <= 0 )
 	{
 		// no data readed, file end
@@ -154,7 +233,7 @@ int ReadBitmapData(
 	cbPageRemainSize = pbmfHeader->bfSize - sizeof(BITMAPFILEHEADER);
 
 	// read bitmap info header
-	cbReaded = ReadPipe(fdIn, pbiHeader, sizeof(BITMAPINFOHEADER));
+	cbReaded = ReadPipe(pipe, pbiHeader, sizeof(BITMAPINFOHEADER));
 
 	pbiHeader->biSize = ENDIEN32(pbiHeader->biSize);
 	pbiHeader->biWidth = ENDIEN32(pbiHeader->biWidth);
@@ -200,11 +279,11 @@ int ReadBitmapData(
 					Error_Log(LEVEL_ERROR, "Can not Alloc Memroy %d Bytes\n", sizeof(RGBQUAD) * nColorCount);
 					return -1;
 				}
-				cbReaded = ReadPipe(fdIn, *ppColorTable, sizeof(RGBQUAD) * nColorCount);
+				cbReaded = ReadPipe(pipe, *ppColorTable, sizeof(RGBQUAD) * nColorCount);
 			}
 			else
 			{
-				cbReaded = SkipPipe(fdIn, sizeof(RGBQUAD) * nColorCount);
+				cbReaded = SkipPipe(pipe, sizeof(RGBQUAD) * nColorCount);
 			}
 			if ( cbReaded <= 0 )
 			{
@@ -226,7 +305,7 @@ int ReadBitmapData(
 		size_t	nSikp;
 
 		nSikp = pbmfHeader->bfOffBits - (pbmfHeader->bfSize - cbPageRemainSize);
-		cbReaded = SkipPipe(fdIn, nSikp);
+		cbReaded = SkipPipe(pipe, nSikp);
 		if ( cbReaded <= 0 )
 		{
 			Error_Log(LEVEL_ERROR, "Invaild Bitmap Data (Skip Data)\n");
@@ -235,6 +314,42 @@ int ReadBitmapData(
 		cbPageRemainSize -= cbReaded;
 	}
 
+	return 1;
+}
+
+// Bottom-up bitmap, the whole page is needed before the first row is known
+int ReadBitmapData(
+	PIPEBUF				*pipe,
+	BITMAPINFOHEADER	*pbiHeader,
+	LPVOID				*ppBits
+)
+{
+	int					iRtn = -1;
+	size_t				cbReaded;
+
+	DebugPrintf("Enter ReadBitmapData\n");
+
+	*ppBits = NULL;
+	if ( pbiHeader->biHeight < 0 )
+	{
+		// Top-down, rows are stored as read
+		pbiHeader->biHeight = -pbiHeader->biHeight;
+		cbReaded = WIDTHBYTES_32(pbiHeader->biWidth) * pbiHeader->biHeight;
+		if ( (*ppBits = MEMALLOC(cbReaded)) == NULL )
+		{
+			Error_Log(LEVEL_ERROR, "Can not Alloc Memory %d Bytes\n", cbReaded);
+		}
+		else if ( ReadPipe(pipe, *ppBits, cbReaded) != cbReaded )
+		{
+			MEMFREE(*ppBits);
+		}
+		else
+		{
+			iRtn = 1;
+		}
+		return iRtn;
+	}
+
 	{
 		DWORD				cbWidthBytes;
 		DWORD				cbBmpBytes;
@@ -252,7 +367,7 @@ int ReadBitmapData(
 			for(y = pbiHeader->biHeight-1; y>=0; y--)
 			{
 				pBitsLine = (LPBYTE)(*ppBits) + cbWidthBytes * y;
-				cbReaded = ReadPipe(fdIn, pBitsLine, cbWidthBytes);
+				cbReaded = ReadPipe(pipe, pBitsLine, cbWidthBytes);
 				if ( cbReaded != cbWidthBytes )
 				{
 					iRtn = -1;
@@ -269,41 +384,105 @@ int ReadBitmapData(
 	return iRtn;
 }
 
-size_t ReadPipe(int fd, void* buffer, size_t size)
+// Top-down 1bpp page, each row goes to the encoder as soon as it is read
+int StreamBitmapData(
+	PIPEBUF				*pipe,
+	TSPLENC				*penc,
+	BITMAPINFOHEADER	*pbiHeader
+)
 {
-	size_t	nBytes;
-	size_t	nRemain = size;
-	size_t	nReaded = 0;
+	int					iRtn = 1;
+	DWORD				cbWidthBytes;
+	LPBYTE				pBitsLine;
+	LONG				y;
 
-	do {
-		nBytes = read(fd, buffer + nReaded, nRemain);
-		if ( nBytes <= 0 )
+	DebugPrintf("Enter StreamBitmapData\n");
+
+	pbiHeader->biHeight = -pbiHeader->biHeight;
+	cbWidthBytes = WIDTHBYTES_32(pbiHeader->biWidth);
+
+	if ( (pBitsLine = MEMALLOC(cbWidthBytes)) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Can not Alloc Memory %d Bytes\n", cbWidthBytes);
+		return -1;
+	}
+
+	TSPL_SendPageBegin(penc, pbiHeader);
+	for(y=0; y<pbiHeader->biHeight; y++)
+	{
+		if ( ReadPipe(pipe, pBitsLine, cbWidthBytes) != cbWidthBytes )
 		{
-			// pipe is closed
-			return 0;
+			// Pad the BITMAP data with blank rows so the printer is not
+			// left waiting inside the command, then drop the label
+			Error_Log(LEVEL_ERROR, "Invaild Bitmap Data (row %d)\n", y);
+			memset(pBitsLine, 0, cbWidthBytes);
+			for( ; y<pbiHeader->biHeight; y++)
+			{
+				TSPL_SendPageRow(penc, pbiHeader, pBitsLine);
+			}
+			TSPL_SendPageAbort(penc, pbiHeader);
+			iRtn = -1;
+			break;
 		}
-		nRemain -= nBytes;
-		nReaded += nBytes;
+		TSPL_SendPageRow(penc, pbiHeader, pBitsLine);
+	}
+	if ( iRtn > 0 )
+	{
+		TSPL_SendPageFinish(penc, pbiHeader);
 	}
-	while ( nReaded < size );
 
-	return nReaded;
+	MEMFREE(pBitsLine);
+	return iRtn;
 }
 
-size_t SkipPipe(int fd, size_t size)
+size_t ReadPipe(PIPEBUF *pipe, void* buffer, size_t size)
 {
-	size_t	nRemain = size;
-	size_t	nReaded = size;
-	size_t	nRead;
-	BYTE	buff[256];
+	ssize_t	nBytes;
+	size_t	nCopy;
+	size_t	nReaded = 0;
 
-	while (nRemain > 0 && nReaded > 0)
+	while ( nReaded < size )
 	{
-		nRead = nRemain > sizeof(buff) ? sizeof(buff) : nRemain;
-
-		nReaded = ReadPipe(fd, buff, nRead);
-		nRemain -= nReaded;
+		if ( pipe->pos < pipe->len )
+		{
+			nCopy = min(pipe->len - pipe->pos, size - nReaded);
+			if ( buffer )
+				memcpy((LPBYTE)buffer + nReaded, pipe->buffer + pipe->pos, nCopy);
+			pipe->pos += nCopy;
+			nReaded += nCopy;
+		}
+		else if ( buffer && size - nReaded >= sizeof(pipe->buffer) )
+		{
+			// Large requests skip the copy through the block buffer
+			nBytes = read(pipe->fd, (LPBYTE)buffer + nReaded, size - nReaded);
+			Metrics_Add(METRIC_READ_CALLS, 1);
+			if ( nBytes <= 0 )
+			{
+				// pipe is closed
+				return 0;
+			}
+			nReaded += nBytes;
+			Metrics_Add(METRIC_INPUT_BYTES, nBytes);
+		}
+		else
+		{
+			nBytes = read(pipe->fd, pipe->buffer, sizeof(pipe->buffer));
+			Metrics_Add(METRIC_READ_CALLS, 1);
+			if ( nBytes <= 0 )
+			{
+				// pipe is closed
+				return 0;
+			}
+			pipe->pos = 0;
+			pipe->len = nBytes;
+			Metrics_Add(METRIC_INPUT_BYTES, nBytes);
+		}
 	}
 
-	return nReaded > 0 ? size : nReaded;
+	return nReaded;
+}
+
+size_t SkipPipe(PIPEBUF *pipe, size_t size)
+{
+	return ReadPipe(pipe, NULL, size);
 }
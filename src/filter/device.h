@@ -22,6 +22,7 @@
 #define _DEVICE_H_
 
 #include "devmode.h"
+#include "tsplenc.h"
 
 #ifdef _DEBUG
 //	#define FILTER_NOT_PSTOPS
@@ -29,48 +30,22 @@
 //	#define FILTER_NOT_BMP2TSPL
 #endif
 
-#define DIB_HEADER_MARKER   ((WORD) ('M' << 8) | 'B')
-
-#pragma pack(2)
-typedef struct tagBITMAPFILEHEADER {
-	WORD	bfType;
-	DWORD	bfSize;
-	WORD	bfReserved1;
-	WORD	bfReserved2;
-	DWORD	bfOffBits;
-} BITMAPFILEHEADER, *PBITMAPFILEHEADER;
-
-typedef struct tagBITMAPINFOHEADER{
-	DWORD	biSize;
-	LONG	biWidth;
-	LONG	biHeight;
-	WORD	biPlanes;
-	WORD	biBitCount;
-	DWORD	biCompression;
-	DWORD	biSizeImage;
-	LONG	biXPelsPerMeter;
-	LONG	biYPelsPerMeter;
-	DWORD	biClrUsed;
-	DWORD	biClrImportant;
-} BITMAPINFOHEADER, *PBITMAPINFOHEADER;
-
-typedef struct tagRGBQUAD {
-	BYTE	rgbBlue; 
-	BYTE	rgbGreen; 
-	BYTE	rgbRed; 
-	BYTE	rgbReserved; 
-} RGBQUAD, *PRGBQUAD;
-#pragma pack()
+#define	MAX_GS_INSTANCES		16
 
 typedef struct _GSDATA
 {
 	void			*gsInstance;
 	int				exit_code;
+	BOOL			bCapture;			// Keep interpreter stdout in szCapture
+	int				nCapture;
+	char			szCapture[64];
 } GSDATA;
 
 typedef struct _DEVDATA
 {
 	cups_file_t			*fpPS;				// Print file
+	char				*szFileName;		// Print file name, NULL for stdin
+	char				szTempFile[1024];	// Spooled copy of stdin, if any
 
 	CUPSLIB_FUNCTION	lib_cups;			// CUPS lib
 	GSLIB_FUNCTION		lib_gs;				// GS lib
@@ -80,12 +55,15 @@ typedef struct _DEVDATA
 	int					num_options;		// CUPS option count
 	cups_option_t		*options;			// CUPS options
 
-	ppd_file_t			*ppd;				// PPD File
+	PPDCACHE			*ppd;				// Compiled PPD File
 
 	DEVMODE				dm;
 
 	LPCSTR				gsdevice;			// 
 	GSDATA				gsdata;
+	int					nGsInstances;		// gs instances rendering PS pages
+	cups_file_t			*fpRecord;			// Record interpreter input instead of running it
+	TSPLENC				*penc;				// The job's TSPL, on stdout
 
 } DEVDATA;
 
@@ -93,7 +71,19 @@ typedef struct _DEVDATA
 int ps2bmp(int argc, char *argv[]);
 int bmp2tspl(int fdIn);
 
-int TSPL_SendPage(DEVMODE *pdm, BITMAPINFOHEADER* pBih, RGBQUAD *pColorTable, void* pBits);
-int TSPL_SendJobEnd(DEVMODE *pdm);
+// Jobs already in TSPL and template records, see the cupsFilter lines of the PPDs
+#define	TSPL_MIME_TYPE			"application/vnd.tsc-tspl"
+#define	TEMPLATE_MIME_TYPE		"application/vnd.tsc-records"
+
+// Where tsc-template and ARTWORK name files, see configure --with-template-dir
+#ifndef TSC_TEMPLATEDIR
+#define TSC_TEMPLATEDIR			"/opt/TSC/barcodedriver/templates"
+#endif
+
+int TemplateJob(DEVDATA *pdev, int fd, const char *szTemplate);
+int PassthroughJob(DEVDATA *pdev, int fd);
+
+// Bytes BAR saved, for TSPL_EncoderStats()
+void TSPL_AddSaved(TSPLENC *penc, size_t cbSaved);
 
 #endif	// #ifndef _DEVICE_H_
@@ -24,10 +24,8 @@
 #include "device.h"
 #include "libloader.h"
 #include "gsrun.h"
-
-static BOOL gsEnable(DEVDATA *pdev);
-static void gsDisable(DEVDATA *pdev);
-static BOOL gsClose(DEVDATA *pdev);
+#include "trace.h"
+#include "probes.h"
 
 static int handleExit(int code, int outerr);
 static int GSDLLCALL my_stdin(void *instance, char *buf, int len);
@@ -40,6 +38,7 @@ int gsrun(DEVDATA *pdev)
 	char			line[8192];		/* Line buffer */
 	size_t			len;			/* Length of line buffer */
 	int				needPS2PS = 0;
+	BOOL			bPDF = FALSE;
 
 	DebugPrintf("\n#ENTER: gsrun()\n");
 
@@ -47,31 +46,50 @@ int gsrun(DEVDATA *pdev)
 	{
 		Error_Log(LEVEL_ERROR, "Empty print file!\n");
 	}
-	else if ( strncmp(line, "%!PS-Adobe-", 11) )
+	else if ( strncmp(line, "%!PS-Adobe-", 11) && strncmp(line, "%PDF-", 5) )
 	{
 		Error_Log(LEVEL_ERROR, "Unknow file content!\n");
 	}
+	else if ( (bPDF = !strncmp(line, "%PDF-", 5)) && !pdfspool(pdev, line, len) )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to spool PDF file\n");
+	}
+#ifndef FILTER_NOT_PSTOPS
+	else if ( !bPDF && pdev->nGsInstances > 1 )
+	{
+		// psrun() records the document and starts one gs per page subset
+		nRtn = psrun(pdev, line, len, sizeof(line));
+	}
+#endif	// #ifndef FILTER_NOT_PSTOPS
 	else if ( gsEnable(pdev) )
 	{
 		nRtn = 0;
 
+		if ( bPDF )
+		{
+			// PDF goes to the interpreter by file name, no pstops pass
+			nRtn = pdfrun(pdev);
+		}
+		else
+		{
 #ifdef FILTER_NOT_PSTOPS
 
-		OutputDevmode(pdev);
-		do
-		{
-			if ( ! gs_write(pdev, line, len) )
+			OutputDevmode(pdev);
+			do
 			{
-				nRtn = 1;
-				break;
-			}
-		} while ((len = pdev->lib_cups.cupsFileGetLine(pdev->fpPS, line, sizeof(line))) > 0);
+				if ( ! gs_write(pdev, line, len) )
+				{
+					nRtn = 1;
+					break;
+				}
+			} while ((len = pdev->lib_cups.cupsFileGetLine(pdev->fpPS, line, sizeof(line))) > 0);
 
 #else	// #ifndef FILTER_NOT_PSTOPS
 
-		nRtn = psrun(pdev, line, len, sizeof(line));
+			nRtn = psrun(pdev, line, len, sizeof(line));
 
 #endif	// #ifndef FILTER_NOT_PSTOPS
+		}
 
 		if ( !nRtn && !gsClose(pdev))
 		{
@@ -81,6 +99,12 @@ int gsrun(DEVDATA *pdev)
 		gsDisable(pdev);
 	}
 
+	if ( pdev->szTempFile[0] )
+	{
+		unlink(pdev->szTempFile);
+		pdev->szTempFile[0] = '\0';
+	}
+
 	DebugPrintf("#LEAVE: gsrun(), return %d\n\n", nRtn);
 	return nRtn;
 }
@@ -91,6 +115,11 @@ BOOL gs_write(
 	size_t			len
 )
 {
+	if ( pdev->fpRecord )
+	{
+		return pdev->lib_cups.cupsFileWrite(pdev->fpRecord, s, len) == (ssize_t)len;
+	}
+
 #ifdef FILTER_NOT_PS2BMP
     fwrite(s, 1, len, stdout);
 #else
@@ -137,6 +166,7 @@ BOOL gs_printf(
 BOOL gsEnable(DEVDATA *pdev)
 {
 	char	arg_device[32];
+	char	arg_permit[1100];
 	char*	gsargv[] = {
 		"gs",
 		"-q",
@@ -145,8 +175,10 @@ BOOL gsEnable(DEVDATA *pdev)
 		"-dPARANOIDSAFER",
 		arg_device,
 		"-sOutputFile=-",
+		NULL,
 	};
-	int		gsargc = sizeof(gsargv)/sizeof(gsargv[0]);
+	int		gsargc = sizeof(gsargv)/sizeof(gsargv[0]) - 1;
+	TRACETIME	tStart = Trace_Begin();
 
 	memset(&pdev->gsdata, 0, sizeof(GSDATA));
 
@@ -172,7 +204,40 @@ BOOL gsEnable(DEVDATA *pdev)
 
 	sprintf(arg_device, "-sDEVICE=%s", pdev->gsdevice);
 	DebugPrintf("\t%s\n", arg_device);
-	pdev->gsdata.exit_code = pdev->lib_gs.gsapi_new_instance(&pdev->gsdata.gsInstance, NULL);
+
+	// The PDF interpreter reads the job file itself. gs 9.50 and later
+	// take a read permission for it under PARANOIDSAFER. Older ones can only
+	// read it with SAFER, which the admin has to allow at configure time.
+	if ( pdev->szTempFile[0] || pdev->szFileName )
+	{
+		gsapi_revision_t	r;
+
+		if (pdev->lib_gs.gsapi_revision(&r, sizeof(r)) != 0)
+		{
+			r.revision = 0;
+		}
+
+		if ( r.revision >= 950 )
+		{
+			snprintf(arg_permit, sizeof(arg_permit), "--permit-file-read=%s",
+				pdev->szTempFile[0] ? pdev->szTempFile : pdev->szFileName);
+			gsargv[gsargc++] = arg_permit;
+		}
+		else
+		{
+#ifdef _GS_SAFER_FALLBACK
+			Error_Log(LEVEL_WARNING, "Ghostscript %ld is older than 9.50, the PDF job runs with -dSAFER\n", r.revision);
+			gsargv[4] = "-dSAFER";
+#else
+			Error_Log(LEVEL_ERROR, "Ghostscript %ld is older than 9.50 and cannot read the PDF job under -dPARANOIDSAFER, "
+				"update Ghostscript or configure the driver --with-gs-safer-fallback\n", r.revision);
+			Trace_End("gsEnable", tStart, TRACE_NO_ARG);
+			return FALSE;
+#endif
+		}
+	}
+
+	pdev->gsdata.exit_code = pdev->lib_gs.gsapi_new_instance(&pdev->gsdata.gsInstance, pdev);
 	if (pdev->gsdata.exit_code == 0 || handleExit(pdev->gsdata.exit_code, 0))
 	{
 		pdev->lib_gs.gsapi_set_stdio(pdev->gsdata.gsInstance, &my_stdin, &my_stdout, &my_stderr);
@@ -184,6 +249,7 @@ BOOL gsEnable(DEVDATA *pdev)
 		}
 	}
 
+	Trace_End("gsEnable", tStart, TRACE_NO_ARG);
 	if (pdev->gsdata.exit_code && !handleExit(pdev->gsdata.exit_code, 1))
 	{
 		return FALSE;
@@ -217,9 +283,11 @@ BOOL gsClose(DEVDATA *pdev)
 		pdev->lib_gs.gsapi_run_string_end (pdev->gsdata.gsInstance, 0, &pdev->gsdata.exit_code);
 		if (pdev->gsdata.exit_code == 0 || handleExit(pdev->gsdata.exit_code, 1))
 		{
+			TSC_PROBE1(gs_close, 1);
 			return TRUE;
 		}
 	}
+	TSC_PROBE1(gs_close, 0);
 	return FALSE;
 #else
 	return TRUE;
@@ -231,11 +299,38 @@ BOOL OutputDevmode(DEVDATA *pdev)
 	BOOL				bRtn = TRUE;
 #if defined(FILTER_NOT_PS2BMP) || defined(FILTER_NOT_BMP2TSPL)
 #else
+	LPBYTE				*ppCmd[PPDCACHE_NUM_COMMANDS];
+	WORD				*pwLength[PPDCACHE_NUM_COMMANDS];
+	DWORD				dwExtra = 0;
+	int					i;
+
+	// The user command blocks follow the DEVMODE, bmp2tspl points the
+	// DEVMODE at its copy
+	GetDevmodeCommands(&pdev->dm, ppCmd, pwLength);
+	for (i=0; i<PPDCACHE_NUM_COMMANDS; i++)
+	{
+		if ( *ppCmd[i] == NULL )
+			*pwLength[i] = 0;
+		dwExtra += *pwLength[i];
+	}
+	if ( dwExtra > 0xFFFF )
+	{
+		Error_Log(LEVEL_ERROR, "User commands too long, %u bytes\n", dwExtra);
+		for (i=0; i<PPDCACHE_NUM_COMMANDS; i++)
+			*pwLength[i] = 0;
+		dwExtra = 0;
+	}
+
 	pdev->dm.dmType = DM_HEADER_MARKER;
 	pdev->dm.dmSize = sizeof(pdev->dm);
-	pdev->dm.dmSizeExtra = 0;
+	pdev->dm.dmSizeExtra = dwExtra;
 
 	bRtn = fwrite(&pdev->dm, 1, sizeof(pdev->dm), stdout) > 0;
+	for (i=0; bRtn && i<PPDCACHE_NUM_COMMANDS; i++)
+	{
+		if ( *pwLength[i] )
+			bRtn = fwrite(*ppCmd[i], 1, *pwLength[i], stdout) == *pwLength[i];
+	}
 #endif
 	return bRtn;
 }
@@ -264,6 +359,18 @@ my_stdin(void *instance, char *buf, int len)
 static int GSDLLCALL
 my_stdout(void *instance, const char *str, int len)
 {
+	DEVDATA		*pdev = (DEVDATA *)instance;
+
+	if ( pdev && pdev->gsdata.bCapture )
+	{
+		int		n = sizeof(pdev->gsdata.szCapture) - 1 - pdev->gsdata.nCapture;
+
+		if ( n > len )
+			n = len;
+		memcpy(pdev->gsdata.szCapture + pdev->gsdata.nCapture, str, n);
+		pdev->gsdata.nCapture += n;
+		pdev->gsdata.szCapture[pdev->gsdata.nCapture] = '\0';
+	}
 //	DebugPrintf("STDOUT: %d bytes, instance=%p\n", len, instance);
 //	DebugWrite(str, len);
 	return len;
@@ -23,9 +23,15 @@
 
 int gsrun(DEVDATA *pdev);
 int psrun(DEVDATA *pdev, char *line, size_t linelen, size_t linesize);
+BOOL pdfspool(DEVDATA *pdev, char *line, size_t linelen);
+int pdfrun(DEVDATA *pdev);
 
 BOOL OutputDevmode(DEVDATA *pdev);
 
+BOOL gsEnable(DEVDATA *pdev);
+void gsDisable(DEVDATA *pdev);
+BOOL gsClose(DEVDATA *pdev);
+
 BOOL gs_write(DEVDATA *pdev, const char *s, size_t len);
 BOOL gs_putchar(DEVDATA *pdev, char c);
 BOOL gs_printf(DEVDATA *pdev, const char *format, ...);
@@ -21,6 +21,9 @@
 #include "common.h"
 #include "debug.h"
 #include "device.h"
+#include "metrics.h"
+
+#include <sys/wait.h>
 
 /*
 	argc = 6 or 7
@@ -36,6 +39,7 @@ int main(int argc, char *argv[], char *env[])
 {
 	int			fd[2];
 	pid_t		childpid;
+	int			nRtn = 1;
 
 	// Make sure status messages are not buffered...
 	setbuf(stdout, NULL);
@@ -50,17 +54,19 @@ int main(int argc, char *argv[], char *env[])
 		return 0;
 	}
 
+	Log_Flush();
 	if ( pipe(fd) != -1 && (childpid=fork()) != -1)
 	{
 		if ( childpid == 0 )
 		{
 			// Child process cloes up input side of pipe
 			close(fd[0]);
+			Metrics_Start("ps2bmp", argv[1]);
 
 			// redirect stdout to pipe fd[1].
-			if ( dup2(fd[1], fileno(stdout)) != -1 )
+			if ( dup2(fd[1], fileno(stdout)) != -1 && ps2bmp(argc, argv) == 0 )
 			{
-				ps2bmp(argc, argv);
+				nRtn = 0;
 			}
 
 			// Child process cloes up output side of pipe
@@ -69,9 +75,11 @@ int main(int argc, char *argv[], char *env[])
 		else
 		{
 			int		nError;
+			int		status = 0;
 
 			// Parent process cloes up output side of pipe
 			close(fd[1]);
+			Metrics_Start("bmp2tspl", argv[1]);
 #if defined(FILTER_NOT_PS2BMP) || defined(FILTER_NOT_BMP2TSPL)
 			{
 				int		nBytes;
@@ -88,16 +96,25 @@ int main(int argc, char *argv[], char *env[])
 				    fwrite(buffer, 1, nBytes, stdout);
 					nTotal += nBytes;
 				}
+				nRtn = 0;
 			}
 #else
-			bmp2tspl(fd[0]);
+			nRtn = (bmp2tspl(fd[0]) < 0);
 #endif
 			DebugPrintf("End TSC Printer Filter on %s\n", argv[0]);
 
 			// Parent process cloes up input side of pipe
 			close(fd[0]);
+
+			// A page gs could not render fails the job, even when
+			// the pages before it went out
+			if ( waitpid(childpid, &status, 0) != childpid || !WIFEXITED(status) || WEXITSTATUS(status) )
+			{
+				Error_Log(LEVEL_ERROR, "ps2bmp failed, status 0x%x\n", status);
+				nRtn = 1;
+			}
 		}
 	}
 
-	return 0;
+	return nRtn;
 }
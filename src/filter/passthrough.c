@@ -0,0 +1,143 @@
+/*
+ * "passthrough.c 2021-05-17 15:55:05
+ *  
+ *  native TSPL jobs for TSC Printer Driver
+ *  
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ 
+ */
+
+
+// splice() is a GNU extension
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "device.h"
+#include "metrics.h"
+
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
+#define	PASSTHROUGH_CHUNK		(1 << 20)
+
+// Moves the whole input to stdout, by the kernel when it can: sendfile()
+// from a regular file, splice() from a pipe, else read() and write().
+// Returns the bytes moved or -1.
+static long long CopyPayload(int fdIn, off_t *pOffset)
+{
+	int				fdOut = fileno(stdout);
+	long long		llTotal = 0;
+	ssize_t			n;
+	char			buffer[65536];
+
+#ifdef HAVE_SYS_SENDFILE_H
+	if ( pOffset )
+	{
+		while ( (n = sendfile(fdOut, fdIn, pOffset, PASSTHROUGH_CHUNK)) > 0 )
+		{
+			llTotal += n;
+			Metrics_Add(METRIC_WRITE_CALLS, 1);
+		}
+		if ( n == 0 )
+			return llTotal;
+		if ( llTotal > 0 || (errno != EINVAL && errno != ENOSYS) )
+			return -1;
+	}
+#endif
+#ifdef HAVE_SPLICE
+	if ( !pOffset )
+	{
+		while ( (n = splice(fdIn, NULL, fdOut, NULL, PASSTHROUGH_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0 )
+		{
+			llTotal += n;
+			Metrics_Add(METRIC_WRITE_CALLS, 1);
+		}
+		if ( n == 0 )
+			return llTotal;
+		if ( llTotal > 0 || (errno != EINVAL && errno != ENOSYS) )
+			return -1;
+	}
+#endif
+
+	// Neither end can be spliced, a terminal or such
+	if ( pOffset && lseek(fdIn, *pOffset, SEEK_SET) < 0 )
+		return -1;
+	while ( (n = read(fdIn, buffer, sizeof(buffer))) != 0 )
+	{
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			return -1;
+		}
+		if ( write(fdOut, buffer, n) != n )
+			return -1;
+		llTotal += n;
+		Metrics_Add(METRIC_READ_CALLS, 1);
+		Metrics_Add(METRIC_WRITE_CALLS, 1);
+	}
+
+	return llTotal;
+}
+
+// A job that is TSPL already goes out as is, after the job setup and user
+// commands of the DEVMODE. Its own SIZE, GAP and so on come later and win.
+// The payload is sent once per copy when it can be read again, otherwise
+// its PRINT commands decide. Return 0 on success.
+int PassthroughJob(DEVDATA *pdev, int fd)
+{
+	struct stat		st;
+	BOOL			bFile = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+	int				nCopies = bFile ? pdev->dm.dmCopies : 1;
+	int				copies;
+	long long		llBytes = 0;
+	long long		llStart = Metrics_Now();
+
+	DebugPrintf("PassthroughJob: %s input, %d copies\n", bFile ? "file" : "stream", nCopies);
+
+	pdev->dm.dmDocPages = 1;
+	pdev->dm.dmCollate = 0;
+	Metrics_Set(METRIC_COPIES, nCopies);
+
+	TSPL_SendJobStart(pdev->penc);
+
+	for ( copies=0; copies<nCopies && llBytes >= 0; copies++ )
+	{
+		off_t		offset = 0;
+
+		llBytes = CopyPayload(fd, bFile ? &offset : NULL);
+		if ( llBytes >= 0 )
+		{
+			Metrics_Add(METRIC_OUTPUT_BYTES, llBytes);
+			if ( copies == 0 )
+				Metrics_Add(METRIC_INPUT_BYTES, llBytes);
+		}
+	}
+	if ( llBytes < 0 )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to send the TSPL job: %s\n", strerror(errno));
+		return 1;
+	}
+
+	TSPL_SendJobEnd(pdev->penc);
+	Metrics_Time(METRIC_US_OUTPUT, llStart);
+
+	return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * "pdfrun.c 2021-05-17 15:55:05
+ *
+ *  pdf run routines for TSC Printer Driver
+ *
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+
+ */
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "device.h"
+#include "libloader.h"
+#include "gsrun.h"
+
+static BOOL gs_pdffile(DEVDATA *pdev, const char *filename);
+
+// The PDF interpreter needs random access, so a job read from stdin
+// is copied to a temp file first. A job file given by CUPS is used as is.
+BOOL pdfspool(
+	DEVDATA			*pdev,
+	char			*line,
+	size_t			linelen
+)
+{
+	cups_file_t		*temp;
+	char			buffer[65536];
+	ssize_t			bytes;
+	BOOL			bRtn = TRUE;
+
+	if ( pdev->szFileName )
+		return TRUE;
+
+	if ((temp = pdev->lib_cups.cupsTempFile2(pdev->szTempFile, sizeof(pdev->szTempFile))) == NULL)
+	{
+		Error_Log(LEVEL_ERROR, "Unable to create temporary file: %s\n", strerror(errno));
+		pdev->szTempFile[0] = '\0';
+		return FALSE;
+	}
+
+	if ( pdev->lib_cups.cupsFileWrite(temp, line, linelen) < (ssize_t)linelen )
+		bRtn = FALSE;
+
+	while ( bRtn && (bytes = pdev->lib_cups.cupsFileRead(pdev->fpPS, buffer, sizeof(buffer))) > 0 )
+	{
+		if ( pdev->lib_cups.cupsFileWrite(temp, buffer, bytes) < bytes )
+			bRtn = FALSE;
+	}
+
+	if ( pdev->lib_cups.cupsFileClose(temp) )
+		bRtn = FALSE;
+
+	if ( !bRtn )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to write temporary file: %s\n", strerror(errno));
+		unlink(pdev->szTempFile);
+		pdev->szTempFile[0] = '\0';
+	}
+
+	return bRtn;
+}
+
+int pdfrun(DEVDATA *pdev)
+{
+	int				nRtn = 1;
+	int				pages;			/* Pages in the PDF */
+	int				number;			/* Pages to print */
+	int				page;
+	int				collate = 0;
+	const char		*choice;
+
+	DebugPrintf("\n#ENTER: pdfrun()\n");
+
+	if ((choice = PpdCacheMarkedChoice(pdev->ppd, "Collate")) != NULL &&
+		!strcasecmp(choice, "True"))
+	{
+		collate = 1;
+	}
+
+	// Open the document and read back its page count...
+	pdev->gsdata.bCapture = TRUE;
+	pdev->gsdata.nCapture = 0;
+	pdev->gsdata.szCapture[0] = '\0';
+	if ( gs_pdffile(pdev, pdev->szTempFile[0] ? pdev->szTempFile : pdev->szFileName) &&
+		gs_puts(pdev, " runpdfbegin pdfpagecount = flush\n") )
+	{
+		nRtn = 0;
+	}
+	pdev->gsdata.bCapture = FALSE;
+
+	pages = atoi(pdev->gsdata.szCapture);
+	DebugPrintf("  pdfpagecount = %d\n", pages);
+
+	if ( !nRtn && pages <= 0 )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to get PDF page count\n");
+		nRtn = 1;
+	}
+
+	if ( !nRtn )
+	{
+		// page-ranges is applied by pdftopdf ahead of the filter, as pstops
+		// does for PostScript, so every page of the file is printed
+		number = pages;
+
+		// Same copies handling as copy_dsc(), every page is rendered once
+		pdev->dm.dmDocPages = number;
+		pdev->dm.dmCollate = 0;
+		if ( number > 1 && collate )
+		{
+			pdev->dm.dmCollate = 1;
+		}
+		if ( number > 0 )
+		{
+			OutputDevmode(pdev);
+		}
+
+		DebugPrintf("  dmCopies = %d, dmCollate = %d, dmDocPages = %d\n", pdev->dm.dmCopies, pdev->dm.dmCollate, number);
+
+		for(page=1; page<=pages && !nRtn; page++)
+		{
+			if ( !gs_printf(pdev, "%d pdfgetpage pdfshowpage\n", page) )
+			{
+				nRtn = 1;
+			}
+		}
+
+		if ( !nRtn && !gs_puts(pdev, "runpdfend\n") )
+		{
+			nRtn = 1;
+		}
+	}
+
+	DebugPrintf("#LEAVE: pdfrun(), return %d\n\n", nRtn);
+	return nRtn;
+}
+
+// Push "(filename) (r) file" with the name escaped as a PostScript string
+BOOL gs_pdffile(
+	DEVDATA			*pdev,
+	const char		*filename
+)
+{
+	char		buffer[2200];
+	char		*ptr = buffer;
+
+	*ptr++ = '(';
+	for( ; *filename && ptr < buffer + sizeof(buffer) - 16; filename++)
+	{
+		if ( *filename == '(' || *filename == ')' || *filename == '\\' )
+			*ptr++ = '\\';
+		*ptr++ = *filename;
+	}
+	strcpy(ptr, ") (r) file");
+
+	return gs_puts(pdev, buffer);
+}
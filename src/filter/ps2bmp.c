@@ -25,6 +25,7 @@
 #include "devmode.h"
 #include "device.h"
 #include "gsrun.h"
+#include "metrics.h"
 
 #define		GSDEVICE_BMP_MONO	"bmpmono"
 #define		GSDEVICE_BMP_GRAY	"bmpgray"
@@ -40,11 +41,18 @@ int ps2bmp(int argc, char *argv[])
 	DEVMODE				dm;
 	int					fdIn;
 
+	long long			llStart = Metrics_Now();
+
 	DebugPrintf("Enter ps2bmp\n");
 
 	pdev = DrvEnable(argc, argv);
+	Metrics_Time(METRIC_US_SETUP, llStart);
+	if ( pdev == NULL )
+		return iRtn;
 
+	llStart = Metrics_Now();
 	iRtn = gsrun(pdev);
+	Metrics_Time(METRIC_US_PARSE, llStart);
 	
 	DrvDisable(pdev);
 	DebugPrintf("Leave ps2bmp, return %d\n", iRtn);
@@ -112,6 +120,7 @@ DEVDATA* DrvEnable(int argc, char *argv[])
 			}
 			else
 			{
+				pdev->szFileName = strdup(argv[6]);
 				if ((pdev->fpPS = pdev->lib_cups.cupsFileOpen(argv[6], "r")) == NULL)
 				{
 					Error_Log(LEVEL_ERROR, "Unable to open file \"%s\" - %s\n", argv[6], strerror(errno));
@@ -154,9 +163,9 @@ void DrvDisable(DEVDATA *pdev)
 		{
 			pdev->lib_cups.cupsFileClose(pdev->fpPS);
 		}
-		if ( pdev->ppd && pdev->lib_cups.ppdClose )
+		if ( pdev->ppd )
 		{
-			pdev->lib_cups.ppdClose(pdev->ppd);
+			PpdCacheClose(pdev->ppd);
 		}
 		if ( pdev->options && pdev->lib_cups.cupsFreeOptions )
 		{
@@ -167,6 +176,7 @@ void DrvDisable(DEVDATA *pdev)
 		FreeGsLibrary(&pdev->lib_gs);
 
 		MEMFREE(pdev->szPrinterName);
+		MEMFREE(pdev->szFileName);
 	}
 	MEMFREE(pdev);
 }
@@ -215,13 +225,20 @@ static BOOL bInitCupsOptions(DEVDATA *pdev, char *argv[])
 		DebugPrintf("\t%s=%s\n", pdev->options[i].name, pdev->options[i].value);
 	}
 
+	// Parsed once, shared by option gathering and devmode setup
+	if ( (pdev->ppd = OpenPrinterPPD(pdev->szPrinterName, &pdev->lib_cups)) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to open the PPD file of %s\n", pdev->szPrinterName);
+		return bRtn;
+	}
+
 	{
 		//////////////////////////////////
 		// Get options from CUPS setting file
 		int					num_options;		// CUPS option count
 		cups_option_t		*options;			// CUPS options
 	
-		num_options = GetPrinterOptions(pdev->szPrinterName, &options, &pdev->lib_cups);
+		num_options = PpdCacheGetOptions(pdev->ppd, &options, &pdev->lib_cups);
 		for(i=0; i<num_options; i++)
 		{
 			if ( strcmp(options[i].name, "orientation-requested")
@@ -242,55 +259,58 @@ static BOOL bInitCupsOptions(DEVDATA *pdev, char *argv[])
 //	seteuid(euid);
 //	DumpRESUID();
 
+	{
+		// Render DSC pages with several gs instances, "auto" is one per CPU
+		const char		*val;
+
+		pdev->nGsInstances = 1;
+		if ( (val = pdev->lib_cups.cupsGetOption("gs-instances", pdev->num_options, pdev->options)) != NULL )
+		{
+			if ( !strcasecmp(val, "auto") )
+				pdev->nGsInstances = sysconf(_SC_NPROCESSORS_ONLN);
+			else
+				pdev->nGsInstances = atoi(val);
+
+			if ( pdev->nGsInstances < 1 )
+				pdev->nGsInstances = 1;
+			else if ( pdev->nGsInstances > MAX_GS_INSTANCES )
+				pdev->nGsInstances = MAX_GS_INSTANCES;
+		}
+	}
+
 	DebugPrintf("=== OPTIONS ===\n");
 	for(i=0; i<pdev->num_options; i++)
 	{
 		DebugPrintf("\t%s=%s\n", pdev->options[i].name, pdev->options[i].value);
 	}
 
+	if ( pdev->ppd )
 	{
-		const char		*filename;
-		ppd_file_t		*ppd;
-	
-		// Create temp PPD file by printer name
-		if ( (filename = pdev->lib_cups.cupsGetPPD(pdev->szPrinterName)) != NULL )
-		{
-	//		DebugPrintf("the ppd of printers is %s.\n", filename);
-	
-			// Open the PPD file
-			pdev->ppd = pdev->lib_cups.ppdOpenFile(filename);
-
-			// Delete temp PPD file
-			unlink(filename);
-
-			if ( pdev->ppd )
-			{
-				ppd_size_t		*pagesize = NULL;
+		float			width, length;
 
-				pdev->lib_cups.ppdMarkDefaults(pdev->ppd);
-				// Mark PPD options by printer options
-				pdev->lib_cups.cupsMarkOptions(pdev->ppd, pdev->num_options, pdev->options);
+		bRtn = SetDevmodeFromOptions(&pdev->lib_cups, pdev->ppd, &pdev->dm, pdev->num_options, pdev->options);
 
-				bRtn = SetDevmodeFromOptions(&pdev->lib_cups, pdev->ppd, &pdev->dm, pdev->num_options, pdev->options);
-
-				pagesize = pdev->lib_cups.ppdPageSize(pdev->ppd, NULL);
-				
-				pdev->dm.dmFields |= DM_COPIES;
-				pdev->dm.dmCopies = atoi(argv[4]);
-				if ( pdev->dm.dmCopies == 0 )
-					pdev->dm.dmCopies = 1;
+		// Labels across are imposed by rastertobarcodetspl on raster pages only
+		if ( pdev->dm.dmColumns > 1 )
+		{
+			Error_Log(LEVEL_WARNING, "Columns is for raster jobs, printing one label across\n");
+			pdev->dm.dmColumns = 1;
+		}
+		
+		pdev->dm.dmFields |= DM_COPIES;
+		pdev->dm.dmCopies = atoi(argv[4]);
+		if ( pdev->dm.dmCopies == 0 )
+			pdev->dm.dmCopies = 1;
 
-				if ( pagesize )
-				{
-					pdev->dm.dmPaperWidth  = pagesize->width;
-					pdev->dm.dmPaperLength = pagesize->length;
-					pdev->dm.dmFields |= DM_PAPERLENGTH | DM_PAPERWIDTH;
-				}
-				else
-				{
-					bRtn = FALSE;
-				}
-			}
+		if ( PpdCachePageSize(pdev->ppd, NULL, &width, &length) )
+		{
+			pdev->dm.dmPaperWidth  = width;
+			pdev->dm.dmPaperLength = length;
+			pdev->dm.dmFields |= DM_PAPERLENGTH | DM_PAPERWIDTH;
+		}
+		else
+		{
+			bRtn = FALSE;
 		}
 	}
 
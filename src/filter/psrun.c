@@ -24,6 +24,10 @@
 #include "device.h"
 #include "libloader.h"
 #include "gsrun.h"
+#include "trace.h"
+#include "probes.h"
+
+#include <sys/wait.h>
 
 #ifndef FILTER_NOT_PSTOPS
 
@@ -64,6 +68,10 @@ typedef struct
 	int				changed_pageorder;
 	int				total_page;
 	int				collate;
+	int				dsc_pages;				/* %%Pages: count, -1 if unknown */
+	int				parallel;				/* Pages rendered by worker processes */
+	int				streamed;				/* Left parallel mode, gs of our own */
+	int				status;					/* Worker status */
 
 }	pstops_doc_t;
 
@@ -77,6 +85,11 @@ static ssize_t copy_trailer(DEVDATA *pdev, pstops_doc_t *doc, char *line, ssize_
 
 static char * parse_text(const char	*start, char **end, char *buffer, size_t bufsize);
 static pstops_page_t *add_page(DEVDATA *pdev, pstops_doc_t *doc, const char *label);
+static BOOL doc_need_spool(DEVDATA *pdev, pstops_doc_t *doc);
+static void doc_output_devmode(DEVDATA *pdev, pstops_doc_t *doc, int number);
+static BOOL stop_parallel(DEVDATA *pdev, pstops_doc_t *doc);
+static int copy_pages_parallel(DEVDATA *pdev, pstops_doc_t *doc, int number, off_t trailer, size_t trailer_len);
+static int render_pages(DEVDATA *pdev, pstops_doc_t *doc, int first, int last, off_t trailer, size_t trailer_len);
 
 #define doc_puts(pdev, doc, s)		doc_write(pdev, doc, s, strlen(s))
 static void copy_bytes(DEVDATA *pdev, FILE *fp, off_t offset, size_t length);
@@ -93,33 +106,57 @@ int psrun(
 {
 	int				nRtn = 0;
 	pstops_doc_t	doc;				/* Document information */
-	ppd_choice_t	*choice;			/* PPD choice */
+	const char		*choice;			/* PPD choice */
 
 	DebugPrintf("\n#ENTER: pstops()\n");
 
 	memset(&doc, 0, sizeof(doc));
 
 	doc.collate = 0;
-    if ((choice = pdev->lib_cups.ppdFindMarkedChoice(pdev->ppd, "Collate")) != NULL &&
-    	!strcasecmp(choice->choice, "True"))
+	doc.dsc_pages = -1;
+    if ((choice = PpdCacheMarkedChoice(pdev->ppd, "Collate")) != NULL &&
+    	!strcasecmp(choice, "True"))
     {
 		doc.collate = 1;
 	}
 
+	// In parallel mode the whole document is recorded first, then the
+	// pages are split between gs instances by copy_pages_parallel().
+	// copy_dsc() drops back to streaming when the header says there is
+	// one page, or gives no count and nothing else needs the spool.
+	if ( pdev->nGsInstances > 1 )
+	{
+		if ((doc.temp = pdev->lib_cups.cupsTempFile2(doc.tempfile, sizeof(doc.tempfile))) == NULL)
+		{
+			Error_Log(LEVEL_ERROR, "Unable to create temporary file: %s\n", strerror(errno));
+			exit(1);
+		}
+		pdev->fpRecord = doc.temp;
+		doc.parallel = 1;
+	}
+
 	// Start with a DSC header...
 	gs_puts(pdev, "%!PS-Adobe-3.0\n");
 
-    if ((doc.temp = pdev->lib_cups.cupsTempFile2(doc.tempfile, sizeof(doc.tempfile))) == NULL)
-    {
-		Error_Log(LEVEL_ERROR, "Unable to create temporary file: %s\n", strerror(errno));
-		exit(1);
-    }
-
 	// filter the document...
     copy_dsc(pdev, &doc, line, linelen, linesize);
 
 	// Send %%EOF as needed...
-	gs_puts(pdev, "%%EOF\n");
+	if ( !doc.parallel && !doc.status )
+	{
+		gs_puts(pdev, "%%EOF\n");
+	}
+	nRtn = doc.status;
+	pdev->fpRecord = NULL;
+
+	if ( doc.streamed )
+	{
+		if ( !nRtn && !gsClose(pdev) )
+		{
+			nRtn = 1;
+		}
+		gsDisable(pdev);
+	}
 
 	if ( doc.fp_temp )
 	{
@@ -151,6 +188,29 @@ void copy_dsc(
 	// Start sending the document with any commands needed...
 	linelen = copy_comments(pdev, doc, line, linelen, linesize);
 
+	// Parallel mode needs a page count to split. %%Pages gives it, else
+	// the spool that collated copies or a cut after the job need anyway.
+	// A single page or a document of unknown length streams to one gs.
+	if ( doc->parallel &&
+		 (doc->dsc_pages >= 0 ? doc->dsc_pages < 2 : !doc_need_spool(pdev, doc)) &&
+		 !stop_parallel(pdev, doc) )
+	{
+		doc->status = 1;
+		return;
+	}
+
+	// Spool the pages only when the DEVMODE needs a page count that the
+	// header did not give us, otherwise they go straight to gs...
+	if ( !doc->temp && doc_need_spool(pdev, doc) )
+	{
+		if ((doc->temp = pdev->lib_cups.cupsTempFile2(doc->tempfile, sizeof(doc->tempfile))) == NULL)
+		{
+			Error_Log(LEVEL_ERROR, "Unable to create temporary file: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+	DebugPrintf("  dsc_pages = %d, spool = %d\n", doc->dsc_pages, doc->temp != NULL);
+
 	// Now find the prolog section, if any...
 	linelen = copy_prolog(pdev, doc, line, linelen, linesize);
 
@@ -173,12 +233,39 @@ void copy_dsc(
 	{
 		doc->total_page ++;
 
-		linelen = copy_page(pdev, doc, line, linelen, linesize);
+		if ( !doc->temp && doc->total_page == 1 )
+		{
+			doc_output_devmode(pdev, doc, doc->dsc_pages > 0 ? doc->dsc_pages : 1);
+		}
+
+		{
+			// Streamed pages render as gs is fed, spooled ones only record
+			TRACETIME	tStart = Trace_Begin();
+
+			linelen = copy_page(pdev, doc, line, linelen, linesize);
+			Trace_End(doc->temp ? "RecordPage" : "RenderPage", tStart, doc->total_page);
+			if ( !doc->temp )
+				TSC_PROBE1(gs_page, doc->total_page);
+		}
 	}
 
 	// Make additional copies as necessary...
 	number = pdev->lib_cups.cupsArrayCount(doc->pages);
-	if (doc->temp && number > 0)
+	if (doc->parallel && number > 0)
+	{
+		off_t		trailer;
+
+		// Record the trailer too, every instance needs it after its pages
+		trailer = pdev->lib_cups.cupsFileTell(doc->temp);
+		linelen = copy_trailer(pdev, doc, line, linelen, linesize);
+		gs_puts(pdev, "%%EOF\n");
+
+		pdev->fpRecord = NULL;
+		doc->status = copy_pages_parallel(pdev, doc, number, trailer, pdev->lib_cups.cupsFileTell(doc->temp) - trailer);
+		unlink(doc->tempfile);
+		return;
+	}
+	else if (doc->temp && number > 0)
 	{
 		// Reopen the temporary file for reading...
 		pdev->lib_cups.cupsFileClose(doc->temp);
@@ -188,37 +275,27 @@ void copy_dsc(
 		doc->total_page = 0;
 		{
 			int			i;
-			int			nCopies;
-			int			nDriverCoyies = 1;		// Collection Copies
-
-			pdev->dm.dmDocPages = number;
-			pdev->dm.dmCollate = 0;
-			if ( number > 1 && doc->collate )
-			{
-				pdev->dm.dmCollate = 1;
-				nDriverCoyies = pdev->dm.dmCopies;
-			}
-			OutputDevmode(pdev);
 
-			DebugPrintf("  nDriverCoyies = %d, dmDocPages = %d\n", nDriverCoyies, number);
+			doc_output_devmode(pdev, doc, number);
 
-			for ( nCopies=0; nCopies<nDriverCoyies; nCopies++ )
+			for(i=0; i<number; i++)
 			{
-				for(i=0; i<number; i++)
+				pageinfo = (pstops_page_t *)pdev->lib_cups.cupsArrayIndex(doc->pages, i);
+
+				if ( pageinfo )
 				{
-					pageinfo = (pstops_page_t *)pdev->lib_cups.cupsArrayIndex(doc->pages, i);
+					TRACETIME	tStart = Trace_Begin();
 
-					if ( pageinfo )
-					{
-						doc->total_page ++;
-						gs_printf(pdev, "%%%%Page: %s %d\n", pageinfo->label, doc->total_page);
+					doc->total_page ++;
+					gs_printf(pdev, "%%%%Page: %s %d\n", pageinfo->label, doc->total_page);
 
-						copy_bytes(pdev, doc->fp_temp, pageinfo->offset, pageinfo->length);
-					}
-					else
-					{
-						Error_Log(LEVEL_ERROR, "Cannot get page %d data\n", i+1);
-					}
+					copy_bytes(pdev, doc->fp_temp, pageinfo->offset, pageinfo->length);
+					Trace_End("RenderPage", tStart, doc->total_page);
+					TSC_PROBE1(gs_page, doc->total_page);
+				}
+				else
+				{
+					Error_Log(LEVEL_ERROR, "Cannot get page %d data\n", i+1);
 				}
 			}
 		}
@@ -254,6 +331,11 @@ copy_comments(
 		// Pull the headers out...
 		if (!strncmp(line, "%%Pages:", 8))
 		{
+			// "(atend)" leaves the count unknown...
+			if ( isdigit(line[8 + strspn(line + 8, " \t")] & 255) )
+			{
+				doc->dsc_pages = atoi(line + 8);
+			}
 		}
 		else if (!strncmp(line, "%%BoundingBox:", 14))
 		{
@@ -422,6 +504,12 @@ ssize_t	copy_page(
 
 	pageinfo = add_page(pdev, doc, label);
 
+	// Streamed pages need their own %%Page: comment...
+	if ( !doc->temp )
+	{
+		doc_printf(pdev, doc, "%%%%Page: %s %d\n", label, doc->total_page);
+	}
+
 //	memcpy(bounding_box, doc->bounding_box, sizeof(bounding_box));
 	while ((linelen = pdev->lib_cups.cupsFileGetLine(pdev->fpPS, line, linesize)) > 0)
 	{
@@ -570,7 +658,10 @@ ssize_t	copy_page(
 	}
 	while ((linelen = pdev->lib_cups.cupsFileGetLine(pdev->fpPS, line, linesize)) > 0);
 
-	pageinfo->length = pdev->lib_cups.cupsFileTell(doc->temp) - pageinfo->offset;
+	if ( doc->temp )
+	{
+		pageinfo->length = pdev->lib_cups.cupsFileTell(doc->temp) - pageinfo->offset;
+	}
 
 	return (linelen);
 }
@@ -739,7 +830,7 @@ pstops_page_t *	add_page(
 	}
 
 	pageinfo->label  = strdup(label);
-	pageinfo->offset = pdev->lib_cups.cupsFileTell(doc->temp);
+	pageinfo->offset = doc->temp ? pdev->lib_cups.cupsFileTell(doc->temp) : 0;
 
 	pdev->lib_cups.cupsArrayAdd(doc->pages, pageinfo);
 
@@ -748,6 +839,246 @@ pstops_page_t *	add_page(
 	return (pageinfo);
 }
 
+BOOL doc_need_spool(
+	DEVDATA			*pdev,
+	pstops_doc_t	*doc
+)
+{
+	if ( doc->dsc_pages >= 0 )
+		return FALSE;
+
+	// Collated copies need to know whether there is more than one page...
+	if ( doc->collate && pdev->dm.dmCopies > 1 )
+		return TRUE;
+
+	// ...and a cut after the job needs the total label count
+	if ( pdev->dm.dmOccurrence == DMOCCURRENCE_JOB &&
+		(pdev->dm.dmPostAction == DMPOSTACTION_CUT || pdev->dm.dmPostAction == DMPOSTACTION_PARTIAL) )
+		return TRUE;
+
+	return FALSE;
+}
+
+void doc_output_devmode(
+	DEVDATA			*pdev,
+	pstops_doc_t	*doc,
+	int				number
+)
+{
+	// Every page is rendered once. Collated copies are replayed
+	// from the encoded TSPL by bmp2tspl, uncollated copies use
+	// the PRINT count, so gs never rasterises a page twice.
+	pdev->dm.dmDocPages = number;
+	pdev->dm.dmCollate = 0;
+	if ( number > 1 && doc->collate )
+	{
+		pdev->dm.dmCollate = 1;
+	}
+	OutputDevmode(pdev);
+
+	DebugPrintf("  dmCopies = %d, dmCollate = %d, dmDocPages = %d\n", pdev->dm.dmCopies, pdev->dm.dmCollate, number);
+}
+
+// Leaves parallel mode: starts the one gs instance and feeds it the
+// header recorded so far
+BOOL stop_parallel(
+	DEVDATA			*pdev,
+	pstops_doc_t	*doc
+)
+{
+	FILE		*fp;
+	off_t		length;
+	BOOL		bRtn = FALSE;
+
+	length = pdev->lib_cups.cupsFileTell(doc->temp);
+	pdev->fpRecord = NULL;
+	pdev->lib_cups.cupsFileClose(doc->temp);
+	doc->temp = NULL;
+	doc->parallel = 0;
+
+	DebugPrintf("  no pages to split, streaming to one gs instance\n");
+
+	if ( (fp = fopen(doc->tempfile, "r")) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to open temporary file: %s\n", strerror(errno));
+	}
+	else
+	{
+		if ( gsEnable(pdev) )
+		{
+			doc->streamed = 1;
+			if ( length > 0 )
+			{
+				copy_bytes(pdev, fp, 0, length);
+			}
+			bRtn = TRUE;
+		}
+		fclose(fp);
+	}
+	unlink(doc->tempfile);
+
+	return bRtn;
+}
+
+int copy_pages_parallel(
+	DEVDATA			*pdev,
+	pstops_doc_t	*doc,
+	int				number,
+	off_t			trailer,
+	size_t			trailer_len
+)
+{
+	int			nRtn = 0;
+	int			instances;
+	int			i;
+	pid_t		pids[MAX_GS_INSTANCES];
+	int			fds[MAX_GS_INSTANCES];
+	char		buffer[65536];
+	ssize_t		bytes;
+
+	instances = pdev->nGsInstances < number ? pdev->nGsInstances : number;
+
+	pdev->lib_cups.cupsFileClose(doc->temp);
+	doc->temp = NULL;
+
+	doc_output_devmode(pdev, doc, number);
+	DebugPrintf("  %d gs instances for %d pages\n", instances, number);
+
+	// Instance 0 writes to our stdout, the others to spool files that are
+	// appended in page order once the instances before them are done
+	fflush(NULL);
+	Log_Flush();
+	for(i=0; i<instances; i++)
+	{
+		fds[i] = -1;
+		pids[i] = -1;
+
+		if ( i > 0 )
+		{
+			const char	*tmpdir = getenv("TMPDIR");
+			char		filename[1024];
+
+			snprintf(filename, sizeof(filename), "%s/psrunXXXXXX", tmpdir ? tmpdir : "/tmp");
+			if ( (fds[i] = mkstemp(filename)) < 0 )
+			{
+				Error_Log(LEVEL_ERROR, "Unable to create temporary file: %s\n", strerror(errno));
+				nRtn = 1;
+				break;
+			}
+			unlink(filename);
+		}
+
+		if ( (pids[i] = fork()) == 0 )
+		{
+			if ( fds[i] >= 0 )
+			{
+				dup2(fds[i], fileno(stdout));
+			}
+			nRtn = render_pages(pdev, doc, i * number / instances, (i + 1) * number / instances, trailer, trailer_len);
+			fflush(NULL);
+			Log_Flush();
+			Trace_Dump();
+			_exit(nRtn);
+		}
+		else if ( pids[i] < 0 )
+		{
+			Error_Log(LEVEL_ERROR, "Unable to start gs instance %d: %s\n", i, strerror(errno));
+			if ( fds[i] >= 0 )
+			{
+				close(fds[i]);
+			}
+			nRtn = 1;
+			break;
+		}
+	}
+	instances = i;
+
+	for(i=0; i<instances; i++)
+	{
+		int		status;
+
+		if ( waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) )
+		{
+			Error_Log(LEVEL_ERROR, "gs instance %d failed\n", i);
+			nRtn = 1;
+		}
+
+		if ( fds[i] >= 0 )
+		{
+			if ( !nRtn && lseek(fds[i], 0, SEEK_SET) == 0 )
+			{
+				while ( (bytes = read(fds[i], buffer, sizeof(buffer))) > 0 )
+				{
+					if ( write(fileno(stdout), buffer, bytes) != bytes )
+					{
+						nRtn = 1;
+						break;
+					}
+				}
+			}
+			close(fds[i]);
+		}
+	}
+
+	return nRtn;
+}
+
+// Runs in a worker: replay the recorded header, pages [first, last)
+// and the trailer through a gs instance of its own
+int render_pages(
+	DEVDATA			*pdev,
+	pstops_doc_t	*doc,
+	int				first,
+	int				last,
+	off_t			trailer,
+	size_t			trailer_len
+)
+{
+	int				nRtn = 1;
+	int				i;
+	FILE			*fp;
+	pstops_page_t	*pageinfo;
+
+	// Own descriptor, the file offset must not be shared with the others
+	if ( (fp = fopen(doc->tempfile, "r")) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to open temporary file: %s\n", strerror(errno));
+		return nRtn;
+	}
+
+	if ( gsEnable(pdev) )
+	{
+		pageinfo = (pstops_page_t *)pdev->lib_cups.cupsArrayIndex(doc->pages, 0);
+		copy_bytes(pdev, fp, 0, pageinfo->offset);
+
+		for(i=first; i<last; i++)
+		{
+			TRACETIME	tStart = Trace_Begin();
+
+			pageinfo = (pstops_page_t *)pdev->lib_cups.cupsArrayIndex(doc->pages, i);
+
+			gs_printf(pdev, "%%%%Page: %s %d\n", pageinfo->label, i + 1);
+			copy_bytes(pdev, fp, pageinfo->offset, pageinfo->length);
+			Trace_End("RenderPage", tStart, i + 1);
+			TSC_PROBE1(gs_page, i + 1);
+		}
+
+		if ( trailer_len > 0 )
+		{
+			copy_bytes(pdev, fp, trailer, trailer_len);
+		}
+
+		if ( gsClose(pdev) )
+		{
+			nRtn = 0;
+		}
+		gsDisable(pdev);
+	}
+
+	fclose(fp);
+	return nRtn;
+}
+
 void doc_printf(
 	DEVDATA			*pdev,
 	pstops_doc_t	*doc,
@@ -56,6 +56,7 @@
 #include "raster.h"
 #include "common.h"
 #include "debug.h"
+#include "metrics.h"
 //#include "cupsinc/debug.h"
 #include <stdlib.h>
 #include <errno.h>
@@ -665,12 +666,18 @@ cups_raster_read(cups_raster_t *r,	/* I - Raster stream */
       if (count < 16)
       {
        /*
-        * Read into the raster buffer and then copy...
+        * Read into the raster buffer and then copy; take what one read
+	* returns, the end of the stream seldom fills the buffer...
 	*/
 
-        remaining = cups_read(r->fd, r->buffer, r->bufsize);
+        do
+	  remaining = read(r->fd, r->buffer, r->bufsize);
+	while (remaining < 0 && errno == EINTR);
+
+	Metrics_Add(METRIC_READ_CALLS, 1);
 	if (remaining <= 0)
 	  return (0);
+	Metrics_Add(METRIC_INPUT_BYTES, remaining);
 
 	r->bufptr = r->buffer;
 	r->bufend = r->buffer + remaining;
@@ -858,6 +865,7 @@ cups_read(int           fd,		/* I - File descriptor */
   for (total = 0; total < bytes; total += count, buf += count)
   {
     count = read(fd, buf, bytes - total);
+    Metrics_Add(METRIC_READ_CALLS, 1);
 
     if (count == 0)
       return (0);
@@ -870,6 +878,7 @@ cups_read(int           fd,		/* I - File descriptor */
     }
   }
 
+  Metrics_Add(METRIC_INPUT_BYTES, total);
   return (total);
 }
 
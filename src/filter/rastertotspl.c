@@ -23,11 +23,19 @@
 #include "common.h"
 #include "debug.h"
 #include "device.h"
+#include "trace.h"
+#include "metrics.h"
+#include "probes.h"
 
 #include "cupsinc/cups.h"
 #include "cupsinc/ppd.h"
 //#include "cupsinc/string.h"
 #include "raster.h"
+#include <getopt.h>
+#include <glob.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
 //#include <stdlib.h>
 //#include <unistd.h>
 //#include <fcntl.h>
@@ -37,12 +45,16 @@
 #define	DRAWMODE_OR				1
 #define	DRAWMODE_XOR			2
 
+// Continuous media cut to the content of each label
+#define	AUTOLENGTH(pdm)			((pdm)->dmAutoLength && (pdm)->dmMediaType == DMMEDIATYPE_CONTINUE)
+
 typedef struct _pageinfo_t
 {
 	unsigned		width;				/* Width of page image in pixels */
 	unsigned		height;				/* Height of page image in pixels */
 	off_t			offset;				/* Offset to start of page */
 	ssize_t			length;				/* Number of bytes for page */
+	unsigned		inked;				/* Rows down to the last inked one */
 }	pageinfo_t;
 
 typedef struct _doc_t
@@ -52,36 +64,68 @@ typedef struct _doc_t
 
 	cups_array_t	*pages;					/* Pages in document */
 
+	BOOL			checkpoint_on;			/* tsc-checkpoint=true, the pages are hashed */
+	unsigned long long	hash;				/* Of the decoded pages, keys the checkpoint */
+	char			checkpoint[1024];		/* Checkpoint filename */
+	int				fd_checkpoint;			/* -1 when not kept */
+	DWORD			rows;					/* Rows written */
+	DWORD			sent;					/* Rows past the backend, see CheckpointUpdate() */
+	long long		*ends;					/* Output offset after each row */
+	long long		next_update;			/* Output offset of the next update */
+
+	BOOL			bars;					/* Solid rectangles as BAR, see bars.c */
+
 }	doc_t;
 
+// Label rows of a job sent so far, kept in $CUPS_CACHEDIR when the job
+// asks for it with tsc-checkpoint=true. When CUPS restarts the job the rows
+// already sent are not sent again. The backend may still fail the job after
+// the filter is done, so the file stays and goes with the sweep of old
+// checkpoints. Nothing tells the filter what the printer took,
+// so a row counts as sent once CHECKPOINT_IN_FLIGHT more bytes left the
+// pipe after it: the backend, the socket and the printer's buffer may
+// still hold that much. A restart prints those rows twice, never loses one.
+#define	CHECKPOINT_MAGIC		0x4B435354		// "TSCK"
+#define	CHECKPOINT_MAX_AGE		(7 * 24 * 3600)
+#define	CHECKPOINT_SWEEP		(24 * 3600)		// Old checkpoints looked for once a day
+#define	CHECKPOINT_IN_FLIGHT	(4 * 1024 * 1024)
+#define	CHECKPOINT_STEP			(64 * 1024)		// Output between two updates
+
+typedef struct _checkpoint_t
+{
+	DWORD				magic;
+	DWORD				rows;				/* Label rows sent, in print order */
+	unsigned long long	hash;				/* doc_t.hash of the job */
+}	checkpoint_t;
+
 
+static int ConvertJob(int argc, char *argv[]);
+static int StandaloneMain(int argc, char *argv[]);
 static DEVDATA* DrvEnable(int argc, char *argv[]);
 static void DrvDisable(DEVDATA *pdev);
 static BOOL bInitCupsOptions(DEVDATA *pdev, char *argv[]);
 static int ParseDocData(DEVDATA *pdev, int fd, doc_t *doc);
 static void FreeDocData(DEVDATA *pdev, doc_t *doc);
-size_t printer_write(const void* pbuf, size_t cbbuf);
-int printer_printf(const char* strfmt, ...);
-
-int TSPL_SendJobStart(DEVMODE *pdm);
-int TSPL_SendJobEnd(DEVMODE *pdm);
-int TSPL_SendPageStart(DEVMODE *pdm);
-int TSPL_SendPageEnd(DEVMODE *pdm);
+static int CheckpointOpen(DEVDATA *pdev, const char *szJob, doc_t *doc, int nRows);
+static void CheckpointUpdate(DEVDATA *pdev, doc_t *doc, DWORD dwRows);
+static void CheckpointWrite(doc_t *doc, long long llWritten);
+static void CheckpointClose(DEVDATA *pdev, doc_t *doc);
+static int ImposeColumns(DEVDATA *pdev, doc_t *doc, unsigned *pnPitch, unsigned *pnGap);
+static void ImposePage(LPBYTE pRow, unsigned cbRow, unsigned x, const BYTE *pPage, const pageinfo_t *pageinfo, unsigned nRows);
+static unsigned InkedRows(const BYTE *pData, unsigned cbLine, unsigned nRows);
+static unsigned TrimmedRows(DEVDATA *pdev, const pageinfo_t *pageinfo);
+static BOOL SendRow(DEVDATA *pdev, doc_t *doc, int first, int n, unsigned nPitch, unsigned nGap);
+static unsigned long long HashBytes(unsigned long long hash, const void *pData, size_t cbData);
 
 int
 main(int  argc, char *argv[])
 {
-	int					fd;	/* File descriptor */
-//	cups_raster_t		*ras;	/* Raster stream for printing */
-//	cups_page_header_t	header;	/* Page header from file */
-	doc_t				doc;
-//	ppd_file_t			*ppd;	/* PPD file */
-	int					page;	/* Current page */
-	int					copies;	/* Current copies */
-	DEVDATA				*pdev = NULL;
+	int					iRtn;
+	BOOL				bStandalone = (argc > 1 && !strncmp(argv[1], "--", 2));
 
 //	DebugPrintf("#ENTER:rastertobarcodetspl\n");
 	Error_Log(LEVEL_DEBUG, "### Start rastertobarcodetspl ###\n");
+	Metrics_Start("rastertobarcodetspl", argc > 1 && !bStandalone ? argv[1] : NULL);
 
 	/*
 	* Make sure status messages are not buffered...
@@ -89,6 +133,10 @@ main(int  argc, char *argv[])
 
 	setbuf(stderr, NULL);
 
+	// Offline conversion, options come from the command line
+	if ( bStandalone )
+		return StandaloneMain(argc, argv);
+
 	/*
 	* Check command-line...
 	*/
@@ -101,9 +149,34 @@ main(int  argc, char *argv[])
 		*/
 
 		fputs("ERROR: rastertoepson job-id user title copies options [file]\n", stderr);
+		fputs("       rastertobarcodetspl --ppd file [--option name=value] [--output file] [--repeat n] [file]\n", stderr);
 		return (1);
 	}
 
+	iRtn = ConvertJob(argc, argv);
+
+//	DebugPrintf("#LEAVE:rastertobarcodetspl\n");
+	Error_Log(LEVEL_DEBUG, "### End rastertobarcodetspl ###\n");
+	return iRtn;
+}
+
+// One CUPS job: argv is job user title copies options [file]
+int ConvertJob(int argc, char *argv[])
+{
+	int					fd;	/* File descriptor */
+	doc_t				doc;
+	int					nLabels;	/* Pages times collated copies */
+	int					nColumns;	/* Labels in a row */
+	unsigned			nPitch, nGap;	/* Dots */
+	int					first, i;
+	int					row = 0;	/* Rows sent, with the skipped ones */
+	int					skip;
+	BOOL				bFailed;
+	DEVDATA				*pdev = NULL;
+	long long			llStart = Metrics_Now();
+
+	TSC_PROBE1(job_start, atoi(argv[1]));
+
 	/*
 	* Open the page stream...
 	*/
@@ -127,62 +200,138 @@ main(int  argc, char *argv[])
 		return (1);
 	}
 
-	memset(&doc, 0, sizeof(doc));
-	// Process pages as needed...
-	if ( ParseDocData(pdev, fd, &doc) )
-	{
-		Error_Log(LEVEL_ERROR, "Raster Data Error.\n");
-		DrvDisable(pdev);
-		return (1);
-	}
-
+	Metrics_Time(METRIC_US_SETUP, llStart);
 
+	// Before any job kind, records and TSPL included
 	if ( CheckTrialTime() )
 	{
 		Error_Log(LEVEL_ERROR, "Trial Version, Time end.\n");
-		printer_printf("\r\n");
+		TSPL_SendCommands(pdev->penc, "\r\n", 2);
 		DrvDisable(pdev);
+		if (fd != 0)
+			close(fd);
 		return (1);
 	}	
 
-	TSPL_SendJobStart(&pdev->dm);
-
-	for ( copies=0; copies<(pdev->dm.dmCollate ? pdev->dm.dmCopies : 1); copies++ )
+	// Variable data records or TSPL as is, not raster
 	{
-		DebugPrintf("--copies %d --\n", copies);
-		for(page=0; page<pdev->dm.dmDocPages; page++)
+		const char	*szTemplate = pdev->lib_cups.cupsGetOption("tsc-template", pdev->num_options, pdev->options);
+		const char	*szType = getenv("CONTENT_TYPE");
+		BOOL		bTspl = (szType && !strcasecmp(szType, TSPL_MIME_TYPE));
+		BOOL		bRecords;
+
+		// A raster job ignores tsc-template, standalone there is no CONTENT_TYPE
+		if ( szType )
+			bRecords = !strcasecmp(szType, TEMPLATE_MIME_TYPE);
+		else
+			bRecords = (szTemplate && *szTemplate);
+
+		if ( bTspl || bRecords )
 		{
-			pageinfo_t	*pageinfo = (pageinfo_t*)pdev->lib_cups.cupsArrayIndex(doc.pages, page);
+			int		iRtn = 1;
+			float	width, length;
 
-			if ( pageinfo )
+			// Labels across are imposed on raster pages only
+			if ( pdev->dm.dmColumns > 1 )
 			{
-				unsigned char	*PlaneData;
+				Error_Log(LEVEL_WARNING, "Columns is for raster jobs, printing one label across\n");
+				pdev->dm.dmColumns = 1;
+			}
 
-				DebugPrintf("PAGE: %d\n", page + 1);
-				DebugPrintf("pageinfo->offset=%d, pageinfo->length=%d\n", pageinfo->offset, pageinfo->length);
+			if ( bRecords && !(szTemplate && *szTemplate) )
+			{
+				Error_Log(LEVEL_ERROR, "No tsc-template for the records\n");
+			}
+			// There is no raster header, the label is the PPD's page size
+			else if ( PpdCachePageSize(pdev->ppd, NULL, &width, &length) )
+			{
+				pdev->dm.dmPaperWidth  = width;
+				pdev->dm.dmPaperLength = length;
+				pdev->dm.dmFields |= DM_PAPERLENGTH | DM_PAPERWIDTH;
 
-				PlaneData = MEMALLOC(pageinfo->length);
-				if ( fseek(doc.fp_temp, pageinfo->offset, SEEK_SET) >= 0)
-				{
-					if ( fread(PlaneData, 1, pageinfo->length, doc.fp_temp) == pageinfo->length )
-					{
-						DebugPrintf("PAGE START\n");
-						TSPL_SendPageStart(&pdev->dm);
+				iRtn = bTspl ? PassthroughJob(pdev, fd) : TemplateJob(pdev, fd, szTemplate);
+			}
+			else
+			{
+				Error_Log(LEVEL_ERROR, "No page size in the PPD\n");
+			}
+
+			TSC_PROBE1(job_end, pdev->dm.dmOutPages);
+			DrvDisable(pdev);
+			if (fd != 0)
+				close(fd);
+			return iRtn;
+		}
+	}
 
-						printer_printf("BITMAP %d,%d,%d,%d,%d,", 0, 0, WIDTHBYTES_8(pageinfo->width), pageinfo->height, DRAWMODE_OR);
-						printer_write(PlaneData, pageinfo->length);
-						printer_printf("\r\n");
+	memset(&doc, 0, sizeof(doc));
+	doc.fd_checkpoint = -1;
+	{
+		const char	*value = pdev->lib_cups.cupsGetOption("tsc-checkpoint", pdev->num_options, pdev->options);
 
-						DebugPrintf("PAGE END\n");
-						TSPL_SendPageEnd(&pdev->dm);
-					}
-				}
-				MEMFREE(PlaneData);
+		doc.checkpoint_on = (value && (!strcasecmp(value, "true") || !strcasecmp(value, "on") || !strcasecmp(value, "yes")));
+	}
+	// Process pages as needed...
+	llStart = Metrics_Now();
+	if ( ParseDocData(pdev, fd, &doc) )
+	{
+		Error_Log(LEVEL_ERROR, "Raster Data Error.\n");
+		DrvDisable(pdev);
+		return (1);
+	}
+
+	Metrics_Time(METRIC_US_PARSE, llStart);
+	Metrics_Set(METRIC_PAGES, pdev->dm.dmDocPages);
+	Metrics_Set(METRIC_COPIES, pdev->dm.dmCopies);
+
+	// Solid rectangles as BAR with tsc-bars=true, bitmaps only otherwise
+	{
+		const char	*value = pdev->lib_cups.cupsGetOption("tsc-bars", pdev->num_options, pdev->options);
+
+		doc.bars = (value && (!strcasecmp(value, "true") || !strcasecmp(value, "on") || !strcasecmp(value, "yes")));
+	}
+	nColumns = ImposeColumns(pdev, &doc, &nPitch, &nGap);
+	nLabels = pdev->dm.dmDocPages * (pdev->dm.dmCollate ? pdev->dm.dmCopies : 1);
+
+	// A restart with other options or another imposition sends other rows
+	doc.hash = HashBytes(doc.hash, argv[5], strlen(argv[5]));
+	doc.hash = HashBytes(doc.hash, &nLabels, sizeof(nLabels));
+	doc.hash = HashBytes(doc.hash, &nColumns, sizeof(nColumns));
+	doc.hash = HashBytes(doc.hash, &nPitch, sizeof(nPitch));
+	doc.hash = HashBytes(doc.hash, &nGap, sizeof(nGap));
+	doc.hash = HashBytes(doc.hash, &doc.bars, sizeof(doc.bars));
+	skip = CheckpointOpen(pdev, argv[1], &doc, (nLabels + nColumns - 1) / nColumns);
+
+	llStart = Metrics_Now();
+	TSPL_SendJobStart(pdev->penc);
+
+	// Collated copies go on filling the row, only the last one has blank
+	// columns. The checkpoint counts rows.
+	for ( first=0; first<nLabels; first+=nColumns )
+	{
+		int			n = min(nColumns, nLabels - first);
+
+		// Sent before CUPS restarted the job
+		if ( row < skip )
+		{
+			for (i=0; i<n; i++)
+			{
+				pageinfo_t	*pageinfo = (pageinfo_t*)pdev->lib_cups.cupsArrayIndex(doc.pages, (first + i) % pdev->dm.dmDocPages);
+
+				if ( pageinfo )
+					Metrics_Add(METRIC_SAVED_BYTES, pageinfo->length);
 			}
+			row++;
+			continue;
 		}
+
+		if ( SendRow(pdev, &doc, first, n, nPitch, nGap) )
+			CheckpointUpdate(pdev, &doc, ++row);
 	}
 
-	TSPL_SendJobEnd(&pdev->dm);
+	bFailed = !TSPL_SendJobEnd(pdev->penc);
+	Metrics_Time(METRIC_US_OUTPUT, llStart);
+	TSC_PROBE1(job_end, pdev->dm.dmDocPages);
 
 	FreeDocData(pdev, &doc);
 
@@ -191,9 +340,144 @@ main(int  argc, char *argv[])
 	if (fd != 0)
 		close(fd);
 
-//	DebugPrintf("#LEAVE:rastertobarcodetspl\n");
-	Error_Log(LEVEL_DEBUG, "### End rastertobarcodetspl ###\n");
-	return (page == 0);
+	return (nLabels == 0 || bFailed);
+}
+
+// rastertobarcodetspl --ppd file [--option name=value]... [--copies n]
+//                     [--output file] [--repeat n] [file]
+// Runs ConvertJob() without cupsd: the PPD comes from the command line
+// instead of cupsGetPPD(), and PRINTER defaults to the PPD name. libcups
+// is still loaded for the PPD parser when the PPD cache misses.
+int StandaloneMain(int argc, char *argv[])
+{
+	static const struct option	longopts[] =
+	{
+		{ "ppd",		required_argument,	NULL,	'p' },
+		{ "option",		required_argument,	NULL,	'o' },
+		{ "copies",		required_argument,	NULL,	'n' },
+		{ "output",		required_argument,	NULL,	'O' },
+		{ "repeat",		required_argument,	NULL,	'r' },
+		{ "help",		no_argument,		NULL,	'h' },
+		{ NULL,			0,					NULL,	0 }
+	};
+	char				*szOptions = NULL;
+	size_t				cbOptions = 0;
+	const char			*szCopies = "1";
+	const char			*szOutput = NULL;
+	int					nRepeat = 1;
+	char				*jobargv[8];
+	int					jobargc = 6;
+	int					iRtn = 0;
+	int					i, opt;
+
+	while ( (opt = getopt_long(argc, argv, "", longopts, NULL)) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'p':
+			setenv("PPD", optarg, 1);
+			break;
+		case 'o':
+			{
+				// Joined as a cupsParseOptions() string
+				size_t	cbNew = cbOptions + strlen(optarg) + 2;
+				char	*p = realloc(szOptions, cbNew);
+
+				if ( p == NULL )
+				{
+					MEMFREE(szOptions);
+					return (1);
+				}
+				snprintf(p + cbOptions, cbNew - cbOptions, "%s%s", cbOptions ? " " : "", optarg);
+				szOptions = p;
+				cbOptions = strlen(szOptions);
+			}
+			break;
+		case 'n':
+			szCopies = optarg;
+			break;
+		case 'O':
+			szOutput = optarg;
+			break;
+		case 'r':
+			nRepeat = atoi(optarg);
+			break;
+		default:
+			fputs("Usage: rastertobarcodetspl --ppd file [--option name=value]... [--copies n]\n"
+				  "                           [--output file] [--repeat n] [file]\n", stderr);
+			MEMFREE(szOptions);
+			return (1);
+		}
+	}
+
+	if ( getenv("PPD") == NULL || nRepeat < 1 || argc - optind > 1 )
+	{
+		Error_Log(LEVEL_ERROR, "A PPD file, a repeat count of at least 1 and one input file at most are needed\n");
+		MEMFREE(szOptions);
+		return (1);
+	}
+	if ( nRepeat > 1 && optind == argc )
+	{
+		Error_Log(LEVEL_ERROR, "--repeat needs an input file, stdin can only be read once\n");
+		MEMFREE(szOptions);
+		return (1);
+	}
+
+	if ( getenv("PRINTER") == NULL )
+	{
+		const char	*szName = strrchr(getenv("PPD"), '/');
+
+		setenv("PRINTER", szName ? szName + 1 : getenv("PPD"), 1);
+	}
+
+	if ( szOutput && freopen(szOutput, "w", stdout) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to create %s: %s\n", szOutput, strerror(errno));
+		MEMFREE(szOptions);
+		return (1);
+	}
+
+	// There is no CUPS job to restart, and a file never has bytes pending
+	// like a pipe, so every label would count as printed: no checkpoint
+	{
+		static const char	szNoCheckpoint[] = "tsc-checkpoint=false";
+		size_t				cbNew = cbOptions + sizeof(szNoCheckpoint) + 1;
+		char				*p = realloc(szOptions, cbNew);
+
+		if ( p == NULL )
+		{
+			MEMFREE(szOptions);
+			return (1);
+		}
+		snprintf(p + cbOptions, cbNew - cbOptions, "%s%s", cbOptions ? " " : "", szNoCheckpoint);
+		szOptions = p;
+	}
+
+	jobargv[0] = argv[0];
+	jobargv[1] = "1";
+	jobargv[2] = getenv("USER") ? getenv("USER") : "root";
+	jobargv[3] = "standalone";
+	jobargv[4] = (char*)szCopies;
+	jobargv[5] = szOptions;
+	if ( optind < argc )
+		jobargv[jobargc++] = argv[optind];
+	jobargv[jobargc] = NULL;
+
+	for (i=0; i<nRepeat && iRtn == 0; i++)
+	{
+		// Every pass leaves one job in a regular output file
+		if ( i > 0 && lseek(fileno(stdout), 0, SEEK_SET) == 0 && ftruncate(fileno(stdout), 0) )
+		{
+			Error_Log(LEVEL_ERROR, "Unable to truncate the output: %s\n", strerror(errno));
+			iRtn = 1;
+			break;
+		}
+
+		iRtn = ConvertJob(jobargc, jobargv);
+	}
+
+	MEMFREE(szOptions);
+	return iRtn;
 }
 
 int ParseDocData(DEVDATA *pdev, int fd, doc_t *doc)
@@ -224,8 +508,11 @@ int ParseDocData(DEVDATA *pdev, int fd, doc_t *doc)
 		int					nOutWidth;
 		int					nOutHeight;
 		pageinfo_t			*pageinfo;
+		int					nPage = pdev->lib_cups.cupsArrayCount(doc->pages) + 1;
+		TRACETIME			tStart;
 
-		DebugPrintf("PAGE: %d\n", pdev->lib_cups.cupsArrayCount(doc->pages) + 1);
+		DebugPrintf("PAGE: %d\n", nPage);
+		TSC_PROBE1(page_decode_start, nPage);
 		DebugPrintf("NumCopies=%d\n", header.NumCopies);
 		DebugPrintf("PageSize(%dx%d) HWResolution(%dx%d)\n", header.PageSize[0], header.PageSize[1], header.HWResolution[0], header.HWResolution[1]);
 		DebugPrintf("Margins(%dx%d)\n", header.Margins[0], header.Margins[1]);
@@ -238,36 +525,39 @@ int ParseDocData(DEVDATA *pdev, int fd, doc_t *doc)
 		nOutHeight = header.cupsHeight;
 
 		// Check Page Size
-		if ( header.PageSize[0] > pdev->ppd->custom_max[0] || header.PageSize[1] > pdev->ppd->custom_max[1] )
+		if ( header.PageSize[0] > PPDCACHE_HDR(pdev->ppd)->custom_max[0] || header.PageSize[1] > PPDCACHE_HDR(pdev->ppd)->custom_max[1] )
 		{
 			// Page Size is too big
-			ppd_size_t		*pagesize = NULL;
-			ppd_option_t	*option;
+			const PPDCACHE_OPTION	*option;
+			int						n;
 
-			DebugPrintf("Custom Max: %.3fx%.3f\n", pdev->ppd->custom_max[0], pdev->ppd->custom_max[1]);
+			DebugPrintf("Custom Max: %.3fx%.3f\n", PPDCACHE_HDR(pdev->ppd)->custom_max[0], PPDCACHE_HDR(pdev->ppd)->custom_max[1]);
 			DebugPrintf("Page size is too big\n");
-			if ( (option = pdev->lib_cups.ppdFindOption(pdev->ppd, "PageSize")) != NULL )
+			if ( (n = PpdCacheFindOption(pdev->ppd, "PageSize")) >= 0 )
 			{
-				DebugPrintf("DefaultPageSize: '%s'\n", option->defchoice);
+				option = PPDCACHE_OPT(pdev->ppd, n);
 				if ( option->num_choices > 0 )
 				{
-					int		i;
+					DWORD			i;
+					const char		*choice;
+					float			width, length;
 					
 					for (i=0; i<option->num_choices; i++)
 					{
-						if ( strcasecmp(option->choices[i].choice, "Custom") )
+						choice = PPDCACHE_STR(pdev->ppd, PPDCACHE_CHO(pdev->ppd, option->first_choice + i)->choice);
+						if ( strcasecmp(choice, "Custom") )
 						{
-							DebugPrintf("Get PageSize: '%s'\n", option->choices[i].choice);
-							if ( (pagesize = pdev->lib_cups.ppdPageSize(pdev->ppd, option->choices[i].choice)) != NULL )
+							DebugPrintf("Get PageSize: '%s'\n", choice);
+							if ( PpdCachePageSize(pdev->ppd, choice, &width, &length) )
 							{
-								DebugPrintf("PageSize: '%s' -> %.3fx%.3f (point)\n", pagesize->name, pagesize->width, pagesize->length);
+								DebugPrintf("PageSize: '%s' -> %.3fx%.3f (point)\n", choice, width, length);
 								
-								pdev->dm.dmPaperWidth  = pagesize->width;
-								pdev->dm.dmPaperLength = pagesize->length;
+								pdev->dm.dmPaperWidth  = width;
+								pdev->dm.dmPaperLength = length;
 								pdev->dm.dmFields |= DM_PAPERLENGTH | DM_PAPERWIDTH;
 
-								nOutWidth  = (int)(pagesize->width  * header.HWResolution[0] / 72 + 0.5);
-								nOutHeight = (int)(pagesize->length * header.HWResolution[1] / 72 + 0.5);
+								nOutWidth  = (int)(width  * header.HWResolution[0] / 72 + 0.5);
+								nOutHeight = (int)(length * header.HWResolution[1] / 72 + 0.5);
 
 								DebugPrintf("Change Out PageSize to %dx%d (pixel)\n", nOutWidth, nOutHeight);
 								break;
@@ -304,6 +594,7 @@ int ParseDocData(DEVDATA *pdev, int fd, doc_t *doc)
 
 			if ( RowData && PlaneData )
 			{
+				tStart = Trace_Begin();
 				for (y = 0; y < header.cupsHeight; y ++)
 				{
 //					DebugPrintf("cupsRasterReadPixels Line %d\n", y);
@@ -317,13 +608,28 @@ int ParseDocData(DEVDATA *pdev, int fd, doc_t *doc)
 					if (y < nOutHeight )
 						memmove(PlaneData + WidthBytes * y, RowData, WidthBytes);
 				}
-				
-				//
+				Trace_End("DecodePage", tStart, nPage);
+				Metrics_Add(METRIC_PIXELS, (long long)header.cupsWidth * header.cupsHeight);
 
+				tStart = Trace_Begin();
 				for(y=0; y<WidthBytes * nOutHeight; y++)
 					PlaneData[y] = ~PlaneData[y];
+				Trace_End("Invert", tStart, nPage);
 
+				pageinfo->inked = AUTOLENGTH(&pdev->dm) ? InkedRows(PlaneData, WidthBytes, nOutHeight) : nOutHeight;
+
+				if ( doc->checkpoint_on )
+				{
+					doc->hash = HashBytes(doc->hash, &pageinfo->width, sizeof(pageinfo->width));
+					doc->hash = HashBytes(doc->hash, &pageinfo->height, sizeof(pageinfo->height));
+					doc->hash = HashBytes(doc->hash, PlaneData, WidthBytes * nOutHeight);
+				}
+
+				tStart = Trace_Begin();
 				pdev->lib_cups.cupsFileWrite(temp, PlaneData, WidthBytes * nOutHeight);
+				Trace_End("SpoolWrite", tStart, nPage);
+				Metrics_Add(METRIC_SPOOL_BYTES, WidthBytes * nOutHeight);
+				TSC_PROBE2(page_decode_end, nPage, WidthBytes * nOutHeight);
 				pageinfo->length = pdev->lib_cups.cupsFileTell(temp) - pageinfo->offset;
 				if ( pageinfo->length != WidthBytes * nOutHeight )
 				{
@@ -372,6 +678,345 @@ void FreeDocData(DEVDATA *pdev, doc_t *doc)
 		fclose(doc->fp_temp);
 	if ( doc->tempfile[0] )
 		unlink(doc->tempfile);
+	CheckpointClose(pdev, doc);
+}
+
+// Labels across for the job, fewer when the row would be wider than the
+// media. dmPaperWidth becomes the row, the SIZE the printer feeds.
+int ImposeColumns(DEVDATA *pdev, doc_t *doc, unsigned *pnPitch, unsigned *pnGap)
+{
+	int				nColumns = pdev->dm.dmColumns;
+	float			fWidth = pdev->dm.dmPaperWidth;
+	float			fGap = pdev->dm.dmColumnGap;
+	float			fMaxWidth = PPDCACHE_HDR(pdev->ppd)->custom_max[0];
+	int				i;
+
+	if ( nColumns < 1 )
+		nColumns = 1;
+	else if ( nColumns > COLUMNS_MAX_VALUE )
+		nColumns = COLUMNS_MAX_VALUE;
+
+	if ( nColumns > 1 && fMaxWidth > 0 && fWidth * nColumns + fGap * (nColumns - 1) > fMaxWidth )
+	{
+		int		n = (int)((fMaxWidth + fGap) / (fWidth + fGap));
+
+		if ( n < 1 )
+			n = 1;
+		Error_Log(LEVEL_WARNING, "%d labels across are wider than the media, printing %d\n", nColumns, n);
+		nColumns = n;
+	}
+
+	// The widest page is the pitch
+	*pnPitch = 0;
+	for (i=0; i<pdev->dm.dmDocPages; i++)
+	{
+		pageinfo_t	*pageinfo = (pageinfo_t*)pdev->lib_cups.cupsArrayIndex(doc->pages, i);
+
+		if ( pageinfo && pageinfo->width > *pnPitch )
+			*pnPitch = pageinfo->width;
+	}
+	*pnGap = (unsigned)(POINT2DOT(fGap, pdev->dm.dmPrintQuality) + 0.5);
+
+	if ( nColumns > 1 )
+		pdev->dm.dmPaperWidth = fWidth * nColumns + fGap * (nColumns - 1);
+
+	DebugPrintf("ImposeColumns: %d across, pitch %u, gap %u dots\n", nColumns, *pnPitch, *pnGap);
+	return nColumns;
+}
+
+// ANDs the first nRows of a spooled page into the row at dot x, the
+// spool is inverted so white is 1 and the row starts all white
+void ImposePage(LPBYTE pRow, unsigned cbRow, unsigned x, const BYTE *pPage, const pageinfo_t *pageinfo, unsigned nRows)
+{
+	unsigned		cbPage = pageinfo->length / pageinfo->height;
+	unsigned		cbRoom = cbRow - (x >> 3);
+	unsigned		shift = x & 7;
+	unsigned		y, i;
+
+	for (y=0; y<nRows; y++)
+	{
+		LPBYTE		pDst = pRow + cbRow * y + (x >> 3);
+		const BYTE	*pSrc = pPage + cbPage * y;
+
+		for (i=0; i<cbPage && i<cbRoom; i++)
+		{
+			pDst[i] &= (BYTE)((pSrc[i] >> shift) | (0xFF << (8 - shift)));
+			if ( shift && i + 1 < cbRoom )
+				pDst[i + 1] &= (BYTE)((pSrc[i] << (8 - shift)) | (0xFF >> shift));
+		}
+	}
+}
+
+// Rows of inverted 1 bit data down to the last one with a black dot
+unsigned InkedRows(const BYTE *pData, unsigned cbLine, unsigned nRows)
+{
+	unsigned		x;
+
+	for ( ; nRows > 0; nRows--)
+	{
+		const BYTE	*pLine = pData + cbLine * (nRows - 1);
+
+		for (x=0; x<cbLine; x++)
+		{
+			if ( pLine[x] != 0xFF )
+				return nRows;
+		}
+	}
+	return 0;
+}
+
+// Rows of a page to send, the content and the margin below it when the
+// length is automatic. A blank page still feeds one row.
+unsigned TrimmedRows(DEVDATA *pdev, const pageinfo_t *pageinfo)
+{
+	unsigned		nRows;
+
+	if ( !AUTOLENGTH(&pdev->dm) )
+		return pageinfo->height;
+
+	nRows = pageinfo->inked + (unsigned)(POINT2DOT(pdev->dm.dmAutoLengthMargin, pdev->dm.dmYResolution) + 0.5);
+	return max(1, min(nRows, pageinfo->height));
+}
+
+// Labels first to first + n - 1 of the job in one BITMAP and one PRINT,
+// the page of a label wraps around for collated copies
+BOOL SendRow(DEVDATA *pdev, doc_t *doc, int first, int n, unsigned nPitch, unsigned nGap)
+{
+	pageinfo_t		*pages[COLUMNS_MAX_VALUE];
+	LPBYTE			PlaneData[COLUMNS_MAX_VALUE];
+	unsigned		nRows[COLUMNS_MAX_VALUE];
+	unsigned		height = 0;
+	size_t			cbPage;
+	int				page = first % pdev->dm.dmDocPages;
+	BOOL			bRtn = TRUE;
+	TRACETIME		tStart = Trace_Begin();
+	int				i;
+
+	memset(PlaneData, 0, sizeof(PlaneData));
+	for (i=0; i<n && bRtn; i++)
+	{
+		pages[i] = (pageinfo_t*)pdev->lib_cups.cupsArrayIndex(doc->pages, (first + i) % pdev->dm.dmDocPages);
+		if ( pages[i] == NULL || pages[i]->height == 0 )
+		{
+			bRtn = FALSE;
+			break;
+		}
+
+		DebugPrintf("PAGE: %d\n", (first + i) % pdev->dm.dmDocPages + 1);
+		DebugPrintf("pageinfo->offset=%d, pageinfo->length=%d\n", pages[i]->offset, pages[i]->length);
+
+		// The rows past a trimmed length are not read
+		nRows[i] = TrimmedRows(pdev, pages[i]);
+		cbPage = pages[i]->length / pages[i]->height * nRows[i];
+		Metrics_Add(METRIC_SAVED_BYTES, pages[i]->length - cbPage);
+
+		PlaneData[i] = MEMALLOC(cbPage);
+		bRtn = PlaneData[i] &&
+			fseek(doc->fp_temp, pages[i]->offset, SEEK_SET) >= 0 &&
+			fread(PlaneData[i], 1, cbPage, doc->fp_temp) == cbPage;
+		height = max(height, nRows[i]);
+	}
+	Trace_End("ReplayRead", tStart, page + 1);
+
+	if ( bRtn )
+	{
+		tStart = Trace_Begin();
+		TSC_PROBE2(page_emit, page + 1, first / pdev->dm.dmDocPages);
+
+		// Continuous media feeds the SIZE, it follows the trimmed row
+		if ( AUTOLENGTH(&pdev->dm) )
+		{
+			float	fLength = (float)height * 72 / pdev->dm.dmYResolution;
+
+			if ( fLength != pdev->dm.dmPaperLength )
+			{
+				pdev->dm.dmPaperLength = fLength;
+				TSPL_SendSize(pdev->penc);
+			}
+		}
+
+		DebugPrintf("PAGE START\n");
+		TSPL_SendPageStart(pdev->penc);
+
+		if ( n == 1 )
+			TSPL_SendPlane(pdev->penc, PlaneData[0], pages[0]->length / pages[0]->height, nRows[0], doc->bars);
+		else
+		{
+			unsigned	cbRow = WIDTHBYTES_8(nPitch * n + nGap * (n - 1));
+			LPBYTE		pRow = MEMALLOC(cbRow * height);
+
+			if ( pRow )
+			{
+				memset(pRow, 0xFF, cbRow * height);
+				for (i=0; i<n; i++)
+					ImposePage(pRow, cbRow, i * (nPitch + nGap), PlaneData[i], pages[i], nRows[i]);
+
+				TSPL_SendPlane(pdev->penc, pRow, cbRow, height, doc->bars);
+				MEMFREE(pRow);
+			}
+			else
+			{
+				Error_Log(LEVEL_ERROR, "No memory: %s\n", strerror(errno));
+				bRtn = FALSE;
+			}
+		}
+
+		DebugPrintf("PAGE END\n");
+		TSPL_SendPageEnd(pdev->penc);
+		Trace_End("OutputPage", tStart, page + 1);
+	}
+
+	for (i=0; i<n; i++)
+		MEMFREE(PlaneData[i]);
+	return bRtn;
+}
+
+// FNV-1a eight bytes a round, a checkpoint key and no digest
+static unsigned long long HashBytes(unsigned long long hash, const void *pData, size_t cbData)
+{
+	const BYTE			*p = pData;
+	unsigned long long	w;
+
+	for ( ; cbData >= sizeof(w); p += sizeof(w), cbData -= sizeof(w))
+	{
+		memcpy(&w, p, sizeof(w));
+		hash = (hash ^ w) * 1099511628211ULL;
+	}
+	for ( ; cbData > 0; p++, cbData--)
+		hash = (hash ^ *p) * 1099511628211ULL;
+
+	return hash;
+}
+
+// Rows to skip, those a previous run of the same job and pages sent
+int CheckpointOpen(DEVDATA *pdev, const char *szJob, doc_t *doc, int nRows)
+{
+	const char		*cachedir;
+	const char		*p;
+	DWORD			hash = 2166136261u;
+	checkpoint_t	ckpt;
+	glob_t			old;
+	struct stat		st;
+	size_t			i;
+	int				fd;
+	int				skip = 0;
+
+	if ( !doc->checkpoint_on )
+		return 0;
+
+	if ( (cachedir = getenv("CUPS_CACHEDIR")) == NULL )
+		cachedir = CUPS_CACHEDIR;
+
+	// Every job leaves its checkpoint behind, the old ones go once a day
+	snprintf(doc->checkpoint, sizeof(doc->checkpoint), "%s/tsc-checkpoint.stamp", cachedir);
+	if ( stat(doc->checkpoint, &st) || st.st_mtime + CHECKPOINT_SWEEP < time(NULL) )
+	{
+		if ( (fd = open(doc->checkpoint, O_WRONLY | O_CREAT, 0600)) >= 0 )
+		{
+			futimens(fd, NULL);
+			close(fd);
+		}
+
+		snprintf(doc->checkpoint, sizeof(doc->checkpoint), "%s/tsc-*.ckpt", cachedir);
+		if ( glob(doc->checkpoint, 0, NULL, &old) == 0 )
+		{
+			for (i=0; i<old.gl_pathc; i++)
+			{
+				if ( !stat(old.gl_pathv[i], &st) && st.st_mtime + CHECKPOINT_MAX_AGE < time(NULL) )
+					unlink(old.gl_pathv[i]);
+			}
+			globfree(&old);
+		}
+	}
+
+	// One per queue and job id
+	for (p=pdev->szPrinterName; *p; p++)
+		hash = (hash ^ (BYTE)*p) * 16777619u;
+	snprintf(doc->checkpoint, sizeof(doc->checkpoint), "%s/tsc-%08x-%d.ckpt", cachedir, hash, atoi(szJob));
+
+	if ( (doc->ends = MEMALLOC(sizeof(long long) * (nRows + 1))) == NULL
+		|| (doc->fd_checkpoint = open(doc->checkpoint, O_RDWR | O_CREAT, 0600)) < 0 )
+	{
+		DebugPrintf("CheckpointOpen: %s - %s\n", doc->checkpoint, strerror(errno));
+		MEMFREE(doc->ends);
+		doc->checkpoint[0] = '\0';
+		return 0;
+	}
+
+	if ( pread(doc->fd_checkpoint, &ckpt, sizeof(ckpt), 0) == sizeof(ckpt)
+		&& ckpt.magic == CHECKPOINT_MAGIC && ckpt.hash == doc->hash )
+	{
+		skip = doc->sent = ckpt.rows;
+		Error_Log(LEVEL_INFO, "Job restarted, skipping %d label rows already sent\n", skip);
+	}
+	else
+	{
+		ckpt.magic = CHECKPOINT_MAGIC;
+		ckpt.rows = 0;
+		ckpt.hash = doc->hash;
+		if ( pwrite(doc->fd_checkpoint, &ckpt, sizeof(ckpt), 0) != sizeof(ckpt) )
+			DebugPrintf("CheckpointOpen: %s - %s\n", doc->checkpoint, strerror(errno));
+	}
+
+	return skip;
+}
+
+// dwRows have been written. Every CHECKPOINT_STEP bytes of output the
+// rows are recorded.
+void CheckpointUpdate(DEVDATA *pdev, doc_t *doc, DWORD dwRows)
+{
+	TSPLENC_STATS	stats;
+
+	if ( doc->fd_checkpoint < 0 )
+		return;
+
+	TSPL_EncoderStats(pdev->penc, &stats);
+	doc->rows = dwRows;
+	doc->ends[dwRows - 1] = stats.llOutput;
+	if ( stats.llOutput < doc->next_update )
+		return;
+	doc->next_update = stats.llOutput + CHECKPOINT_STEP;
+
+	CheckpointWrite(doc, stats.llOutput);
+}
+
+// The rows CHECKPOINT_IN_FLIGHT bytes ahead of what is still in the pipe
+// count as sent. The page cache keeps the file past a killed filter.
+void CheckpointWrite(doc_t *doc, long long llWritten)
+{
+	checkpoint_t	ckpt;
+	int				nPending = 0;
+	DWORD			sent = doc->sent;
+
+	// Not a pipe, nothing is pending
+	if ( ioctl(fileno(stdout), FIONREAD, &nPending) < 0 )
+		nPending = 0;
+	while ( sent < doc->rows && doc->ends[sent] <= llWritten - nPending - CHECKPOINT_IN_FLIGHT )
+		sent++;
+	if ( sent == doc->sent )
+		return;
+	doc->sent = sent;
+
+	ckpt.magic = CHECKPOINT_MAGIC;
+	ckpt.rows = doc->sent;
+	ckpt.hash = doc->hash;
+	if ( pwrite(doc->fd_checkpoint, &ckpt, sizeof(ckpt), 0) != sizeof(ckpt) )
+		DebugPrintf("CheckpointWrite: %s - %s\n", doc->checkpoint, strerror(errno));
+}
+
+// Records the rows sent at the end, the file is left for the sweep
+void CheckpointClose(DEVDATA *pdev, doc_t *doc)
+{
+	TSPLENC_STATS	stats;
+
+	if ( doc->fd_checkpoint >= 0 )
+	{
+		TSPL_EncoderStats(pdev->penc, &stats);
+		CheckpointWrite(doc, stats.llOutput);
+		close(doc->fd_checkpoint);
+		doc->fd_checkpoint = -1;
+	}
+	MEMFREE(doc->ends);
 }
 
 DEVDATA* DrvEnable(int argc, char *argv[])
@@ -410,6 +1055,14 @@ DEVDATA* DrvEnable(int argc, char *argv[])
 			DrvDisable(pdev);
 			pdev = NULL;
 		}
+
+		// Reads pdev->dm as the job goes, the page size is set later
+		if ( pdev && (pdev->penc = TSPL_OpenEncoder(&pdev->dm, Metrics_WriteStdout, NULL)) == NULL )
+		{
+			Error_Log(LEVEL_ERROR, "No memory: %s\n", strerror(errno));
+			DrvDisable(pdev);
+			pdev = NULL;
+		}
 	}
 
 #ifdef _DEBUG
@@ -433,9 +1086,18 @@ void DrvDisable(DEVDATA *pdev)
 	DebugPrintf("\n#ENTER:DrvDisable(pdev=%p)\n", pdev);
 	if ( pdev )
 	{
-		if ( pdev->ppd && pdev->lib_cups.ppdClose )
+		if ( pdev->penc )
+		{
+			TSPLENC_STATS	stats;
+
+			TSPL_EncoderStats(pdev->penc, &stats);
+			Metrics_Add(METRIC_SPOOL_BYTES, stats.llSpooled);
+			Metrics_Add(METRIC_SAVED_BYTES, stats.llSaved);
+			TSPL_CloseEncoder(pdev->penc);
+		}
+		if ( pdev->ppd )
 		{
-			pdev->lib_cups.ppdClose(pdev->ppd);
+			PpdCacheClose(pdev->ppd);
 		}
 		if ( pdev->options && pdev->lib_cups.cupsFreeOptions )
 		{
@@ -493,13 +1155,20 @@ static BOOL bInitCupsOptions(DEVDATA *pdev, char *argv[])
 		DebugPrintf("\t%s=%s\n", pdev->options[i].name, pdev->options[i].value);
 	}
 
+	// Parsed once, shared by option gathering and devmode setup
+	if ( (pdev->ppd = OpenPrinterPPD(pdev->szPrinterName, &pdev->lib_cups)) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to open the PPD file of %s\n", pdev->szPrinterName);
+		return bRtn;
+	}
+
 	{
 		//////////////////////////////////
 		// Get options from CUPS setting file
 		int					num_options;		// CUPS option count
 		cups_option_t		*options;			// CUPS options
 
-		num_options = GetPrinterOptions(pdev->szPrinterName, &options, &pdev->lib_cups);
+		num_options = PpdCacheGetOptions(pdev->ppd, &options, &pdev->lib_cups);
 		for(i=0; i<num_options; i++)
 		{
 			if ( strcmp(options[i].name, "orientation-requested")
@@ -526,61 +1195,14 @@ static BOOL bInitCupsOptions(DEVDATA *pdev, char *argv[])
 		DebugPrintf("\t%s=%s\n", pdev->options[i].name, pdev->options[i].value);
 	}
 
+	if ( pdev->ppd )
 	{
-		const char		*filename;
-//		ppd_file_t		*ppd;
+		bRtn = SetDevmodeFromOptions(&pdev->lib_cups, pdev->ppd, &pdev->dm, pdev->num_options, pdev->options);
 
-		// Create temp PPD file by printer name
-		if ( (filename = pdev->lib_cups.cupsGetPPD(pdev->szPrinterName)) != NULL )
-		{
-	//		DebugPrintf("the ppd of printers is %s.\n", filename);
-
-			// Open the PPD file
-			pdev->ppd = pdev->lib_cups.ppdOpenFile(filename);
-
-			// Delete temp PPD file
-			unlink(filename);
-
-			if ( pdev->ppd )
-			{
-				ppd_size_t		*pagesize = NULL;
-
-				pdev->lib_cups.ppdMarkDefaults(pdev->ppd);
-				// Mark PPD options by printer options
-				pdev->lib_cups.cupsMarkOptions(pdev->ppd, pdev->num_options, pdev->options);
-
-				bRtn = SetDevmodeFromOptions(&pdev->lib_cups, pdev->ppd, &pdev->dm, pdev->num_options, pdev->options);
-
-//				pagesize = pdev->lib_cups.ppdPageSize(pdev->ppd, NULL);
-//				if ( !pagesize )
-//				{
-//					for (i = 0; i < pdev->ppd->num_sizes; i ++)
-//						if (pdev->ppd->sizes[i].marked)
-//						{
-//							pagesize = (pdev->ppd->sizes + i);
-//							break;
-//						}
-//				}
-//				DebugPrintf("pagesize = %p.\n", pagesize);
-
-				pdev->dm.dmFields |= DM_COPIES;
-				pdev->dm.dmCopies = atoi(argv[4]);
-				if ( pdev->dm.dmCopies == 0 )
-					pdev->dm.dmCopies = 1;
-
-//				if ( pagesize )
-//				{
-//					pdev->dm.dmPaperWidth  = pagesize->width;
-//					pdev->dm.dmPaperLength = pagesize->length;
-//					pdev->dm.dmFields |= DM_PAPERLENGTH | DM_PAPERWIDTH;
-//				}
-//				else
-//				{
-//					Error_Log(LEVEL_ERROR, "Paper size is NOT set.\n");
-//					bRtn = FALSE;
-//				}
-			}
-		}
+		pdev->dm.dmFields |= DM_COPIES;
+		pdev->dm.dmCopies = atoi(argv[4]);
+		if ( pdev->dm.dmCopies == 0 )
+			pdev->dm.dmCopies = 1;
 	}
 
 	if ( pdev->dm.dmCopies == 0 )
@@ -601,48 +1223,3 @@ static BOOL bInitCupsOptions(DEVDATA *pdev, char *argv[])
 
 	return bRtn;
 }
-
-size_t printer_write(const void* pbuf, size_t cbbuf)
-{
-//	DebugPrintf("printer_write %d bytes\n", cbbuf);
-	return write(fileno(stdout), pbuf, cbbuf);
-}
-
-int printer_printf(const char* strfmt, ...)
-{
-	int		iRtn = -1;
-	int		size = 128;
-	va_list	args;
-	char	*p;
-
-	// Guess we need no more than 128 bytes.
-	while ((p = MEMALLOC(size)) != NULL)
-	{
-		// Try to print in the allocated space.
-		va_start(args, strfmt);
-		iRtn = vsnprintf(p, size, strfmt, args);
-		va_end(args);
-
-		// If that worked, break;
-		if (iRtn > -1 && iRtn < size)
-		{
-			break;
-		}
-		
-		// Else try again with more space. */
-		if (iRtn > -1)		// glibc 2.1
-			size = iRtn+1;	// precisely what is needed
-		else				// glibc 2.0
-			size *= 2;		// twice the old size
-
-		MEMFREE(p);
-	}
-
-	if ( p )
-	{
-		iRtn = printer_write(p, iRtn);
-		MEMFREE(p);
-	}
-
-	return iRtn;
-}
@@ -0,0 +1,705 @@
+/*
+ * "template.c 2021-05-17 15:55:05
+ *  
+ *  variable data templates for TSC Printer Driver
+ *  
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ 
+ */
+
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "device.h"
+#include "metrics.h"
+
+#include <sys/stat.h>
+
+// A template is the fixed artwork of a label plus the fields that change
+// per record, in a text file of the template directory named by the
+// tsc-template job option:
+//
+//		# Shipping label
+//		ARTWORK 0,0,"ship.bmp"
+//		TEXT 40,60,"3",0,1,1,"${name}"
+//		BARCODE 40,400,"128",120,1,0,3,3,"${tracking}"
+//		QRCODE 560,400,L,6,A,0,"${url}"
+//
+// The job file is the record stream, CSV with a header line or JSON lines
+// of flat objects. The artwork, a 1 bit BMP relative to the template, is
+// downloaded once and placed with PUTBMP on each label, the drawing
+// commands go out per record with ${name} replaced by the record's field.
+// Nothing is rasterised. The records are their own MIME type, see
+// mime/tsc-template.types, so CUPS hands them to the filter unconverted:
+//
+//		lp -o document-format=application/vnd.tsc-records -o tsc-template=ship.tpl records.csv
+
+#define	TPL_MAX_FIELDS			64
+#define	TPL_ARTWORK_NAME		"TPLART.BMP"
+
+typedef struct _TEMPLATE
+{
+	LPBYTE			pArtwork;				// BMP file, NULL if none
+	DWORD			cbArtwork;
+	int				xArtwork;
+	int				yArtwork;
+	int				nCommands;
+	char			**pszCommands;			// Drawing commands with ${name} fields
+} TEMPLATE;
+
+typedef struct _RECORD
+{
+	BOOL			bJson;
+	char			*szLine;				// getline() buffer, fields point into it
+	size_t			cbLine;
+	char			*szHeader;				// CSV header line, names point into it
+	int				nNames;
+	char			*names[TPL_MAX_FIELDS];
+	int				nValues;
+	char			*values[TPL_MAX_FIELDS];
+} RECORD;
+
+// Commands a template may draw with, the job setup comes from the DEVMODE
+static const char	*g_szDrawCommands[] =
+{
+	"TEXT", "BLOCK", "BARCODE", "QRCODE", "DMATRIX", "PDF417", "AZTEC", "MAXICODE",
+	"BAR", "BOX", "CIRCLE", "ELLIPSE", "DIAGONAL", "ERASE", "REVERSE"
+};
+
+static void StripLineEnd(char *szLine)
+{
+	size_t		len = strlen(szLine);
+
+	while ( len > 0 && (szLine[len - 1] == '\n' || szLine[len - 1] == '\r') )
+		szLine[--len] = '\0';
+}
+
+// A job names files of the template directory only, relative and with
+// no ".." on the way
+static BOOL IsTemplateName(const char *szName)
+{
+	const char	*p;
+
+	if ( *szName == '\0' || *szName == '/' )
+		return FALSE;
+
+	for (p=szName; ; p++)
+	{
+		if ( p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0') )
+			return FALSE;
+		if ( (p = strchr(p, '/')) == NULL )
+			return TRUE;
+	}
+}
+
+// The path of szName in TSC_TEMPLATEDIR, or in the directory of the
+// template szTemplate there when it is not NULL
+static BOOL TemplatePath(char *szPath, size_t cbPath, const char *szTemplate, const char *szName)
+{
+	const char	*szDir = szTemplate ? strrchr(szTemplate, '/') : NULL;
+	int			cbDir = szDir ? (int)(szDir - szTemplate) + 1 : 0;
+	int			len;
+
+	if ( !IsTemplateName(szName) )
+	{
+		Error_Log(LEVEL_ERROR, "%s is not a file of %s\n", szName, TSC_TEMPLATEDIR);
+		return FALSE;
+	}
+
+	len = snprintf(szPath, cbPath, "%s/%.*s%s", TSC_TEMPLATEDIR, cbDir, szDir ? szTemplate : "", szName);
+	if ( len < 0 || (size_t)len >= cbPath )
+	{
+		Error_Log(LEVEL_ERROR, "The path of %s is too long\n", szName);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL LoadArtwork(TEMPLATE *tpl, const char *szFile)
+{
+	FILE				*fp;
+	struct stat			st;
+	BITMAPFILEHEADER	*pBfh;
+	BITMAPINFOHEADER	*pBih;
+
+	if ( (fp = fopen(szFile, "rb")) == NULL || fstat(fileno(fp), &st) )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to open artwork %s: %s\n", szFile, strerror(errno));
+		if ( fp )
+			fclose(fp);
+		return FALSE;
+	}
+
+	if ( st.st_size > (off_t)(sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER))
+		&& (tpl->pArtwork = MEMALLOC(st.st_size)) != NULL
+		&& fread(tpl->pArtwork, 1, st.st_size, fp) == (size_t)st.st_size )
+	{
+		tpl->cbArtwork = st.st_size;
+	}
+	fclose(fp);
+
+	// PUTBMP takes the file as downloaded, only check it is one
+	pBfh = (BITMAPFILEHEADER *)tpl->pArtwork;
+	pBih = (BITMAPINFOHEADER *)(tpl->pArtwork + sizeof(BITMAPFILEHEADER));
+	if ( tpl->cbArtwork == 0 || pBfh->bfType != DIB_HEADER_MARKER || pBih->biBitCount != 1 )
+	{
+		Error_Log(LEVEL_ERROR, "Artwork %s is not a 1 bit BMP file\n", szFile);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL LoadTemplate(TEMPLATE *tpl, const char *szTemplate)
+{
+	FILE		*fp;
+	char		szFile[PATH_MAX];
+	char		*szLine = NULL;
+	size_t		cbLine = 0;
+	int			nLine = 0;
+	BOOL		bRtn = TRUE;
+
+	if ( !TemplatePath(szFile, sizeof(szFile), NULL, szTemplate) )
+		return FALSE;
+
+	if ( (fp = fopen(szFile, "r")) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to open template %s: %s\n", szFile, strerror(errno));
+		return FALSE;
+	}
+
+	while ( bRtn && getline(&szLine, &cbLine, fp) > 0 )
+	{
+		char		szCmd[16];
+		char		szArtwork[256];
+		char		szPath[PATH_MAX];
+		const char	*p = szLine;
+		size_t		i;
+
+		nLine++;
+		StripLineEnd(szLine);
+		while ( isspace((BYTE)*p) )
+			p++;
+		if ( *p == '\0' || *p == '#' )
+			continue;
+
+		if ( sscanf(p, "ARTWORK %d,%d,\"%255[^\"]\"", &tpl->xArtwork, &tpl->yArtwork, szArtwork) == 3 )
+		{
+			MEMFREE(tpl->pArtwork);
+			tpl->cbArtwork = 0;
+			bRtn = TemplatePath(szPath, sizeof(szPath), szTemplate, szArtwork) && LoadArtwork(tpl, szPath);
+			continue;
+		}
+
+		for (i=0; i<ARRAYCOUNT(g_szDrawCommands); i++)
+		{
+			size_t		len = strlen(g_szDrawCommands[i]);
+
+			if ( !strncasecmp(p, g_szDrawCommands[i], len) && (p[len] == ' ' || p[len] == '\t') )
+				break;
+		}
+		if ( i == ARRAYCOUNT(g_szDrawCommands) )
+		{
+			sscanf(p, "%15s", szCmd);
+			Error_Log(LEVEL_ERROR, "%s:%d: %s is not a drawing command\n", szFile, nLine, szCmd);
+			bRtn = FALSE;
+			break;
+		}
+
+		{
+			char	**pszNew = realloc(tpl->pszCommands, sizeof(char *) * (tpl->nCommands + 1));
+
+			if ( pszNew == NULL || (pszNew[tpl->nCommands] = strdup(p)) == NULL )
+			{
+				Error_Log(LEVEL_ERROR, "No memory: %s\n", strerror(errno));
+				if ( pszNew )
+					tpl->pszCommands = pszNew;
+				bRtn = FALSE;
+				break;
+			}
+			tpl->pszCommands = pszNew;
+			tpl->nCommands++;
+		}
+	}
+
+	free(szLine);
+	fclose(fp);
+
+	if ( bRtn && tpl->nCommands == 0 && tpl->pArtwork == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Template %s draws nothing\n", szFile);
+		bRtn = FALSE;
+	}
+
+	return bRtn;
+}
+
+static void FreeTemplate(TEMPLATE *tpl)
+{
+	int			i;
+
+	for (i=0; i<tpl->nCommands; i++)
+		MEMFREE(tpl->pszCommands[i]);
+	MEMFREE(tpl->pszCommands);
+	MEMFREE(tpl->pArtwork);
+}
+
+// Splits a CSV line in place, quoted fields may hold commas, "" and newlines
+static int SplitCsv(char *szLine, char **fields, int nMax)
+{
+	char		*in = szLine;
+	char		*out = szLine;
+	int			n = 0;
+
+	while ( n < nMax )
+	{
+		fields[n++] = out;
+		if ( *in == '"' )
+		{
+			for (in++; *in; )
+			{
+				if ( *in == '"' && *++in != '"' )
+					break;
+				*out++ = *in++;
+			}
+		}
+		while ( *in && *in != ',' )
+			*out++ = *in++;
+
+		if ( *in != ',' )
+			break;
+		in++;
+		*out++ = '\0';
+	}
+	*out = '\0';
+
+	return n;
+}
+
+static char* SkipSpace(char *p)
+{
+	while ( isspace((BYTE)*p) )
+		p++;
+	return p;
+}
+
+// Decodes the JSON string at *pp in place, *pp is left after it
+static char* JsonString(char **pp)
+{
+	char		*in = *pp + 1;
+	char		*out = *pp;
+	char		*start = out;
+
+	while ( *in && *in != '"' )
+	{
+		if ( *in != '\\' )
+		{
+			*out++ = *in++;
+			continue;
+		}
+
+		switch ( *++in )
+		{
+		case 'b':	*out++ = '\b';	break;
+		case 'f':	*out++ = '\f';	break;
+		case 'n':	*out++ = '\n';	break;
+		case 'r':	*out++ = '\r';	break;
+		case 't':	*out++ = '\t';	break;
+		case '"':
+		case '\\':
+		case '/':	*out++ = *in;	break;
+		case 'u':
+			{
+				unsigned	uc, lo;
+
+				if ( sscanf(in + 1, "%4x", &uc) != 1 )
+					return NULL;
+				in += 4;
+				// A surrogate pair is one character
+				if ( uc >= 0xD800 && uc < 0xDC00 && in[1] == '\\' && in[2] == 'u'
+					&& sscanf(in + 3, "%4x", &lo) == 1 && lo >= 0xDC00 && lo < 0xE000 )
+				{
+					uc = 0x10000 + ((uc - 0xD800) << 10) + (lo - 0xDC00);
+					in += 6;
+				}
+
+				if ( uc < 0x80 )
+					*out++ = uc;
+				else if ( uc < 0x800 )
+				{
+					*out++ = 0xC0 | (uc >> 6);
+					*out++ = 0x80 | (uc & 0x3F);
+				}
+				else if ( uc < 0x10000 )
+				{
+					*out++ = 0xE0 | (uc >> 12);
+					*out++ = 0x80 | ((uc >> 6) & 0x3F);
+					*out++ = 0x80 | (uc & 0x3F);
+				}
+				else
+				{
+					*out++ = 0xF0 | (uc >> 18);
+					*out++ = 0x80 | ((uc >> 12) & 0x3F);
+					*out++ = 0x80 | ((uc >> 6) & 0x3F);
+					*out++ = 0x80 | (uc & 0x3F);
+				}
+			}
+			break;
+		default:
+			return NULL;
+		}
+		in++;
+	}
+	if ( *in != '"' )
+		return NULL;
+
+	*out = '\0';
+	*pp = in + 1;
+	return start;
+}
+
+// Splits a flat JSON object in place, numbers and literals are kept as text
+static int SplitJson(char *szLine, char **names, char **values, int nMax)
+{
+	char		*p = SkipSpace(szLine);
+	int			n = 0;
+	char		c;
+
+	if ( *p++ != '{' )
+		return -1;
+	if ( *(p = SkipSpace(p)) == '}' )
+		return 0;
+
+	do
+	{
+		char		*name, *value;
+
+		p = SkipSpace(p);
+		if ( *p != '"' || (name = JsonString(&p)) == NULL )
+			return -1;
+		p = SkipSpace(p);
+		if ( *p++ != ':' )
+			return -1;
+		p = SkipSpace(p);
+
+		if ( *p == '"' )
+		{
+			if ( (value = JsonString(&p)) == NULL )
+				return -1;
+			p = SkipSpace(p);
+			c = *p++;
+		}
+		else
+		{
+			value = p;
+			while ( *p && *p != ',' && *p != '}' && !isspace((BYTE)*p) )
+				p++;
+			if ( p == value || *value == '{' || *value == '[' || *p == '\0' )
+				return -1;
+			c = *p;
+			*p++ = '\0';
+			if ( isspace((BYTE)c) )
+			{
+				p = SkipSpace(p);
+				c = *p++;
+			}
+			if ( !strcmp(value, "null") )
+				value = "";
+		}
+
+		if ( n < nMax )
+		{
+			names[n] = name;
+			values[n++] = value;
+		}
+	} while ( c == ',' );
+
+	return c == '}' ? n : -1;
+}
+
+// Next record, FALSE at the end of the stream
+static BOOL ReadRecord(FILE *fp, RECORD *rec)
+{
+	ssize_t		len;
+
+	while ( (len = getline(&rec->szLine, &rec->cbLine, fp)) > 0 )
+	{
+		Metrics_Add(METRIC_INPUT_BYTES, len);
+
+		if ( !rec->bJson )
+		{
+			// A quoted field goes on while the quotes are unbalanced
+			size_t		nQuotes = 0;
+			const char	*p;
+
+			for (p=rec->szLine; *p; p++)
+				nQuotes += (*p == '"');
+			while ( (nQuotes & 1) )
+			{
+				char		*szMore = NULL;
+				size_t		cbMore = 0;
+				ssize_t		lenMore = getline(&szMore, &cbMore, fp);
+				char		*szJoined;
+
+				if ( lenMore <= 0 || (szJoined = realloc(rec->szLine, len + lenMore + 1)) == NULL )
+				{
+					free(szMore);
+					break;
+				}
+				Metrics_Add(METRIC_INPUT_BYTES, lenMore);
+				memcpy(szJoined + len, szMore, lenMore + 1);
+				for (p=szMore; *p; p++)
+					nQuotes += (*p == '"');
+				rec->szLine = szJoined;
+				rec->cbLine = len + lenMore + 1;
+				len += lenMore;
+				free(szMore);
+			}
+		}
+
+		StripLineEnd(rec->szLine);
+		if ( *SkipSpace(rec->szLine) == '\0' )
+			continue;
+
+		if ( rec->bJson )
+		{
+			rec->nNames = rec->nValues = SplitJson(rec->szLine, rec->names, rec->values, TPL_MAX_FIELDS);
+			if ( rec->nValues < 0 )
+			{
+				Error_Log(LEVEL_WARNING, "Skipping a record that is not a flat JSON object\n");
+				continue;
+			}
+		}
+		else
+		{
+			rec->nValues = SplitCsv(rec->szLine, rec->values, TPL_MAX_FIELDS);
+		}
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static const char* FieldValue(RECORD *rec, const char *szName, size_t cbName)
+{
+	int			i;
+
+	for (i=0; i<rec->nNames && i<rec->nValues; i++)
+	{
+		if ( !strncmp(rec->names[i], szName, cbName) && rec->names[i][cbName] == '\0' )
+			return rec->values[i];
+	}
+	return NULL;
+}
+
+static BOOL Append(char **pBuf, size_t *pcbBuf, size_t *pLen, const char *p, size_t n)
+{
+	if ( *pLen + n + 1 > *pcbBuf )
+	{
+		size_t	cbNew = (*pLen + n + 1) * 2;
+		char	*pNew = realloc(*pBuf, cbNew);
+
+		if ( pNew == NULL )
+			return FALSE;
+		*pBuf = pNew;
+		*pcbBuf = cbNew;
+	}
+	memcpy(*pBuf + *pLen, p, n);
+	*pLen += n;
+	(*pBuf)[*pLen] = '\0';
+	return TRUE;
+}
+
+// Appends a command with its fields filled in. A quote in a value is
+// TSPL's \["], control characters would end the command and are dropped.
+static BOOL ExpandCommand(const char *szCmd, RECORD *rec, char **pBuf, size_t *pcbBuf, size_t *pLen)
+{
+	const char	*p = szCmd;
+	const char	*field;
+
+	while ( (field = strstr(p, "${")) != NULL )
+	{
+		const char	*end = strchr(field + 2, '}');
+		const char	*value;
+
+		if ( end == NULL )
+			break;
+		if ( !Append(pBuf, pcbBuf, pLen, p, field - p) )
+			return FALSE;
+
+		if ( (value = FieldValue(rec, field + 2, end - field - 2)) != NULL )
+		{
+			for ( ; *value; value++)
+			{
+				if ( *value == '"' )
+				{
+					if ( !Append(pBuf, pcbBuf, pLen, "\\[\"]", 4) )
+						return FALSE;
+				}
+				else if ( (BYTE)*value >= 0x20 && !Append(pBuf, pcbBuf, pLen, value, 1) )
+					return FALSE;
+			}
+		}
+		p = end + 1;
+	}
+
+	return Append(pBuf, pcbBuf, pLen, p, strlen(p)) && Append(pBuf, pcbBuf, pLen, "\r\n", 2);
+}
+
+// The first ${name} of the template the record has no field for, or NULL
+static const char* MissingField(TEMPLATE *tpl, RECORD *rec, int *pcbName)
+{
+	int			i;
+	const char	*p, *end;
+
+	for (i=0; i<tpl->nCommands; i++)
+	{
+		for (p=tpl->pszCommands[i]; (p = strstr(p, "${")) != NULL && (end = strchr(p, '}')) != NULL; p=end)
+		{
+			if ( FieldValue(rec, p + 2, end - p - 2) == NULL )
+			{
+				*pcbName = end - p - 2;
+				return p + 2;
+			}
+		}
+	}
+	return NULL;
+}
+
+// Prints one label per record of the stream on fd, return 0 on success
+int TemplateJob(DEVDATA *pdev, int fd, const char *szTemplate)
+{
+	TEMPLATE	tpl;
+	RECORD		rec;
+	FILE		*fp;
+	char		*pBuf = NULL;
+	size_t		cbBuf = 0;
+	size_t		len;
+	int			c, i;
+	int			nLabels = 0;
+	int			nRecords = 0;
+	int			cbName;
+	const char	*szName;
+	BOOL		bRtn = TRUE;
+	BOOL		bStarted = FALSE;
+	long long	llStart = Metrics_Now();
+
+	memset(&tpl, 0, sizeof(tpl));
+	memset(&rec, 0, sizeof(rec));
+
+	if ( !LoadTemplate(&tpl, szTemplate) || (fp = fdopen(dup(fd), "r")) == NULL )
+	{
+		FreeTemplate(&tpl);
+		return 1;
+	}
+
+	// JSON lines or CSV, from the first character
+	while ( (c = getc(fp)) != EOF && isspace(c) )
+		;
+	rec.bJson = (c == '{');
+	if ( c != EOF )
+		ungetc(c, fp);
+
+	if ( !rec.bJson )
+	{
+		if ( ReadRecord(fp, &rec) )
+		{
+			// The header keeps the first line buffer, records get their own
+			rec.szHeader = rec.szLine;
+			rec.szLine = NULL;
+			rec.cbLine = 0;
+			rec.nNames = rec.nValues;
+			for (i=0; i<rec.nNames; i++)
+				rec.names[i] = SkipSpace(rec.values[i]);
+
+			// CSV fields are known from the header, a misspelt one fails the job
+			if ( (szName = MissingField(&tpl, &rec, &cbName)) != NULL )
+			{
+				Error_Log(LEVEL_ERROR, "Field %.*s is not a column of the records\n", cbName, szName);
+				bRtn = FALSE;
+			}
+		}
+		else
+		{
+			Error_Log(LEVEL_ERROR, "No CSV header line in the records\n");
+			bRtn = FALSE;
+		}
+	}
+
+	// Labels are not counted ahead, copies of a record are never collated
+	pdev->dm.dmDocPages = 1;
+	pdev->dm.dmCollate = 0;
+	Metrics_Time(METRIC_US_PARSE, llStart);
+	Metrics_Set(METRIC_COPIES, pdev->dm.dmCopies);
+
+	llStart = Metrics_Now();
+	if ( bRtn )
+	{
+		bStarted = TRUE;
+		TSPL_SendJobStart(pdev->penc);
+		if ( tpl.pArtwork )
+			TSPL_SendDownload(pdev->penc, TPL_ARTWORK_NAME, tpl.pArtwork, tpl.cbArtwork);
+	}
+
+	while ( bRtn && ReadRecord(fp, &rec) )
+	{
+		char		szPut[64];
+
+		// A short CSV line or a JSON object without a field is no label
+		nRecords++;
+		if ( (szName = MissingField(&tpl, &rec, &cbName)) != NULL )
+		{
+			Error_Log(LEVEL_WARNING, "Skipping record %d, it has no field %.*s\n", nRecords, cbName, szName);
+			continue;
+		}
+
+		len = 0;
+		if ( tpl.pArtwork )
+		{
+			snprintf(szPut, sizeof(szPut), "PUTBMP %d,%d,\"%s\"\r\n", tpl.xArtwork, tpl.yArtwork, TPL_ARTWORK_NAME);
+			bRtn = Append(&pBuf, &cbBuf, &len, szPut, strlen(szPut));
+		}
+		for (i=0; bRtn && i<tpl.nCommands; i++)
+			bRtn = ExpandCommand(tpl.pszCommands[i], &rec, &pBuf, &cbBuf, &len);
+		if ( !bRtn )
+		{
+			Error_Log(LEVEL_ERROR, "No memory: %s\n", strerror(errno));
+			break;
+		}
+
+		pdev->dm.dmOutPages++;
+		TSPL_SendPageStart(pdev->penc);
+		TSPL_SendCommands(pdev->penc, pBuf, len);
+		TSPL_SendPageEnd(pdev->penc);
+		nLabels++;
+	}
+
+	// The job setup is undone even when no label went out
+	if ( bStarted && !TSPL_SendJobEnd(pdev->penc) )
+		bRtn = FALSE;
+	Metrics_Time(METRIC_US_OUTPUT, llStart);
+	Metrics_Set(METRIC_PAGES, nLabels);
+	DebugPrintf("TemplateJob: %d labels from %s\n", nLabels, szTemplate);
+
+	fclose(fp);
+	free(pBuf);
+	free(rec.szLine);
+	MEMFREE(rec.szHeader);
+	FreeTemplate(&tpl);
+
+	return !(bRtn && nLabels > 0);
+}
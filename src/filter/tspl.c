@@ -39,41 +39,152 @@
 #define	TSPL_SET_CUTTER				"SET CUTTER %s\r\n"
 #define	TSPL_SET_PARTIAL_CUTTER		"SET PARTIAL_CUTTER %s\r\n"
 
-static size_t printer_write(const void* pbuf, size_t cbbuf);
-static size_t printer_puts(const char* str);
-static int printer_printf(const char* strfmt, ...);
+struct _TSPLENC
+{
+	const DEVMODE	*pdm;
+	TSPLENC_SINK	pfnSink;
+	void			*pContext;
+	FILE			*fpCopies;			// Encoded pages of a collated job, replayed for the remaining copies
+	BOOL			bSpoolError;		// Part of a page did not reach fpCopies
+	BOOL			bSinkError;			// The sink took less than it was given
+	BOOL			bCollate;			// Every label printed once, copies are pages again
+	DWORD			dwOutPages;
+	TSPLENC_STATS	stats;
+};
+
+static size_t sink_write(TSPLENC *penc, const void* pbuf, size_t cbbuf);
+static size_t printer_write(TSPLENC *penc, const void* pbuf, size_t cbbuf);
+static size_t printer_puts(TSPLENC *penc, const char* str);
+static int printer_printf(TSPLENC *penc, const char* strfmt, ...);
+static int sink_status(const TSPLENC *penc);
+
+static int TSPL_SendUserCommand(TSPLENC *penc, DWORD dwField);
+static FILE* TSPL_OpenCopiesSpool(void);
+static void TSPL_SendCopies(TSPLENC *penc);
+
+int TSPL_EncoderVersion(void)
+{
+	return TSPLENC_VERSION;
+}
+
+TSPLENC* TSPL_OpenEncoder(const DEVMODE *pdm, TSPLENC_SINK pfnSink, void *pContext)
+{
+	TSPLENC		*penc;
+
+	if ( pdm == NULL || pfnSink == NULL )
+		return NULL;
+
+	if ( (penc = MEMALLOC(sizeof(TSPLENC))) != NULL )
+	{
+		memset(penc, 0, sizeof(TSPLENC));
+		penc->pdm = pdm;
+		penc->pfnSink = pfnSink;
+		penc->pContext = pContext;
+	}
+	return penc;
+}
+
+// A job not ended drops its copies spool, nothing more is sent
+void TSPL_CloseEncoder(TSPLENC *penc)
+{
+	if ( penc == NULL )
+		return;
+
+	if ( penc->fpCopies )
+		fclose(penc->fpCopies);
+	MEMFREE(penc);
+}
+
+void TSPL_EncoderStats(const TSPLENC *penc, TSPLENC_STATS *pStats)
+{
+	*pStats = penc->stats;
+}
+
+// The registry defaults, with no dmFields flag but the label's
+DEVMODE* TSPL_CreateDevmode(float fWidth, float fLength, int nDpi)
+{
+	DEVMODE		*pdm;
+	int			i;
+
+	if ( fWidth <= 0 || fLength <= 0 || nDpi <= 0 || (pdm = MEMALLOC(sizeof(DEVMODE))) == NULL )
+		return NULL;
+
+	for (i=0; i<g_tsc_options_num; i++)
+	{
+		if ( g_tsc_options[i].parse == NULL && g_tsc_options[i].type != OPTTYPE_COMMAND )
+			SetOptionValue(&g_tsc_options[i], pdm, NULL);
+	}
+
+	pdm->dmType = DM_HEADER_MARKER;
+	pdm->dmSize = sizeof(DEVMODE);
+	pdm->dmFields = DM_PAPERLENGTH | DM_PAPERWIDTH | DM_PRINTQUALITY | DM_YRESOLUTION | DM_COPIES;
+	pdm->dmPaperWidth = fWidth;
+	pdm->dmPaperLength = fLength;
+	pdm->dmPrintQuality = pdm->dmXResolution = pdm->dmYResolution = nDpi;
+	pdm->dmCopies = 1;
+	pdm->dmDocPages = 1;
+	return pdm;
+}
+
+// Page sizes, resolutions, units and user commands come with the PPD
+int TSPL_SetDevmodeOption(DEVMODE *pdm, const char *szName, const char *szValue)
+{
+	const TSC_OPTION_NAME_T	*pOpt;
+
+	if ( szName == NULL || szValue == NULL || (pOpt = GetOptionTypeByName((char *)szName)) == NULL
+		|| pOpt->parse || pOpt->type == OPTTYPE_NONE || pOpt->type == OPTTYPE_COMMAND )
+		return 0;
+
+	return SetOptionValue(pOpt, pdm, szValue) ? 1 : 0;
+}
+
+void TSPL_SetDevmodeCopies(DEVMODE *pdm, int nCopies, int nPages, int bCollate)
+{
+	pdm->dmCopies = nCopies > 0 ? nCopies : 1;
+	pdm->dmDocPages = nPages > 0 ? nPages : 1;
+	pdm->dmCollate = (bCollate && pdm->dmDocPages > 1);
+}
+
+void TSPL_FreeDevmode(DEVMODE *pdm)
+{
+	MEMFREE(pdm);
+}
 
-static int TSPL_SendBitmap1bpp(DEVMODE *pdm, BITMAPINFOHEADER* pBih, void* pBits);
-static int TSPL_SendUserCommand(DEVMODE *pdm, DWORD dwField);
+// BAR of bars.c
+void TSPL_AddSaved(TSPLENC *penc, size_t cbSaved)
+{
+	penc->stats.llSaved += cbSaved;
+}
 
-int TSPL_SendJobStart(DEVMODE *pdm)
+int TSPL_SendJobStart(TSPLENC *penc)
 {
+	const DEVMODE	*pdm = penc->pdm;
+
+	penc->bCollate = pdm->dmCollate;
+
 	// Set User Command - Start Job
-	TSPL_SendUserCommand(pdm, DM_CMDSTARTJOB);
+	TSPL_SendUserCommand(penc, DM_CMDSTARTJOB);
 
 	// Set Lable Size
-	if ( pdm->dmMetric == DMMETRIC_INCH )
-		printer_printf("SIZE %.3f,%.3f\r\n", POINT2INCH(pdm->dmPaperWidth), POINT2INCH(pdm->dmPaperLength));
-	else
-		printer_printf("SIZE %.1f mm,%.1f mm\r\n", POINT2MM(pdm->dmPaperWidth), POINT2MM(pdm->dmPaperLength));
+	TSPL_SendSize(penc);
 
 	// Set Gap
 	switch ( pdm->dmMediaType )
 	{
 	case DMMEDIATYPE_GAPS:			// Label with Gaps
 		if ( pdm->dmMetric == DMMETRIC_INCH )
-			printer_printf("GAP %.3f,%.3f\r\n", POINT2INCH(pdm->dmGapHeight), POINT2INCH(pdm->dmGapOffset));
+			printer_printf(penc, "GAP %.3f,%.3f\r\n", POINT2INCH(pdm->dmGapHeight), POINT2INCH(pdm->dmGapOffset));
 		else
-			printer_printf("GAP %.1f mm,%.1f mm\r\n", POINT2MM(pdm->dmGapHeight), POINT2MM(pdm->dmGapOffset));
+			printer_printf(penc, "GAP %.1f mm,%.1f mm\r\n", POINT2MM(pdm->dmGapHeight), POINT2MM(pdm->dmGapOffset));
 		break;
 	case DMMEDIATYPE_MARK:			// Label with Mark
 		if ( pdm->dmMetric == DMMETRIC_INCH )
-			printer_printf("BLINE %.3f,%.3f\r\n", POINT2INCH(pdm->dmGapHeight), POINT2INCH(pdm->dmGapOffset));
+			printer_printf(penc, "BLINE %.3f,%.3f\r\n", POINT2INCH(pdm->dmGapHeight), POINT2INCH(pdm->dmGapOffset));
 		else
-			printer_printf("BLINE %.1f mm,%.1f mm\r\n", POINT2MM(pdm->dmGapHeight), POINT2MM(pdm->dmGapOffset));
+			printer_printf(penc, "BLINE %.1f mm,%.1f mm\r\n", POINT2MM(pdm->dmGapHeight), POINT2MM(pdm->dmGapOffset));
 		break;
 	case DMMEDIATYPE_CONTINUE:		// Continue
-		printer_printf("GAP 0,0\r\n");
+		printer_printf(penc, "GAP 0,0\r\n");
 		break;
 	}
 
@@ -81,24 +192,24 @@ int TSPL_SendJobStart(DEVMODE *pdm)
 	if ( pdm->dmFields & DM_PRINTSPEED )
 	{
 		if ( pdm->dmPrintSpeed % 10 )
-			printer_printf("SPEED %d.%d\r\n", pdm->dmPrintSpeed / 10, pdm->dmPrintSpeed % 10);
+			printer_printf(penc, "SPEED %d.%d\r\n", pdm->dmPrintSpeed / 10, pdm->dmPrintSpeed % 10);
 		else
-			printer_printf("SPEED %d\r\n", pdm->dmPrintSpeed / 10);
+			printer_printf(penc, "SPEED %d\r\n", pdm->dmPrintSpeed / 10);
 	}
 
 	// Set Density
 	if ( pdm->dmFields & DM_DARKNESS )
-		printer_printf("DENSITY %d\r\n", pdm->dmDarkness);
+		printer_printf(penc, "DENSITY %d\r\n", pdm->dmDarkness);
 
 // [0002] Li Add Start
 	// Set Ribbon
 	switch ( pdm->dmMediaMethod )
 	{
 	case DMMEDIAMETHOD_DIRECT:
-		printer_puts("SET RIBBON OFF\r\n");
+		printer_puts(penc, "SET RIBBON OFF\r\n");
 		break;
 	case DMMEDIAMETHOD_TRANSFER:
-		printer_puts("SET RIBBON ON\r\n");
+		printer_puts(penc, "SET RIBBON ON\r\n");
 		break;
 	}
 // [0002] Li Add End
@@ -111,22 +222,22 @@ int TSPL_SendJobStart(DEVMODE *pdm)
 		if ( pdm->dmFields & DM_MIRRORIMAGE )
 			m = pdm->dmMirrorImage;
 
-		printer_printf("DIRECTION %d,%d\r\n", n, m);
+		printer_printf(penc, "DIRECTION %d,%d\r\n", n, m);
 	}
 
 	// Set Reference
-	printer_printf("REFERENCE %.0f,%.0f\r\n",
+	printer_printf(penc, "REFERENCE %.0f,%.0f\r\n",
 					POINT2DOT((double)pdm->dmAdjustHorizontal, pdm->dmPrintQuality),
 					POINT2DOT((double)pdm->dmAdjustVertical, pdm->dmYResolution));
 
 	// Set Offset
 	if ( pdm->dmMetric == DMMETRIC_INCH )
-		printer_printf("OFFSET %.3f\r\n", POINT2INCH(pdm->dmFeedOffset));
+		printer_printf(penc, "OFFSET %.3f\r\n", POINT2INCH(pdm->dmFeedOffset));
 	else
-		printer_printf("OFFSET %.1f mm\r\n", POINT2MM(pdm->dmFeedOffset));
+		printer_printf(penc, "OFFSET %.1f mm\r\n", POINT2MM(pdm->dmFeedOffset));
 
 	// Set Shift
-	printer_printf("SHIFT %.0f\r\n", POINT2DOT((double)pdm->dmVerticalOffset, pdm->dmYResolution));
+	printer_printf(penc, "SHIFT %.0f\r\n", POINT2DOT((double)pdm->dmVerticalOffset, pdm->dmYResolution));
 
 	// Set Action;
 #if 1
@@ -173,10 +284,10 @@ int TSPL_SendJobStart(DEVMODE *pdm)
 			break;
 		}
 // [0002] Li Delete Start
-//		printer_printf(TSPL_SET_TEAR, szTear);
-//		printer_printf(TSPL_SET_PEEL, szPeel);
-//		printer_printf(TSPL_SET_CUTTER, szCut);
-//		printer_printf(TSPL_SET_PARTIAL_CUTTER, szPartCut);
+//		printer_printf(penc, TSPL_SET_TEAR, szTear);
+//		printer_printf(penc, TSPL_SET_PEEL, szPeel);
+//		printer_printf(penc, TSPL_SET_CUTTER, szCut);
+//		printer_printf(penc, TSPL_SET_PARTIAL_CUTTER, szPartCut);
 // [0002] Li Delete End
 // [0002] Li Add Start
 		{
@@ -191,14 +302,14 @@ int TSPL_SendJobStart(DEVMODE *pdm)
 			{
 				if ( szCmds[i][1] == szOFF )
 				{
-					printer_printf(szCmds[i][0], szCmds[i][1]);
+					printer_printf(penc, szCmds[i][0], szCmds[i][1]);
 				}
 			}
 			for ( i=0; i<ARRAYCOUNT(szCmds); i++)
 			{
 				if ( szCmds[i][1] != szOFF )
 				{
-					printer_printf(szCmds[i][0], szCmds[i][1]);
+					printer_printf(penc, szCmds[i][0], szCmds[i][1]);
 				}
 			}
 		}
@@ -210,49 +321,49 @@ int TSPL_SendJobStart(DEVMODE *pdm)
 	switch ( pdm->dmPostAction )
 	{
 	case DMPOSTACTION_NONE:			// None
-		printer_puts("SET TEAR OFF\r\n");
-		printer_puts("SET PEEL OFF\r\n");
-		printer_puts("SET CUTTER OFF\r\n");
-		printer_puts("SET PARTIAL_CUTTER OFF\r\n");
+		printer_puts(penc, "SET TEAR OFF\r\n");
+		printer_puts(penc, "SET PEEL OFF\r\n");
+		printer_puts(penc, "SET CUTTER OFF\r\n");
+		printer_puts(penc, "SET PARTIAL_CUTTER OFF\r\n");
 		break;
 	case DMPOSTACTION_TEAROFF:		// Tear Off
-		printer_puts("SET TEAR ON\r\n");
-		printer_puts("SET PEEL OFF\r\n");
-		printer_puts("SET CUTTER OFF\r\n");
-		printer_puts("SET PARTIAL_CUTTER OFF\r\n");
+		printer_puts(penc, "SET TEAR ON\r\n");
+		printer_puts(penc, "SET PEEL OFF\r\n");
+		printer_puts(penc, "SET CUTTER OFF\r\n");
+		printer_puts(penc, "SET PARTIAL_CUTTER OFF\r\n");
 		break;
 	case DMPOSTACTION_PEELOFF:		// Peel Off
-		printer_puts("SET TEAR OFF\r\n");
-		printer_puts("SET PEEL ON\r\n");
-		printer_puts("SET CUTTER OFF\r\n");
-		printer_puts("SET PARTIAL_CUTTER OFF\r\n");
+		printer_puts(penc, "SET TEAR OFF\r\n");
+		printer_puts(penc, "SET PEEL ON\r\n");
+		printer_puts(penc, "SET CUTTER OFF\r\n");
+		printer_puts(penc, "SET PARTIAL_CUTTER OFF\r\n");
 		break;
 	case DMPOSTACTION_CUT:			// Cut
 		switch ( pdm->dmOccurrence )
 		{
 		case DMOCCURRENCE_EVERY:		// After Every Page
-			printer_puts("SET TEAR OFF\r\n");
-			printer_puts("SET PEEL OFF\r\n");
-			printer_puts("SET CUTTER 1\r\n");
-			printer_puts("SET PARTIAL_CUTTER OFF\r\n");
+			printer_puts(penc, "SET TEAR OFF\r\n");
+			printer_puts(penc, "SET PEEL OFF\r\n");
+			printer_puts(penc, "SET CUTTER 1\r\n");
+			printer_puts(penc, "SET PARTIAL_CUTTER OFF\r\n");
 			break;
 		case DMOCCURRENCE_COPIES:		// After Identical Copies
-			printer_puts("SET TEAR OFF\r\n");
-			printer_puts("SET PEEL OFF\r\n");
-			printer_printf("SET CUTTER %d\r\n", pdm->dmCopies);
-			printer_puts("SET PARTIAL_CUTTER OFF\r\n");
+			printer_puts(penc, "SET TEAR OFF\r\n");
+			printer_puts(penc, "SET PEEL OFF\r\n");
+			printer_printf(penc, "SET CUTTER %d\r\n", pdm->dmCopies);
+			printer_puts(penc, "SET PARTIAL_CUTTER OFF\r\n");
 			break;
 		case DMOCCURRENCE_JOB:			// After Job
-			printer_puts("SET TEAR OFF\r\n");
-			printer_puts("SET PEEL OFF\r\n");
-			printer_printf("SET CUTTER %d\r\n", pdm->dmCopies * pdm->dmDocPages);
-			printer_puts("SET PARTIAL_CUTTER OFF\r\n");
+			printer_puts(penc, "SET TEAR OFF\r\n");
+			printer_puts(penc, "SET PEEL OFF\r\n");
+			printer_printf(penc, "SET CUTTER %d\r\n", pdm->dmCopies * pdm->dmDocPages);
+			printer_puts(penc, "SET PARTIAL_CUTTER OFF\r\n");
 			break;
 		case DMOCCURRENCE_SPECIFIED:	// After Specified interval
-			printer_puts("SET TEAR OFF\r\n");
-			printer_puts("SET PEEL OFF\r\n");
-			printer_printf("SET CUTTER %d\r\n", pdm->dmCutInterval);
-			printer_puts("SET PARTIAL_CUTTER OFF\r\n");
+			printer_puts(penc, "SET TEAR OFF\r\n");
+			printer_puts(penc, "SET PEEL OFF\r\n");
+			printer_printf(penc, "SET CUTTER %d\r\n", pdm->dmCutInterval);
+			printer_puts(penc, "SET PARTIAL_CUTTER OFF\r\n");
 			break;
 		}
 		break;
@@ -260,28 +371,28 @@ int TSPL_SendJobStart(DEVMODE *pdm)
 		switch ( pdm->dmOccurrence )
 		{
 		case DMOCCURRENCE_EVERY:		// After Every Page
-			printer_puts("SET TEAR OFF\r\n");
-			printer_puts("SET PEEL OFF\r\n");
-			printer_puts("SET CUTTER OFF\r\n");
-			printer_puts("SET PARTIAL_CUTTER 1\r\n");
+			printer_puts(penc, "SET TEAR OFF\r\n");
+			printer_puts(penc, "SET PEEL OFF\r\n");
+			printer_puts(penc, "SET CUTTER OFF\r\n");
+			printer_puts(penc, "SET PARTIAL_CUTTER 1\r\n");
 			break;
 		case DMOCCURRENCE_COPIES:		// After Identical Copies
-			printer_puts("SET TEAR OFF\r\n");
-			printer_puts("SET PEEL OFF\r\n");
-			printer_puts("SET CUTTER OFF\r\n");
-			printer_printf("SET PARTIAL_CUTTER %d\r\n", pdm->dmCopies);
+			printer_puts(penc, "SET TEAR OFF\r\n");
+			printer_puts(penc, "SET PEEL OFF\r\n");
+			printer_puts(penc, "SET CUTTER OFF\r\n");
+			printer_printf(penc, "SET PARTIAL_CUTTER %d\r\n", pdm->dmCopies);
 			break;
 		case DMOCCURRENCE_JOB:			// After Job
-			printer_puts("SET TEAR OFF\r\n");
-			printer_puts("SET PEEL OFF\r\n");
-			printer_puts("SET CUTTER OFF\r\n");
-			printer_printf("SET PARTIAL_CUTTER %d\r\n", pdm->dmCopies * pdm->dmDocPages);
+			printer_puts(penc, "SET TEAR OFF\r\n");
+			printer_puts(penc, "SET PEEL OFF\r\n");
+			printer_puts(penc, "SET CUTTER OFF\r\n");
+			printer_printf(penc, "SET PARTIAL_CUTTER %d\r\n", pdm->dmCopies * pdm->dmDocPages);
 			break;
 		case DMOCCURRENCE_SPECIFIED:	// After Specified interval
-			printer_puts("SET TEAR OFF\r\n");
-			printer_puts("SET PEEL OFF\r\n");
-			printer_puts("SET CUTTER OFF\r\n");
-			printer_printf("SET PARTIAL_CUTTER %d\r\n", pdm->dmCutInterval);
+			printer_puts(penc, "SET TEAR OFF\r\n");
+			printer_puts(penc, "SET PEEL OFF\r\n");
+			printer_puts(penc, "SET CUTTER OFF\r\n");
+			printer_printf(penc, "SET PARTIAL_CUTTER %d\r\n", pdm->dmCutInterval);
 			break;
 		}
 		break;
@@ -293,102 +404,205 @@ int TSPL_SendJobStart(DEVMODE *pdm)
 //	switch ( pdm->dmMediaMethod )
 //	{
 //	case DMMEDIAMETHOD_DIRECT:
-//		printer_puts("SET RIBBON OFF\r\n");
+//		printer_puts(penc, "SET RIBBON OFF\r\n");
 //		break;
 //	case DMMEDIAMETHOD_TRANSFER:
-//		printer_puts("SET RIBBON ON\r\n");
+//		printer_puts(penc, "SET RIBBON ON\r\n");
 //		break;
 //	}
 // [0002] Li Delete End
+
+	return sink_status(penc);
+}
+
+// Also per label when the length follows the content
+int TSPL_SendSize(TSPLENC *penc)
+{
+	const DEVMODE	*pdm = penc->pdm;
+
+	if ( pdm->dmMetric == DMMETRIC_INCH )
+		printer_printf(penc, "SIZE %.3f,%.3f\r\n", POINT2INCH(pdm->dmPaperWidth), POINT2INCH(pdm->dmPaperLength));
+	else
+		printer_printf(penc, "SIZE %.1f mm,%.1f mm\r\n", POINT2MM(pdm->dmPaperWidth), POINT2MM(pdm->dmPaperLength));
+
+	return sink_status(penc);
 }
 
-int TSPL_SendJobEnd(DEVMODE *pdm)
+int TSPL_SendJobEnd(TSPLENC *penc)
 {
+	int		iRtn = 1;
+
+	// Collated copies, never from a partial spool
+	if ( penc->fpCopies )
+	{
+		if ( penc->bSpoolError || fflush(penc->fpCopies) != 0 || ferror(penc->fpCopies) )
+		{
+			Error_Log(LEVEL_ERROR, "Unable to spool the collated copies, only 1 of %d copies was sent\n", penc->pdm->dmCopies);
+			iRtn = 0;
+		}
+		else
+			TSPL_SendCopies(penc);
+		fclose(penc->fpCopies);
+		penc->fpCopies = NULL;
+	}
+
 	// Set User Command - End Job
-	TSPL_SendUserCommand(pdm, DM_CMDENDJOB);
+	TSPL_SendUserCommand(penc, DM_CMDENDJOB);
+
+	return iRtn && sink_status(penc);
 }
 
-int TSPL_SendPageStart(DEVMODE *pdm)
+int TSPL_SendPageStart(TSPLENC *penc)
 {
 	// Cls
-	printer_puts("CLS\r\n");
+	printer_puts(penc, "CLS\r\n");
 
 	// Set User Command - Start Label
-	TSPL_SendUserCommand(pdm, DM_CMDSTARTLABEL);
+	return TSPL_SendUserCommand(penc, DM_CMDSTARTLABEL);
 }
 
-int TSPL_SendPageEnd(DEVMODE *pdm)
+int TSPL_SendPageEnd(TSPLENC *penc)
 {
+	const DEVMODE	*pdm = penc->pdm;
+
 	// REVERSE
 	if( (pdm->dmFields & DM_NEGATIVEIMAGE) && (pdm->dmNegativeImage != DMNEGATIVEIMAGE_OFF))
 	{
-		printer_printf("REVERSE 0,0,%.0f,%.0f\r\n",
+		printer_printf(penc, "REVERSE 0,0,%.0f,%.0f\r\n",
 						POINT2DOT(pdm->dmPaperWidth, pdm->dmPrintQuality),
 						POINT2DOT(pdm->dmPaperLength, pdm->dmYResolution));
 	}
 
 	// PRINT
-	printer_printf("PRINT %d,%d\r\n", 1, pdm->dmCollate ? 1 : pdm->dmCopies);
+	printer_printf(penc, "PRINT %d,%d\r\n", 1, penc->bCollate ? 1 : pdm->dmCopies);
 	
 	// Set User Command - End Label
-	TSPL_SendUserCommand(pdm, DM_CMDENDLABEL);
+	return TSPL_SendUserCommand(penc, DM_CMDENDLABEL);
 }
 
-int TSPL_SendPage(DEVMODE *pdm, BITMAPINFOHEADER* pBih, RGBQUAD *pColorTable, void* pBits)
+int TSPL_SendPage(TSPLENC *penc, BITMAPINFOHEADER* pBih, RGBQUAD *pColorTable, void* pBits)
 {
+	DWORD	cbWidthBytes = WIDTHBYTES_32(pBih->biWidth);
+	LONG	y;
+
 	DebugPrintf("Enter TSPL_SendPage\n");
 
-	if ( pdm->dmOutPages == 0 )
+	TSPL_SendPageBegin(penc, pBih);
+	for(y=0; y<pBih->biHeight; y++)
 	{
-		TSPL_SendJobStart(pdm);
+		TSPL_SendPageRow(penc, pBih, (LPBYTE)pBits + cbWidthBytes * y);
 	}
-	pdm->dmOutPages ++;
-	TSPL_SendPageStart(pdm);
+	TSPL_SendPageFinish(penc, pBih);
 
-	switch( pBih->biBitCount )
+	return sink_status(penc);
+}
+
+// Page header and BITMAP command for a top-down bitmap of pBih->biHeight
+// rows, which are then sent one by one with TSPL_SendPageRow()
+int TSPL_SendPageBegin(TSPLENC *penc, BITMAPINFOHEADER* pBih)
+{
+	if ( penc->dwOutPages == 0 )
 	{
-	case 1:
-		TSPL_SendBitmap1bpp(pdm, pBih, pBits);
-		break;
-	case 8:
-		break;
+		TSPL_SendJobStart(penc);
+
+		// Keep the encoded pages of a collated job, the other copies
+		// are replayed from them instead of rendering every page again
+		if ( penc->bCollate && penc->pdm->dmCopies > 1 )
+		{
+			if ( (penc->fpCopies = TSPL_OpenCopiesSpool()) == NULL )
+			{
+				Error_Log(LEVEL_WARNING, "Unable to create copies spool file: %s, print copies uncollated\n", strerror(errno));
+				penc->bCollate = FALSE;
+			}
+		}
 	}
+	penc->dwOutPages ++;
+	TSPL_SendPageStart(penc);
 
-	TSPL_SendPageEnd(pdm);
+	if ( pBih->biBitCount == 1 )
+	{
+		int		ix = 0;									// x-coordinate
+		int		iy = 0;									// y-coordinate
+		int		iWidth = WIDTHBYTES_8(pBih->biWidth);	// The width of the image in bytes
+		int		iHeight = pBih->biHeight;				// The height of the image in dot
 
-	return 1;
+		printer_printf(penc, "BITMAP %d,%d,%d,%d,%d,", ix, iy, iWidth, iHeight, DRAWMODE_OR);
+	}
+
+	return sink_status(penc);
 }
 
-int TSPL_SendBitmap1bpp(DEVMODE *pdm, BITMAPINFOHEADER* pBih, void* pBits)
+// One scanline of the page. TSPL draws 0 bits, so the row is inverted
+// through a buffer of ours, the caller's bitmap is left as it is
+int TSPL_SendPageRow(TSPLENC *penc, BITMAPINFOHEADER* pBih, void* pRow)
 {
-	int		ix = 0;									// x-coordinate
-	int		iy = 0;									// y-coordinate
-	int		iWidth = WIDTHBYTES_8(pBih->biWidth);	// The width of the image in bytes
-	int		iHeight = pBih->biHeight;				// The height of the image in dot
-	int		x, y;
-	DWORD	cbWidthBytes = WIDTHBYTES_32(pBih->biWidth);
-	BYTE*	pBitsLine;
+	int		iWidth = WIDTHBYTES_8(pBih->biWidth);
+	LPBYTE	pBitsLine = pRow;
+	BYTE	bLine[512];
+	int		cb;
+	int		x;
 
-	pBitsLine = MEMALLOC(iWidth);
-	if ( pBitsLine )
+	if ( pBih->biBitCount == 1 )
 	{
-		printer_printf("BITMAP %d,%d,%d,%d,%d,", ix, iy, iWidth, iHeight, DRAWMODE_OR);
-	
-		for(y=0; y<pBih->biHeight; y++)
+		for ( ; iWidth > 0; iWidth -= cb, pBitsLine += cb)
 		{
-			memcpy(pBitsLine, pBits + cbWidthBytes * y, iWidth);
-			for (x=0; x<iWidth; x++)
-				pBitsLine[x] = ~pBitsLine[x];
-			printer_write(pBitsLine, iWidth);
+			cb = iWidth < (int)sizeof(bLine) ? iWidth : (int)sizeof(bLine);
+			for (x=0; x<cb; x++)
+				bLine[x] = ~pBitsLine[x];
+			printer_write(penc, bLine, cb);
 		}
-		printer_printf("\r\n");
-		MEMFREE(pBitsLine);
 	}
-	return 1;
+
+	return sink_status(penc);
+}
+
+int TSPL_SendPageFinish(TSPLENC *penc, BITMAPINFOHEADER* pBih)
+{
+	if ( pBih->biBitCount == 1 )
+	{
+		printer_puts(penc, "\r\n");
+	}
+
+	TSPL_SendPageEnd(penc);
+
+	return sink_status(penc);
 }
 
-int TSPL_SendUserCommand(DEVMODE *pdm, DWORD dwField)
+// Ends the BITMAP data of a label that could not be read in full and
+// clears the image buffer instead of printing it
+int TSPL_SendPageAbort(TSPLENC *penc, BITMAPINFOHEADER* pBih)
 {
+	if ( pBih->biBitCount == 1 )
+	{
+		printer_puts(penc, "\r\n");
+	}
+
+	printer_puts(penc, "CLS\r\n");
+
+	return sink_status(penc);
+}
+
+// Stores a file in printer memory, for PUTBMP and the like
+int TSPL_SendDownload(TSPLENC *penc, const char *szName, const void *pData, DWORD cbData)
+{
+	printer_printf(penc, "DOWNLOAD \"%s\",%u,", szName, cbData);
+	printer_write(penc, pData, cbData);
+	printer_puts(penc, "\r\n");
+
+	return sink_status(penc);
+}
+
+// Commands of a label, already terminated by CR LF, in one write
+int TSPL_SendCommands(TSPLENC *penc, const char *szCmds, DWORD cbCmds)
+{
+	printer_write(penc, szCmds, cbCmds);
+
+	return sink_status(penc);
+}
+
+int TSPL_SendUserCommand(TSPLENC *penc, DWORD dwField)
+{
+	const DEVMODE	*pdm = penc->pdm;
 	WORD	wLength = 0;
 	LPBYTE	pCmdDat = NULL;
 
@@ -417,17 +631,106 @@ int TSPL_SendUserCommand(DEVMODE *pdm, DWORD dwField)
 
 	if ( pCmdDat && wLength > 0 )
 	{
-		printer_write(pCmdDat, wLength);
+		printer_write(penc, pCmdDat, wLength);
 	}
+
+	return sink_status(penc);
 }
 
-size_t printer_write(const void* pbuf, size_t cbbuf)
+FILE* TSPL_OpenCopiesSpool(void)
+{
+	FILE		*fp = NULL;
+	const char	*tmpdir;
+	char		filename[1024];
+	int			fd;
+
+	if ( (tmpdir = getenv("TMPDIR")) == NULL )
+		tmpdir = "/tmp";
+
+	snprintf(filename, sizeof(filename), "%s/tsplXXXXXX", tmpdir);
+	if ( (fd = mkstemp(filename)) >= 0 )
+	{
+		// Nobody else needs the file, it goes away with the descriptor
+		unlink(filename);
+
+		if ( (fp = fdopen(fd, "w+")) == NULL )
+			close(fd);
+	}
+
+	return fp;
+}
+
+void TSPL_SendCopies(TSPLENC *penc)
+{
+	char	buffer[65536];
+	size_t	nbytes;
+	int		copies;
+
+	fflush(penc->fpCopies);
+
+	DebugPrintf("TSPL_SendCopies: %d copies of %ld bytes\n", penc->pdm->dmCopies - 1, ftell(penc->fpCopies));
+
+	for ( copies=1; copies<penc->pdm->dmCopies; copies++ )
+	{
+		if ( fseek(penc->fpCopies, 0, SEEK_SET) < 0 )
+		{
+			Error_Log(LEVEL_ERROR, "Unable to rewind copies spool file: %s\n", strerror(errno));
+			break;
+		}
+
+		while ( (nbytes = fread(buffer, 1, sizeof(buffer), penc->fpCopies)) > 0 )
+		{
+			if ( sink_write(penc, buffer, nbytes) != nbytes )
+			{
+				Error_Log(LEVEL_ERROR, "Unable to send copy %d of %d, the rest are not sent\n", copies + 1, penc->pdm->dmCopies);
+				return;
+			}
+		}
+	}
+}
+
+// Until all of it is taken, a sink may take part of it. Returns less than
+// cbbuf when the sink fails.
+size_t sink_write(TSPLENC *penc, const void* pbuf, size_t cbbuf)
+{
+	size_t	done = 0;
+	size_t	n;
+
+	while ( done < cbbuf )
+	{
+		n = penc->pfnSink(penc->pContext, (const BYTE *)pbuf + done, cbbuf - done);
+		penc->stats.llWrites ++;
+		if ( n == 0 || n > cbbuf - done )
+			break;
+		done += n;
+	}
+	penc->stats.llOutput += done;
+	if ( done < cbbuf )
+		penc->bSinkError = TRUE;
+	return done;
+}
+
+// 1 until the sink fails, the encoder then stays failed
+int sink_status(const TSPLENC *penc)
+{
+	return penc->bSinkError ? 0 : 1;
+}
+
+size_t printer_write(TSPLENC *penc, const void* pbuf, size_t cbbuf)
 {
 //	DebugPrintf("printer_write %d bytes\n", cbbuf);
-	return write(fileno(stdout), pbuf, cbbuf);
+	if ( penc->fpCopies && !penc->bSpoolError )
+	{
+		if ( fwrite(pbuf, 1, cbbuf, penc->fpCopies) == cbbuf )
+			penc->stats.llSpooled += cbbuf;
+		else
+			penc->bSpoolError = TRUE;
+	}
+
+	return sink_write(penc, pbuf, cbbuf);
 }
 
-int printer_printf(const char* strfmt, ...)
+int printer_printf(TSPLENC *penc, const char* strfmt, ...)
 {
 	int		iRtn = -1;
 	int		size = 128;
@@ -459,14 +762,14 @@ int printer_printf(const char* strfmt, ...)
 
 	if ( p )
 	{
-		iRtn = printer_write(p, iRtn);
+		iRtn = printer_write(penc, p, iRtn);
 		MEMFREE(p);
 	}
 
 	return iRtn;
 }
 
-size_t printer_puts(const char* str)
+size_t printer_puts(TSPLENC *penc, const char* str)
 {
-	return printer_write(str, strlen(str));
+	return printer_write(penc, str, strlen(str));
 }
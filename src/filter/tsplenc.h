@@ -0,0 +1,141 @@
+/*
+ * "tsplenc.h 2021-05-17 15:55:05
+ *
+ *  TSPL encoder declaration for TSC Printer Driver
+ *
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef _TSPLENC_H_
+#define _TSPLENC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// libtsplenc, the TSPL of a job from its DEVMODE and its labels. All an
+// encoder keeps is in its TSPLENC and the output goes to the caller's
+// sink, so encoders of different jobs may run on different threads. One
+// encoder is used by one thread at a time. Installed with this header,
+// link with -ltsplenc -lpthread.
+#define TSPLENC_VERSION			4		// Bumped when a declaration below changes
+
+#define DIB_HEADER_MARKER   ((uint16_t) ('M' << 8) | 'B')
+
+// The fixed size types of the driver's WORD, DWORD and LONG, so the header
+// stands on its own
+#pragma pack(2)
+typedef struct tagBITMAPFILEHEADER {
+	uint16_t	bfType;
+	uint32_t	bfSize;
+	uint16_t	bfReserved1;
+	uint16_t	bfReserved2;
+	uint32_t	bfOffBits;
+} BITMAPFILEHEADER, *PBITMAPFILEHEADER;
+
+typedef struct tagBITMAPINFOHEADER{
+	uint32_t	biSize;
+	int32_t		biWidth;
+	int32_t		biHeight;
+	uint16_t	biPlanes;
+	uint16_t	biBitCount;
+	uint32_t	biCompression;
+	uint32_t	biSizeImage;
+	int32_t		biXPelsPerMeter;
+	int32_t		biYPelsPerMeter;
+	uint32_t	biClrUsed;
+	uint32_t	biClrImportant;
+} BITMAPINFOHEADER, *PBITMAPINFOHEADER;
+
+typedef struct tagRGBQUAD {
+	uint8_t		rgbBlue;
+	uint8_t		rgbGreen;
+	uint8_t		rgbRed;
+	uint8_t		rgbReserved;
+} RGBQUAD, *PRGBQUAD;
+#pragma pack()
+
+// The job settings, only the driver sees the layout
+#ifndef _DEVMODE_DECLARED_
+#define _DEVMODE_DECLARED_
+typedef struct _DEVMODE DEVMODE;
+#endif
+
+// Takes up to cbData bytes of TSPL, returns the bytes taken and 0 on an
+// error. What is left is offered again.
+typedef size_t (*TSPLENC_SINK)(void *pContext, const void *pData, size_t cbData);
+
+typedef struct _TSPLENC TSPLENC;
+
+typedef struct _TSPLENC_STATS
+{
+	long long		llOutput;				// Bytes to the sink
+	long long		llWrites;				// Sink calls
+	long long		llSpooled;				// Kept to replay collated copies
+	long long		llSaved;				// Not sent thanks to BAR
+} TSPLENC_STATS;
+
+int TSPL_EncoderVersion(void);
+
+// A DEVMODE for a label of fWidth by fLength points at nDpi, one copy. The
+// options are those of the driver's PPDs with their choices, for instance
+// TSPL_SetDevmodeOption(pdm, "Darkness", "10"); lengths are in points.
+// Those not set keep the driver's default and leave the printer's own
+// SPEED, DENSITY and DIRECTION alone. Returns 0 for an option that is not
+// the driver's or needs its PPD.
+DEVMODE* TSPL_CreateDevmode(float fWidth, float fLength, int nDpi);
+int TSPL_SetDevmodeOption(DEVMODE *pdm, const char *szName, const char *szValue);
+void TSPL_SetDevmodeCopies(DEVMODE *pdm, int nCopies, int nPages, int bCollate);
+void TSPL_FreeDevmode(DEVMODE *pdm);
+
+// The DEVMODE is read by every command and never written: it outlives the
+// encoder, and a field changed between labels goes with the next command
+TSPLENC* TSPL_OpenEncoder(const DEVMODE *pdm, TSPLENC_SINK pfnSink, void *pContext);
+void TSPL_CloseEncoder(TSPLENC *penc);
+void TSPL_EncoderStats(const TSPLENC *penc, TSPLENC_STATS *pStats);
+
+// The TSPL_Send functions return 1, or 0 once the sink took less than it
+// was given: the job is then incomplete, the encoder stays failed.
+// TSPL_SendJobEnd() also returns 0 when the collated copies could not be
+// spooled and only one was sent.
+int TSPL_SendJobStart(TSPLENC *penc);
+int TSPL_SendSize(TSPLENC *penc);
+int TSPL_SendJobEnd(TSPLENC *penc);
+
+// A label is TSPL_SendPageStart(), its commands, TSPL_SendPageEnd()
+int TSPL_SendPageStart(TSPLENC *penc);
+int TSPL_SendPageEnd(TSPLENC *penc);
+int TSPL_SendDownload(TSPLENC *penc, const char *szName, const void *pData, unsigned int cbData);
+int TSPL_SendCommands(TSPLENC *penc, const char *szCmds, unsigned int cbCmds);
+
+// Or a whole label from a 1 bit bitmap, at once or by rows
+int TSPL_SendPage(TSPLENC *penc, BITMAPINFOHEADER* pBih, RGBQUAD *pColorTable, void* pBits);
+int TSPL_SendPageBegin(TSPLENC *penc, BITMAPINFOHEADER* pBih);
+int TSPL_SendPageRow(TSPLENC *penc, BITMAPINFOHEADER* pBih, void* pRow);
+int TSPL_SendPageFinish(TSPLENC *penc, BITMAPINFOHEADER* pBih);
+int TSPL_SendPageAbort(TSPLENC *penc, BITMAPINFOHEADER* pBih);		// Rows all sent, no PRINT
+
+// The plane of a label between TSPL_SendPageStart() and TSPL_SendPageEnd(),
+// solid rectangles as BAR, the rest as BITMAP bands
+size_t TSPL_SendPlane(TSPLENC *penc, unsigned char *pPlane, unsigned cbLine, unsigned nRows, int bBars);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// #ifndef _TSPLENC_H_
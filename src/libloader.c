@@ -20,112 +20,202 @@
  */
 
 #include "config.h"
+#include "common.h"
 #include "debug.h"
 #include "libloader.h"
 #include "mycups.h"
+#include "trace.h"
 #include <dlfcn.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#ifdef _FAST_START
+	// Symbols are bound when first called, libcups pulls in a lot we never use
+	#define	LIB_DLOPEN_FLAGS	RTLD_LAZY
+#else
+	#define	LIB_DLOPEN_FLAGS	RTLD_NOW
+#endif
 
 void*	TryLibLocation(const char* str)
 {
-	void*	hmodule = dlopen(str, RTLD_NOW);
+	void*	hmodule = dlopen(str, LIB_DLOPEN_FLAGS);
 
 	DebugPrintf("TryLibLocation: %s, %s\n", str, hmodule ? "OK" : "Fail");
 
 	return hmodule;
 }
 
-int	LoadCupsLibrary(CUPSLIB_FUNCTION* cupsfun)
+#ifdef _FAST_START
+static void LibPathCacheFile(const char *szName, char *filename, size_t len)
 {
-	int			nRtn = 1;
+	const char		*cachedir;
+
+	if ( (cachedir = getenv("CUPS_CACHEDIR")) == NULL )
+		cachedir = CUPS_CACHEDIR;
+
+	snprintf(filename, len, "%s/tsc-%s.path", cachedir, szName);
+}
+
+// Remember where the library was found, written the same way as the
+// PPD cache. Failing to store is not an error.
+static void StoreLibLocation(const char *szName, const char *szPath)
+{
+	char		filename[1024];
+	char		tempfile[1024];
+	char		*ptr;
+	int			fd;
+	size_t		len = strlen(szPath);
+
+	LibPathCacheFile(szName, filename, sizeof(filename));
+	snprintf(tempfile, sizeof(tempfile), "%s", filename);
+	if ( (ptr = strrchr(tempfile, '/')) != NULL )
+		snprintf(ptr + 1, sizeof(tempfile) - (ptr + 1 - tempfile), "tsc-XXXXXX");
+
+	if ( (fd = mkstemp(tempfile)) < 0 )
+		return;
+
+	fchmod(fd, 0644);
+	if ( write(fd, szPath, len) != len || close(fd) || rename(tempfile, filename) )
+	{
+		DebugPrintf("StoreLibLocation: %s - %s\n", filename, strerror(errno));
+		unlink(tempfile);
+	}
+}
+#endif	// #ifdef _FAST_START
+
+// Probe the known locations, the one that worked last time first
+static void* LoadLibLocation(const char *szName, const char *szLibs[])
+{
+	void		*hmodule = NULL;
 	int			i;
-	const char	*szLibgs[] = {
-#ifdef __MACOS__
-		"/usr/lib/libcups.dylib",
-		"/usr/lib/libcups.2.dylib",
-		"/usr/local/lib/libcups.dylib",
-		"/usr/local/lib/libcups.2.dylib",
-#else
-#ifdef __x86_64__
-		// try 64 bit libraries on 64 bit system
-		"/usr/lib64/libcups.so",
-		"/usr/lib64/libcups.so.2",
-		"/usr/local/lib64/libcups.so",
-		"/usr/local/lib64/libcups.so.2",
-		"/usr/lib/x86_64-linux-gnu/libcups.so.2",
-#else
-		"/usr/lib/libcups.so",
-		"/usr/lib/libcups.so.2",
-		"/usr/local/lib/libcups.so",
-		"/usr/local/lib/libcups.so.2",
-		"/usr/lib/i386-linux-gnu/libcups.so.2",
-		"/usr/lib/aarch64-linux-gnu/libcups.so.2",
-		"/usr/lib/mipsel-linux-gnu/libcups.so.2",			//add
-		
-#endif  // __x86_64__
+#ifdef _FAST_START
+	char		filename[1024];
+	char		path[1024];
+	int			fd;
+	ssize_t		len;
+
+	LibPathCacheFile(szName, filename, sizeof(filename));
+	if ( (fd = open(filename, O_RDONLY)) >= 0 )
+	{
+		len = read(fd, path, sizeof(path) - 1);
+		close(fd);
+		if ( len > 0 )
+		{
+			// Only ever one of our own locations, whoever can write the
+			// cache directory must not choose what is loaded
+			path[len] = 0;
+			for(i=0; szLibs[i]; i++)
+			{
+				if ( !strcmp(path, szLibs[i]) )
+				{
+					if ( (hmodule = TryLibLocation(szLibs[i])) != NULL )
+						return hmodule;
+					break;
+				}
+			}
+			if ( szLibs[i] == NULL )
+				Error_Log(LEVEL_WARNING, "Ignoring unknown library location in %s\n", filename);
+		}
+	}
 #endif
-		NULL,
-	};
 
-	memset(cupsfun, 0, sizeof(CUPSLIB_FUNCTION));
-	for(i=0; cupsfun->hmodule==NULL && szLibgs[i]; i++)
+	for(i=0; hmodule==NULL && szLibs[i]; i++)
 	{
-		cupsfun->hmodule = TryLibLocation(szLibgs[i]);
+		hmodule = TryLibLocation(szLibs[i]);
 	}
 
-	if ( cupsfun->hmodule )
+#ifdef _FAST_START
+	if ( hmodule )
+		StoreLibLocation(szName, szLibs[i - 1]);
+#endif
+	return hmodule;
+}
+
+// Symbols are resolved a group at a time, a group falls back to our own
+// implementation as a whole when the libcups at hand is too old for it
+#define	CUPSLIB_CUPS		0
+#define	CUPSLIB_PPD			1
+#define	CUPSLIB_FILE		2
+#define	CUPSLIB_ARRAY		3
+#define	CUPSLIB_LANG		4
+#define	CUPSLIB_NUM_GROUPS	5
+
+// Where dlsym() puts each symbol of a group
+typedef struct {
+	int			group;
+	const char	*name;
+	size_t		offset;
+} CUPSLIB_SYMBOL;
+
+#define CUPSLIB_SYM(g, name)	{g, #name, offsetof(CUPSLIB_FUNCTION, name)}
+#define CUPSLIB_SLOT(f, i)		(*(void **)((char *)(f) + g_cupslib_symbols[i].offset))
+
+static const CUPSLIB_SYMBOL g_cupslib_symbols[] = {
+	CUPSLIB_SYM(CUPSLIB_CUPS,	cupsGetDests),
+	CUPSLIB_SYM(CUPSLIB_CUPS,	cupsSetDests),
+	CUPSLIB_SYM(CUPSLIB_CUPS,	cupsFreeDests),
+	CUPSLIB_SYM(CUPSLIB_CUPS,	cupsGetDest),
+	CUPSLIB_SYM(CUPSLIB_CUPS,	cupsAddOption),
+	CUPSLIB_SYM(CUPSLIB_CUPS,	cupsParseOptions),
+	CUPSLIB_SYM(CUPSLIB_CUPS,	cupsMarkOptions),
+	CUPSLIB_SYM(CUPSLIB_CUPS,	cupsGetOption),
+	CUPSLIB_SYM(CUPSLIB_CUPS,	cupsFreeOptions),
+	CUPSLIB_SYM(CUPSLIB_CUPS,	cupsGetPPD),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdOpenFile),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdClose),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdMarkDefaults),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdFindOption),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdFindChoice),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdMarkOption),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdFindMarkedChoice),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdPageSize),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdFindAttr),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdFindNextAttr),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdIsMarked),
+	CUPSLIB_SYM(CUPSLIB_PPD,	ppdLocalize),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsTempFile2),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsFileClose),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsFileGetLine),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsFileOpen),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsFileOpenFd),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsFileStdin),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsFileWrite),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsFileTell),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsFileRead),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsFileSeek),
+	CUPSLIB_SYM(CUPSLIB_FILE,	cupsFileRewind),
+	CUPSLIB_SYM(CUPSLIB_ARRAY,	cupsArrayAdd),
+	CUPSLIB_SYM(CUPSLIB_ARRAY,	cupsArrayNew),
+	CUPSLIB_SYM(CUPSLIB_ARRAY,	cupsArrayCount),
+	CUPSLIB_SYM(CUPSLIB_ARRAY,	cupsArrayFirst),
+	CUPSLIB_SYM(CUPSLIB_ARRAY,	cupsArrayLast),
+	CUPSLIB_SYM(CUPSLIB_ARRAY,	cupsArrayIndex),
+	CUPSLIB_SYM(CUPSLIB_LANG,	cupsLangDefault),
+	CUPSLIB_SYM(CUPSLIB_LANG,	cupsLangFree),
+};
+
+static BOOL ResolveCupsGroup(CUPSLIB_FUNCTION* cupsfun, int group)
+{
+	BOOL		bRtn = TRUE;
+	size_t		i;
+
+	for (i=0; i<ARRAYCOUNT(g_cupslib_symbols); i++)
 	{
-		cupsfun->cupsGetDests = (PFN_cupsGetDests) dlsym(cupsfun->hmodule, "cupsGetDests");
-		cupsfun->cupsSetDests = (PFN_cupsSetDests) dlsym(cupsfun->hmodule, "cupsSetDests");
-		cupsfun->cupsFreeDests = (PFN_cupsFreeDests) dlsym(cupsfun->hmodule, "cupsFreeDests");
-		cupsfun->cupsGetDest = (PFN_cupsGetDest) dlsym(cupsfun->hmodule, "cupsGetDest");
-		cupsfun->cupsAddOption = (PFN_cupsAddOption) dlsym(cupsfun->hmodule,"cupsAddOption");
-		cupsfun->cupsParseOptions = (PFN_cupsParseOptions) dlsym(cupsfun->hmodule, "cupsParseOptions");
-		cupsfun->cupsMarkOptions = (PFN_cupsMarkOptions) dlsym(cupsfun->hmodule, "cupsMarkOptions");
-		cupsfun->cupsGetOption = (PFN_cupsGetOption) dlsym(cupsfun->hmodule, "cupsGetOption");
-		cupsfun->cupsFreeOptions = (PFN_cupsFreeOptions) dlsym(cupsfun->hmodule, "cupsFreeOptions");
-		cupsfun->cupsGetPPD = (PFN_cupsGetPPD) dlsym(cupsfun->hmodule, "cupsGetPPD");
-		cupsfun->cupsTempFile2 = (PFN_cupsTempFile2) dlsym(cupsfun->hmodule, "cupsTempFile2");
-
-		cupsfun->ppdOpenFile = (PFN_ppdOpenFile) dlsym(cupsfun->hmodule, "ppdOpenFile");
-		cupsfun->ppdClose = (PFN_ppdClose) dlsym(cupsfun->hmodule, "ppdClose");
-		cupsfun->ppdMarkDefaults = (PFN_ppdMarkDefaults) dlsym(cupsfun->hmodule, "ppdMarkDefaults");
-		cupsfun->ppdFindOption = (PFN_ppdFindOption) dlsym(cupsfun->hmodule, "ppdFindOption");
-		cupsfun->ppdFindChoice = (PFN_ppdFindChoice) dlsym(cupsfun->hmodule, "ppdFindChoice");
-		cupsfun->ppdMarkOption = (PFN_ppdMarkOption) dlsym(cupsfun->hmodule, "ppdMarkOption");
-		cupsfun->ppdFindMarkedChoice = (PFN_ppdFindMarkedChoice) dlsym(cupsfun->hmodule, "ppdFindMarkedChoice");
-		cupsfun->ppdPageSize = (PFN_ppdPageSize) dlsym(cupsfun->hmodule, "ppdPageSize");
-		cupsfun->ppdFindAttr = (PFN_ppdFindAttr) dlsym(cupsfun->hmodule, "ppdFindAttr");
-		cupsfun->ppdFindNextAttr = (PFN_ppdFindNextAttr) dlsym(cupsfun->hmodule, "ppdFindNextAttr");
-		cupsfun->ppdIsMarked = (PFN_ppdIsMarked) dlsym(cupsfun->hmodule, "ppdIsMarked");
-		cupsfun->ppdLocalize = (PFN_ppdLocalize) dlsym(cupsfun->hmodule, "ppdLocalize");
-
-		cupsfun->cupsFileClose = (PFN_cupsFileClose) dlsym(cupsfun->hmodule, "cupsFileClose");
-		cupsfun->cupsFileGetLine = (PFN_cupsFileGetLine) dlsym(cupsfun->hmodule, "cupsFileGetLine");
-		cupsfun->cupsFileOpen = (PFN_cupsFileOpen) dlsym(cupsfun->hmodule, "cupsFileOpen");
-		cupsfun->cupsFileOpenFd = (PFN_cupsFileOpenFd) dlsym(cupsfun->hmodule, "cupsFileOpenFd");
-		cupsfun->cupsFileStdin = (PFN_cupsFileStdin) dlsym(cupsfun->hmodule, "cupsFileStdin");
-		cupsfun->cupsFileWrite = (PFN_cupsFileWrite) dlsym(cupsfun->hmodule, "cupsFileWrite");
-		cupsfun->cupsFileTell = (PFN_cupsFileTell) dlsym(cupsfun->hmodule, "cupsFileTell");
-		cupsfun->cupsFileRead = (PFN_cupsFileRead) dlsym(cupsfun->hmodule, "cupsFileRead");
-		cupsfun->cupsFileSeek = (PFN_cupsFileSeek) dlsym(cupsfun->hmodule, "cupsFileSeek");
-		cupsfun->cupsFileRewind	= (PFN_cupsFileRewind) dlsym(cupsfun->hmodule, "cupsFileRewind");
-
-		cupsfun->cupsArrayAdd = (PFN_cupsArrayAdd) dlsym(cupsfun->hmodule, "cupsArrayAdd");
-		cupsfun->cupsArrayNew = (PFN_cupsArrayNew) dlsym(cupsfun->hmodule, "cupsArrayNew");
-		cupsfun->cupsArrayCount = (PFN_cupsArrayCount) dlsym(cupsfun->hmodule, "cupsArrayCount");
-		cupsfun->cupsArrayFirst = (PFN_cupsArrayFirst) dlsym(cupsfun->hmodule, "cupsArrayFirst");
-		cupsfun->cupsArrayLast = (PFN_cupsArrayLast) dlsym(cupsfun->hmodule, "cupsArrayLast");
-		cupsfun->cupsArrayIndex = (PFN_cupsArrayIndex) dlsym(cupsfun->hmodule, "cupsArrayIndex");
-
-		cupsfun->cupsLangDefault = (PFN_cupsLangDefault) dlsym(cupsfun->hmodule, "cupsLangDefault");
-		cupsfun->cupsLangFree = (PFN_cupsLangFree) dlsym(cupsfun->hmodule, "cupsLangFree");
+		if ( g_cupslib_symbols[i].group == group )
+			CUPSLIB_SLOT(cupsfun, i) = dlsym(cupsfun->hmodule, g_cupslib_symbols[i].name);
+	}
 
+	switch ( group )
+	{
+	case CUPSLIB_PPD:
 		if ( cupsfun->ppdLocalize == NULL )
 		{
 DebugPrintf( "Use myself ppdLocalize\n");
 			cupsfun->ppdLocalize = my_ppdLocalize;
 		}
+		break;
 
+	case CUPSLIB_FILE:
 		if ( cupsfun->cupsTempFile2 == NULL
 			|| cupsfun->cupsFileClose == NULL
 			|| cupsfun->cupsFileGetLine == NULL
@@ -152,7 +242,9 @@ DebugPrintf( "Use myself cupsFile functions\n");
 			cupsfun->cupsFileSeek = (PFN_cupsFileSeek) my_cupsFileSeek;
 			cupsfun->cupsFileRewind	= (PFN_cupsFileRewind) my_cupsFileRewind;
 		}
+		break;
 
+	case CUPSLIB_ARRAY:
 		// before CUPS 1.2, not have Array funtion, use myself function
 		if ( cupsfun->cupsArrayAdd == NULL
 			|| cupsfun->cupsArrayNew == NULL
@@ -170,56 +262,75 @@ DebugPrintf( "Use myself cupsArray functions\n");
 			cupsfun->cupsArrayLast = (PFN_cupsArrayLast) my_cupsArrayLast;
 			cupsfun->cupsArrayIndex = (PFN_cupsArrayIndex) my_cupsArrayIndex;
 		}
+		break;
+
+	case CUPSLIB_LANG:
 		if ( cupsfun->cupsLangDefault == NULL )
 		{
 DebugPrintf( "Use myself cupsLangDefault\n");
 			cupsfun->cupsLangDefault = my_cupsLangDefault;
 		}
+		break;
+	}
 
-		if ( cupsfun->cupsGetDests
-			&& cupsfun->cupsFreeDests
-			&& cupsfun->cupsSetDests
-			&& cupsfun->cupsGetDest
-			&& cupsfun->cupsAddOption
-			&& cupsfun->cupsParseOptions
-			&& cupsfun->cupsMarkOptions
-			&& cupsfun->cupsGetOption
-			&& cupsfun->cupsFreeOptions
-			&& cupsfun->cupsGetPPD
-			&& cupsfun->cupsTempFile2
-			&& cupsfun->ppdOpenFile
-			&& cupsfun->ppdClose
-			&& cupsfun->ppdMarkDefaults
-			&& cupsfun->ppdFindOption
-			&& cupsfun->ppdFindChoice
-			&& cupsfun->ppdMarkOption
-			&& cupsfun->ppdFindMarkedChoice
-			&& cupsfun->ppdPageSize
-			&& cupsfun->ppdFindAttr
-			&& cupsfun->ppdFindNextAttr
-			&& cupsfun->ppdIsMarked
-			&& cupsfun->ppdLocalize
-			&& cupsfun->cupsFileClose
-			&& cupsfun->cupsFileGetLine
-			&& cupsfun->cupsFileOpen
-			&& cupsfun->cupsFileOpenFd
-			&& cupsfun->cupsFileStdin
-			&& cupsfun->cupsFileWrite
-			&& cupsfun->cupsFileTell
-			&& cupsfun->cupsFileRead
-			&& cupsfun->cupsFileSeek
-			&& cupsfun->cupsFileRewind
-			&& cupsfun->cupsArrayAdd
-			&& cupsfun->cupsArrayNew
-			&& cupsfun->cupsArrayCount
-			&& cupsfun->cupsArrayFirst
-			&& cupsfun->cupsArrayLast
-			&& cupsfun->cupsArrayIndex
-			&& cupsfun->cupsLangDefault
-			&& cupsfun->cupsLangFree
-			)
+	for (i=0; i<ARRAYCOUNT(g_cupslib_symbols); i++)
+	{
+		if ( g_cupslib_symbols[i].group == group && CUPSLIB_SLOT(cupsfun, i) == NULL )
+			bRtn = FALSE;
+	}
+
+	return bRtn;
+}
+
+int	LoadCupsLibrary(CUPSLIB_FUNCTION* cupsfun)
+{
+	int			nRtn = 1;
+	TRACETIME	tStart = Trace_Begin();
+	const char	*szLibgs[] = {
+#ifdef __MACOS__
+		"/usr/lib/libcups.dylib",
+		"/usr/lib/libcups.2.dylib",
+		"/usr/local/lib/libcups.dylib",
+		"/usr/local/lib/libcups.2.dylib",
+#else
+#ifdef __x86_64__
+		// try 64 bit libraries on 64 bit system
+		"/usr/lib64/libcups.so",
+		"/usr/lib64/libcups.so.2",
+		"/usr/local/lib64/libcups.so",
+		"/usr/local/lib64/libcups.so.2",
+		"/usr/lib/x86_64-linux-gnu/libcups.so.2",
+#else
+		"/usr/lib/libcups.so",
+		"/usr/lib/libcups.so.2",
+		"/usr/local/lib/libcups.so",
+		"/usr/local/lib/libcups.so.2",
+		"/usr/lib/i386-linux-gnu/libcups.so.2",
+		"/usr/lib/aarch64-linux-gnu/libcups.so.2",
+		"/usr/lib/mipsel-linux-gnu/libcups.so.2",			//add
+		
+#endif  // __x86_64__
+#endif
+		NULL,
+	};
+
+	memset(cupsfun, 0, sizeof(CUPSLIB_FUNCTION));
+	cupsfun->hmodule = LoadLibLocation("libcups", szLibgs);
+
+	if ( cupsfun->hmodule )
+	{
+		int		i;
+
+		// Every group is resolved now, a libcups too old for the driver
+		// fails here and not halfway through a job
+		nRtn = 0;
+		for (i=0; i<CUPSLIB_NUM_GROUPS; i++)
 		{
-			nRtn = 0;
+			if ( !ResolveCupsGroup(cupsfun, i) )
+			{
+				Error_Log(LEVEL_ERROR, "libcups version too old, missing functions of group %d\n", i);
+				nRtn = 1;
+			}
 		}
 
 		if ( nRtn )
@@ -228,6 +339,7 @@ DebugPrintf( "Use myself cupsLangDefault\n");
 		}
 	}
 
+	Trace_End("LoadCupsLibrary", tStart, TRACE_NO_ARG);
 	return nRtn;
 }
 
@@ -243,7 +355,7 @@ void	FreeCupsLibrary(CUPSLIB_FUNCTION* cupsfun)
 int	LoadGsLibrary(GSLIB_FUNCTION* gsfun)
 {
 	int			nRtn = 1;
-	int			i;
+	TRACETIME	tStart = Trace_Begin();
 	const char	*szLibgs[] = {
 #if defined(__MACOS__)
 		"/usr/lib/libgs.dylib",
@@ -266,10 +378,8 @@ int	LoadGsLibrary(GSLIB_FUNCTION* gsfun)
 	};
 
 	memset(gsfun, 0, sizeof(GSLIB_FUNCTION));
-	for(i=0; gsfun->hmodule==NULL && szLibgs[i]; i++)
-	{
-		gsfun->hmodule = TryLibLocation(szLibgs[i]);
-	}
+	// Every gs job calls all of these, so the table stays eagerly resolved
+	gsfun->hmodule = LoadLibLocation("libgs", szLibgs);
 
 	if ( gsfun->hmodule )
 	{
@@ -319,6 +429,7 @@ int	LoadGsLibrary(GSLIB_FUNCTION* gsfun)
 		}
 	}
 
+	Trace_End("LoadGsLibrary", tStart, TRACE_NO_ARG);
 	return nRtn;
 }
 
@@ -38,6 +38,11 @@
 extern "C" {
 #endif /* __cplusplus */
 
+// Where the PPD images and library paths are cached, $CUPS_CACHEDIR wins
+#ifndef CUPS_CACHEDIR
+#define CUPS_CACHEDIR			"/var/cache/cups"
+#endif
+
 /*
  * CUPS Functions...
  */
@@ -0,0 +1,179 @@
+/*
+ * "metrics.c 2021-05-17 15:55:05
+ *
+ *  job metrics routines for TSC Printer Driver
+ *
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "metrics.h"
+#include "probes.h"
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+
+long long			g_llMetrics[METRIC_NUM];
+
+static const char	*s_szNames[METRIC_NUM] = {
+	"input_bytes",
+	"pixels",
+	"pages",
+	"copies",
+	"output_bytes",
+	"read_calls",
+	"write_calls",
+	"spool_bytes",
+	"saved_bytes",
+	"setup_us",
+	"parse_us",
+	"output_us",
+};
+
+static const char	*s_szFilter = NULL;
+static const char	*s_szJob = NULL;
+static long long	s_llStart = 0;
+
+long long Metrics_Now(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Names the line and starts the clock. A forked child calls it again
+// with its own name and gets fresh counters.
+void Metrics_Start(const char *szFilter, const char *szJob)
+{
+	BOOL		bFirst = (s_szFilter == NULL);
+
+	memset(g_llMetrics, 0, sizeof(g_llMetrics));
+	s_szFilter = szFilter;
+	s_szJob = szJob;
+	s_llStart = Metrics_Now();
+
+	if ( bFirst && getenv("TSC_METRICS_FILE") )
+		atexit(Metrics_Dump);
+}
+
+// A JSON string body, cut short rather than cut through an escape
+static void JsonEscape(char *szDst, size_t cbDst, const char *szSrc)
+{
+	size_t		len = 0;
+	char		esc[8];
+
+	for ( ; *szSrc; szSrc++)
+	{
+		BYTE	c = (BYTE)*szSrc;
+
+		if ( c == '"' || c == '\\' )
+			snprintf(esc, sizeof(esc), "\\%c", c);
+		else if ( c < 0x20 )
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+		else
+		{
+			esc[0] = c;
+			esc[1] = 0;
+		}
+		if ( len + strlen(esc) >= cbDst )
+			break;
+		strcpy(szDst + len, esc);
+		len += strlen(esc);
+	}
+	szDst[len] = 0;
+}
+
+// One write() of the whole line on an O_APPEND descriptor, so lines of
+// concurrent jobs never interleave
+void Metrics_Dump(void)
+{
+	const char		*filename;
+	const char		*printer;
+	char			szPrinter[256];
+	char			szJob[64];
+	char			line[1024];
+	int				len;
+	int				i;
+	int				fd;
+	struct rusage	ru;
+
+	if ( s_szFilter == NULL || (filename = getenv("TSC_METRICS_FILE")) == NULL || !*filename )
+		return;
+
+	if ( (printer = getenv("PRINTER")) == NULL )
+		printer = "";
+	JsonEscape(szPrinter, sizeof(szPrinter), printer);
+	JsonEscape(szJob, sizeof(szJob), s_szJob ? s_szJob : "");
+	getrusage(RUSAGE_SELF, &ru);
+
+	len = snprintf(line, sizeof(line), "{\"time\":%ld,\"filter\":\"%s\",\"printer\":\"%s\",\"job\":\"%s\",\"pid\":%d",
+		(long)time(NULL), s_szFilter, szPrinter, szJob, (int)getpid());
+	for (i=0; i<METRIC_NUM && len < sizeof(line); i++)
+	{
+		len += snprintf(line + len, sizeof(line) - len, ",\"%s\":%lld", s_szNames[i], g_llMetrics[i]);
+	}
+	if ( len < sizeof(line) )
+	{
+		len += snprintf(line + len, sizeof(line) - len, ",\"total_us\":%lld,\"user_us\":%lld,\"sys_us\":%lld,\"max_rss_kb\":%ld}\n",
+			Metrics_Now() - s_llStart,
+			(long long)ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec,
+			(long long)ru.ru_stime.tv_sec * 1000000 + ru.ru_stime.tv_usec,
+			ru.ru_maxrss);
+	}
+	if ( len >= sizeof(line) )
+	{
+		Error_Log(LEVEL_WARNING, "Metrics line too long, not written\n");
+		return;
+	}
+
+	if ( (fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0 )
+	{
+		Error_Log(LEVEL_WARNING, "Unable to write metrics file %s: %s\n", filename, strerror(errno));
+		return;
+	}
+	if ( write(fd, line, len) != len )
+	{
+		Error_Log(LEVEL_WARNING, "Unable to write metrics file %s: %s\n", filename, strerror(errno));
+	}
+	close(fd);
+}
+
+// The first write also logs the time from exec to the first byte
+size_t Metrics_WriteStdout(void *pContext, const void* pData, size_t cbData)
+{
+	Log_FirstOutputByte();
+	Metrics_Add(METRIC_WRITE_CALLS, 1);
+	TSC_PROBE1(printer_write, cbData);
+
+	for ( ;; )
+	{
+		ssize_t		n = write(fileno(stdout), pData, cbData);
+
+		if ( n >= 0 )
+		{
+			Metrics_Add(METRIC_OUTPUT_BYTES, n);
+			return n;
+		}
+		if ( errno != EINTR )
+		{
+			Error_Log(LEVEL_ERROR, "Unable to write to the printer: %s\n", strerror(errno));
+			return 0;
+		}
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * "metrics.h 2021-05-17 15:55:05
+ *
+ *  job metrics declaration for TSC Printer Driver
+ *
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Counters are always kept, a plain add. At exit one JSON line per process
+// is appended to $TSC_METRICS_FILE, when set.
+#define	METRIC_INPUT_BYTES		0		// Raster or pipe bytes read
+#define	METRIC_PIXELS			1		// Decoded pixels
+#define	METRIC_PAGES			2
+#define	METRIC_COPIES			3
+#define	METRIC_OUTPUT_BYTES		4		// TSPL sent to the printer
+#define	METRIC_READ_CALLS		5
+#define	METRIC_WRITE_CALLS		6
+#define	METRIC_SPOOL_BYTES		7		// Written to the job's temp file
+#define	METRIC_SAVED_BYTES		8		// Not sent thanks to compression or trimming
+#define	METRIC_US_SETUP			9		// Stage wall times
+#define	METRIC_US_PARSE			10
+#define	METRIC_US_OUTPUT		11
+#define	METRIC_NUM				12
+
+extern long long	g_llMetrics[METRIC_NUM];
+
+#define	Metrics_Add(id, n)			(g_llMetrics[id] += (n))
+#define	Metrics_Set(id, n)			(g_llMetrics[id] = (n))
+#define	Metrics_Time(id, start)		(g_llMetrics[id] += Metrics_Now() - (start))
+
+void Metrics_Start(const char *szFilter, const char *szJob);
+long long Metrics_Now(void);
+void Metrics_Dump(void);
+
+// The filters' TSPLENC_SINK, stdout counted in the metrics above
+size_t Metrics_WriteStdout(void *pContext, const void *pData, size_t cbData);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// #ifndef _METRICS_H_
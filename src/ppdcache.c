@@ -0,0 +1,729 @@
+/*
+ * "ppdcache.c 2021-05-17 15:55:05
+ *
+ *  compiled ppd cache routines for TSC Printer Driver
+ *
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "devmode.h"
+#include "ppdcache.h"
+#include "trace.h"
+
+#include <sys/stat.h>
+
+typedef struct _PPDCACHE_BUF
+{
+	BYTE		*data;
+	size_t		len;
+	size_t		size;
+	BOOL		bFailed;				// Out of memory, image incomplete
+} PPDCACHE_BUF;
+
+static DWORD buf_reserve(PPDCACHE_BUF *buf, size_t len);
+static DWORD buf_string(PPDCACHE_BUF *buf, const char *str);
+static BYTE* PpdCacheBuild(const char *szPpdFile, struct stat *st, CUPSLIB_FUNCTION *cups, size_t *psize);
+static BOOL PpdCacheValid(const BYTE *image, size_t size, const char *szPpdFile, struct stat *st);
+static void PpdCacheFileName(const char *szPpdFile, char *filename, size_t len);
+static void PpdCacheStore(const char *szPpdFile, const BYTE *image, size_t size);
+static BOOL MarkChoice(PPDCACHE *cache, const char *keyword, const char *choice);
+static BOOL MarkOptionsCups(PPDCACHE *cache, int num_options, cups_option_t *options, CUPSLIB_FUNCTION *cups);
+
+// IPP options cupsMarkOptions() maps onto PPD keywords of its own
+static const char	*g_szIppOptions[] = {
+	"finishings",
+	"multiple-document-handling",
+	"output-bin",
+	"print-color-mode",
+	"print-quality",
+	"sides",
+};
+
+PPDCACHE* PpdCacheOpen(const char *szPpdFile, BOOL bStore, CUPSLIB_FUNCTION *cups)
+{
+	PPDCACHE		*cache;
+	struct stat		st;
+	char			filename[1024];
+	int				fd;
+
+	if ( szPpdFile == NULL || stat(szPpdFile, &st) )
+		return NULL;
+
+	if ( (cache = MEMALLOC(sizeof(PPDCACHE))) == NULL )
+		return NULL;
+
+	// Try the compiled image first...
+	if ( bStore )
+	{
+		PpdCacheFileName(szPpdFile, filename, sizeof(filename));
+		if ( (fd = open(filename, O_RDONLY)) >= 0 )
+		{
+			struct stat		cst;
+			void			*image;
+
+			if ( !fstat(fd, &cst) && cst.st_size >= sizeof(PPDCACHE_HEADER) &&
+				(image = mmap(NULL, cst.st_size, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED )
+			{
+				if ( PpdCacheValid(image, cst.st_size, szPpdFile, &st) )
+				{
+					cache->image = image;
+					cache->size = cst.st_size;
+					cache->bMapped = TRUE;
+				}
+				else
+				{
+					munmap(image, cst.st_size);
+				}
+			}
+			close(fd);
+		}
+		DebugPrintf("PpdCacheOpen: %s %s\n", filename, cache->image ? "hit" : "miss");
+	}
+
+	// ...else compile the PPD, and keep the image for the next job
+	if ( cache->image == NULL )
+	{
+		TRACETIME	tStart = Trace_Begin();
+
+		cache->image = PpdCacheBuild(szPpdFile, &st, cups, &cache->size);
+		if ( cache->image && bStore )
+		{
+			PpdCacheStore(szPpdFile, cache->image, cache->size);
+		}
+		Trace_End("PpdCacheBuild", tStart, TRACE_NO_ARG);
+	}
+
+	if ( cache->image == NULL ||
+		(cache->marked = MEMALLOC(sizeof(DWORD) * (PPDCACHE_HDR(cache)->num_options + 1))) == NULL )
+	{
+		PpdCacheClose(cache);
+		return NULL;
+	}
+
+	PpdCacheMarkDefaults(cache);
+	return cache;
+}
+
+void PpdCacheClose(PPDCACHE *cache)
+{
+	int			i;
+
+	if ( cache )
+	{
+		if ( cache->bMapped )
+			munmap(cache->image, cache->size);
+		else
+			MEMFREE(cache->image);
+
+		MEMFREE(cache->marked);
+		for (i=0; i<PPDCACHE_NUM_COMMANDS; i++)
+			MEMFREE(cache->command[i]);
+	}
+	MEMFREE(cache);
+}
+
+int PpdCacheFindOption(PPDCACHE *cache, const char *keyword)
+{
+	DWORD		i;
+
+	for (i=0; i<PPDCACHE_HDR(cache)->num_options; i++)
+	{
+		if ( !strcasecmp(PPDCACHE_STR(cache, PPDCACHE_OPT(cache, i)->keyword), keyword) )
+			return i;
+	}
+	return -1;
+}
+
+void PpdCacheMarkDefaults(PPDCACHE *cache)
+{
+	DWORD		i;
+
+	for (i=0; i<PPDCACHE_HDR(cache)->num_options; i++)
+	{
+		cache->marked[i] = PPDCACHE_OPT(cache, i)->defchoice;
+	}
+	cache->custom[0] = cache->custom[1] = 0.0;
+
+	for (i=0; i<PPDCACHE_NUM_COMMANDS; i++)
+	{
+		MEMFREE(cache->command[i]);
+		cache->command_length[i] = 0;
+	}
+}
+
+// Plain keyword=choice options are marked from the image. Anything
+// only cupsMarkOptions() knows how to map, IPP names, PWG media names
+// and {...} custom values, has the job marked by libcups on the PPD.
+void PpdCacheMarkOptions(PPDCACHE *cache, int num_options, cups_option_t *options, CUPSLIB_FUNCTION *cups)
+{
+	int			i;
+	DWORD		j;
+	const char	*szCups = NULL;			// First option left to libcups
+
+	for (i=0; i<num_options; i++)
+	{
+		BOOL		bPlaced = TRUE;
+
+		for (j=0; j<ARRAYCOUNT(g_szIppOptions); j++)
+		{
+			if ( !strcasecmp(options[i].name, g_szIppOptions[j]) )
+				bPlaced = FALSE;
+		}
+
+		if ( !bPlaced || options[i].value[0] == '{' )
+		{
+			bPlaced = FALSE;
+		}
+		else if ( !strcasecmp(options[i].name, "media") )
+		{
+			char		value[256];
+			char		*ptr, *next;
+
+			// media=size,type,source in any order
+			snprintf(value, sizeof(value), "%s", options[i].value);
+			for (ptr=value; ptr; ptr=next)
+			{
+				if ( (next = strchr(ptr, ',')) != NULL )
+					*next++ = '\0';
+
+				if ( !MarkChoice(cache, "PageSize", ptr) && !MarkChoice(cache, "MediaType", ptr) &&
+					!MarkChoice(cache, "InputSlot", ptr) )
+				{
+					bPlaced = FALSE;
+				}
+			}
+		}
+		else if ( !strcasecmp(options[i].name, "PageRegion") )
+		{
+			bPlaced = MarkChoice(cache, "PageSize", options[i].value);
+		}
+		else if ( !MarkChoice(cache, options[i].name, options[i].value) &&
+			PpdCacheFindOption(cache, options[i].name) >= 0 )
+		{
+			bPlaced = FALSE;
+		}
+
+		if ( !bPlaced && szCups == NULL )
+			szCups = options[i].name;
+	}
+
+	if ( szCups )
+	{
+		DebugPrintf("PpdCacheMarkOptions: %s needs cupsMarkOptions()\n", szCups);
+		if ( !MarkOptionsCups(cache, num_options, options, cups) )
+		{
+			Error_Log(LEVEL_WARNING, "Unable to mark options with libcups, %s is ignored\n", szCups);
+		}
+	}
+}
+
+const char* PpdCacheMarkedChoice(PPDCACHE *cache, const char *keyword)
+{
+	int			i;
+
+	if ( (i = PpdCacheFindOption(cache, keyword)) < 0 || cache->marked[i] == PPDCACHE_NONE )
+		return NULL;
+
+	return PPDCACHE_STR(cache, PPDCACHE_CHO(cache, cache->marked[i])->choice);
+}
+
+const char* PpdCacheChoiceCode(PPDCACHE *cache, const char *keyword, const char *choice)
+{
+	const PPDCACHE_OPTION	*option;
+	DWORD					i;
+	int						n;
+
+	if ( (n = PpdCacheFindOption(cache, keyword)) < 0 )
+		return NULL;
+
+	option = PPDCACHE_OPT(cache, n);
+	for (i=option->first_choice; i<option->first_choice+option->num_choices; i++)
+	{
+		if ( !strcmp(PPDCACHE_STR(cache, PPDCACHE_CHO(cache, i)->choice), choice) )
+			return PPDCACHE_STR(cache, PPDCACHE_CHO(cache, i)->code);
+	}
+	return NULL;
+}
+
+// Like ppdPageSize(): NULL is the marked size, "Custom.WxH" is parsed
+BOOL PpdCachePageSize(PPDCACHE *cache, const char *name, float *width, float *length)
+{
+	DWORD		i;
+
+	if ( name == NULL && (name = PpdCacheMarkedChoice(cache, "PageSize")) == NULL )
+		return FALSE;
+
+	if ( !strcasecmp(name, "Custom") && cache->custom[0] > 0.0 )
+	{
+		*width = cache->custom[0];
+		*length = cache->custom[1];
+		return TRUE;
+	}
+
+	if ( !strncasecmp(name, "Custom.", 7) )
+	{
+		float		w, l;
+		char		units[16];
+
+		units[0] = '\0';
+		if ( sscanf(name + 7, "%fx%f%15s", &w, &l, units) < 2 )
+			return FALSE;
+
+		if ( !strcasecmp(units, "in") )
+			w *= 72.0, l *= 72.0;
+		else if ( !strcasecmp(units, "cm") )
+			w *= 72.0 / 2.54, l *= 72.0 / 2.54;
+		else if ( !strcasecmp(units, "mm") )
+			w *= 72.0 / 25.4, l *= 72.0 / 25.4;
+		else if ( !strcasecmp(units, "m") )
+			w *= 72.0 / 0.0254, l *= 72.0 / 0.0254;
+		else if ( !strcasecmp(units, "ft") )
+			w *= 12.0 * 72.0, l *= 12.0 * 72.0;
+
+		*width = w;
+		*length = l;
+		return TRUE;
+	}
+
+	for (i=0; i<PPDCACHE_HDR(cache)->num_sizes; i++)
+	{
+		if ( !strcasecmp(PPDCACHE_STR(cache, PPDCACHE_SZ(cache, i)->name), name) )
+		{
+			*width = PPDCACHE_SZ(cache, i)->width;
+			*length = PPDCACHE_SZ(cache, i)->length;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// Same result as GetPrinterOptions() on the parsed PPD
+int PpdCacheGetOptions(PPDCACHE *cache, cups_option_t **options, CUPSLIB_FUNCTION *cups)
+{
+	int			num = 0;
+	DWORD		i;
+
+	*options = NULL;
+	for (i=0; i<PPDCACHE_HDR(cache)->num_attrs; i++)
+	{
+		num = cups->cupsAddOption(PPDCACHE_STR(cache, PPDCACHE_ATR(cache, i)->name),
+			PPDCACHE_STR(cache, PPDCACHE_ATR(cache, i)->value), num, options);
+	}
+	return num;
+}
+
+// A user command block, decoded when the PPD was compiled
+const BYTE* PpdCacheCommand(PPDCACHE *cache, int index, DWORD *length)
+{
+	if ( cache->command[index] )
+	{
+		*length = cache->command_length[index];
+		return cache->command[index];
+	}
+
+	*length = PPDCACHE_HDR(cache)->command_lengths[index];
+	return *length ? cache->image + PPDCACHE_HDR(cache)->commands[index] : NULL;
+}
+
+// A job option replacing the PPD's user command block
+BOOL PpdCacheSetCommand(PPDCACHE *cache, int index, const char *szCoded)
+{
+	MEMFREE(cache->command[index]);
+	cache->command_length[index] = 0;
+
+	if ( (cache->command[index] = MEMALLOC(strlen(szCoded) * 3 / 4 + 4)) == NULL )
+		return FALSE;
+
+	cache->command_length[index] = Decode(szCoded, cache->command[index]);
+	return TRUE;
+}
+
+BOOL MarkChoice(PPDCACHE *cache, const char *keyword, const char *choice)
+{
+	const PPDCACHE_OPTION	*option;
+	const char				*name;
+	DWORD					i;
+	int						n;
+
+	if ( (n = PpdCacheFindOption(cache, keyword)) < 0 )
+		return FALSE;
+
+	// Custom values select the "Custom" choice
+	if ( !strncasecmp(choice, "Custom.", 7) || choice[0] == '{' )
+	{
+		if ( !strcasecmp(keyword, "PageSize") &&
+			!PpdCachePageSize(cache, choice, &cache->custom[0], &cache->custom[1]) )
+		{
+			return FALSE;
+		}
+		choice = "Custom";
+	}
+
+	option = PPDCACHE_OPT(cache, n);
+	for (i=option->first_choice; i<option->first_choice+option->num_choices; i++)
+	{
+		name = PPDCACHE_STR(cache, PPDCACHE_CHO(cache, i)->choice);
+		if ( !strcasecmp(name, choice) ||
+			(!strcmp(name, "True") && (!strcasecmp(choice, "yes") || !strcasecmp(choice, "on"))) ||
+			(!strcmp(name, "False") && (!strcasecmp(choice, "no") || !strcasecmp(choice, "off"))) )
+		{
+			cache->marked[n] = i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// The marks cupsMarkOptions() leaves on the PPD, copied to the cache
+BOOL MarkOptionsCups(PPDCACHE *cache, int num_options, cups_option_t *options, CUPSLIB_FUNCTION *cups)
+{
+	ppd_file_t				*ppd;
+	ppd_choice_t			*choice;
+	ppd_size_t				*size;
+	const PPDCACHE_OPTION	*option;
+	DWORD					i, j;
+
+	if ( (ppd = cups->ppdOpenFile(PPDCACHE_STR(cache, PPDCACHE_HDR(cache)->path))) == NULL )
+		return FALSE;
+
+	cups->ppdMarkDefaults(ppd);
+	cups->cupsMarkOptions(ppd, num_options, options);
+
+	for (i=0; i<PPDCACHE_HDR(cache)->num_options; i++)
+	{
+		option = PPDCACHE_OPT(cache, i);
+		cache->marked[i] = PPDCACHE_NONE;
+		if ( (choice = cups->ppdFindMarkedChoice(ppd, PPDCACHE_STR(cache, option->keyword))) == NULL )
+			continue;
+
+		for (j=option->first_choice; j<option->first_choice+option->num_choices; j++)
+		{
+			if ( !strcmp(PPDCACHE_STR(cache, PPDCACHE_CHO(cache, j)->choice), choice->choice) )
+			{
+				cache->marked[i] = j;
+				break;
+			}
+		}
+	}
+
+	cache->custom[0] = cache->custom[1] = 0.0;
+	if ( (size = cups->ppdPageSize(ppd, NULL)) != NULL && !strcasecmp(size->name, "Custom") )
+	{
+		cache->custom[0] = size->width;
+		cache->custom[1] = size->length;
+	}
+
+	cups->ppdClose(ppd);
+	return TRUE;
+}
+
+DWORD buf_reserve(PPDCACHE_BUF *buf, size_t len)
+{
+	DWORD		offset;
+
+	// Keep every table and string 4 byte aligned
+	len = (len + 3) & ~3;
+	if ( buf->len + len > buf->size )
+	{
+		size_t		size = buf->size ? buf->size : 4096;
+		BYTE		*data;
+
+		while ( size < buf->len + len )
+			size *= 2;
+		if ( buf->bFailed || (data = realloc(buf->data, size)) == NULL )
+		{
+			buf->bFailed = TRUE;
+			return PPDCACHE_NONE;
+		}
+		memset(data + buf->size, 0, size - buf->size);
+		buf->data = data;
+		buf->size = size;
+	}
+	offset = buf->len;
+	buf->len += len;
+	return offset;
+}
+
+DWORD buf_string(PPDCACHE_BUF *buf, const char *str)
+{
+	DWORD		offset;
+
+	if ( str == NULL )
+		str = "";
+	if ( (offset = buf_reserve(buf, strlen(str) + 1)) != PPDCACHE_NONE )
+		strcpy((char *)buf->data + offset, str);
+	return offset;
+}
+
+BYTE* PpdCacheBuild(const char *szPpdFile, struct stat *st, CUPSLIB_FUNCTION *cups, size_t *psize)
+{
+	ppd_file_t			*ppd;
+	ppd_option_t		**ppdoption = NULL;
+	int					num_ppdoptions;
+	cups_option_t		*attrs = NULL;
+	int					num_attrs, num_alloc;
+	PPDCACHE_BUF		buf;
+	PPDCACHE_HEADER		*hdr;
+	DWORD				num_choices = 0;
+	DWORD				offset, n;
+	DWORD				tables[4];
+	int					i, j;
+	BOOL				bRtn = TRUE;
+
+	DebugPrintf("PpdCacheBuild: %s\n", szPpdFile);
+
+	if ( (ppd = cups->ppdOpenFile(szPpdFile)) == NULL )
+	{
+		Error_Log(LEVEL_ERROR, "Unable to open PPD file %s\n", szPpdFile);
+		return NULL;
+	}
+	cups->ppdMarkDefaults(ppd);
+
+	num_ppdoptions = GetPpdOptions(ppd, &ppdoption);
+	for (i=0; i<num_ppdoptions; i++)
+		num_choices += ppdoption[i]->num_choices;
+	num_attrs = num_alloc = GetPrinterOptions(ppd, &attrs, cups);
+
+	// Header and tables first, then the strings they point to.
+	// buf_reserve() may move the data, so offsets are stored apart.
+	#define HDR		((PPDCACHE_HEADER *)buf.data)
+	memset(&buf, 0, sizeof(buf));
+	memset(tables, 0, sizeof(tables));
+	if ( buf_reserve(&buf, sizeof(PPDCACHE_HEADER)) == PPDCACHE_NONE ||
+		(tables[0] = buf_reserve(&buf, sizeof(PPDCACHE_OPTION) * num_ppdoptions)) == PPDCACHE_NONE ||
+		(tables[1] = buf_reserve(&buf, sizeof(PPDCACHE_CHOICE) * num_choices)) == PPDCACHE_NONE ||
+		(tables[2] = buf_reserve(&buf, sizeof(PPDCACHE_SIZE) * ppd->num_sizes)) == PPDCACHE_NONE ||
+		(tables[3] = buf_reserve(&buf, sizeof(PPDCACHE_ATTR) * num_attrs)) == PPDCACHE_NONE )
+	{
+		bRtn = FALSE;
+	}
+	else
+	{
+		HDR->options = tables[0];
+		HDR->choices = tables[1];
+		HDR->sizes = tables[2];
+		HDR->attrs = tables[3];
+	}
+
+	n = 0;
+	for (i=0; bRtn && !buf.bFailed && i<num_ppdoptions; i++)
+	{
+		ppd_choice_t	*marked = cups->ppdFindMarkedChoice(ppd, ppdoption[i]->keyword);
+
+		offset = buf_string(&buf, ppdoption[i]->keyword);
+		((PPDCACHE_OPTION *)(buf.data + HDR->options))[i].keyword = offset;
+		((PPDCACHE_OPTION *)(buf.data + HDR->options))[i].first_choice = n;
+		((PPDCACHE_OPTION *)(buf.data + HDR->options))[i].num_choices = ppdoption[i]->num_choices;
+		((PPDCACHE_OPTION *)(buf.data + HDR->options))[i].defchoice = PPDCACHE_NONE;
+
+		for (j=0; j<ppdoption[i]->num_choices; j++, n++)
+		{
+			if ( marked == ppdoption[i]->choices + j )
+				((PPDCACHE_OPTION *)(buf.data + HDR->options))[i].defchoice = n;
+
+			offset = buf_string(&buf, ppdoption[i]->choices[j].choice);
+			((PPDCACHE_CHOICE *)(buf.data + HDR->choices))[n].choice = offset;
+			offset = buf_string(&buf, ppdoption[i]->choices[j].code);
+			((PPDCACHE_CHOICE *)(buf.data + HDR->choices))[n].code = offset;
+		}
+	}
+
+	for (i=0; bRtn && !buf.bFailed && i<ppd->num_sizes; i++)
+	{
+		PPDCACHE_SIZE	*size;
+
+		offset = buf_string(&buf, ppd->sizes[i].name);
+		size = (PPDCACHE_SIZE *)(buf.data + HDR->sizes) + i;
+		size->name = offset;
+		size->width = ppd->sizes[i].width;
+		size->length = ppd->sizes[i].length;
+		size->left = ppd->sizes[i].left;
+		size->bottom = ppd->sizes[i].bottom;
+		size->right = ppd->sizes[i].right;
+		size->top = ppd->sizes[i].top;
+	}
+
+	// User commands are decoded here once, not by every job
+	for (i=0, n=0; bRtn && !buf.bFailed && i<num_attrs; i++)
+	{
+		const TSC_OPTION_NAME_T	*pOpt = GetOptionTypeByName(attrs[i].name);
+		int						index;
+
+		if ( pOpt && (index = GetOptionCommandIndex(pOpt)) >= 0 )
+		{
+			BYTE		*data;
+			int			length;
+
+			if ( (data = MEMALLOC(strlen(attrs[i].value) * 3 / 4 + 4)) == NULL )
+			{
+				bRtn = FALSE;
+				break;
+			}
+			length = Decode(attrs[i].value, data);
+			if ( (offset = buf_reserve(&buf, length)) != PPDCACHE_NONE )
+			{
+				memcpy(buf.data + offset, data, length);
+				HDR->commands[index] = offset;
+				HDR->command_lengths[index] = length;
+			}
+			MEMFREE(data);
+			continue;
+		}
+
+		offset = buf_string(&buf, attrs[i].name);
+		((PPDCACHE_ATTR *)(buf.data + HDR->attrs))[n].name = offset;
+		offset = buf_string(&buf, attrs[i].value);
+		((PPDCACHE_ATTR *)(buf.data + HDR->attrs))[n].value = offset;
+		n++;
+	}
+	num_attrs = n;
+
+	offset = bRtn ? buf_string(&buf, szPpdFile) : PPDCACHE_NONE;
+	if ( offset != PPDCACHE_NONE && !buf.bFailed )
+	{
+		hdr = HDR;
+		hdr->magic = PPDCACHE_MAGIC;
+		hdr->version = PPDCACHE_VERSION;
+		hdr->size = buf.len;
+		hdr->path = offset;
+		hdr->ppd_mtime = st->st_mtime;
+		hdr->ppd_size = st->st_size;
+		hdr->custom_max[0] = ppd->custom_max[0];
+		hdr->custom_max[1] = ppd->custom_max[1];
+		hdr->custom_min[0] = ppd->custom_min[0];
+		hdr->custom_min[1] = ppd->custom_min[1];
+		hdr->num_options = num_ppdoptions;
+		hdr->num_choices = num_choices;
+		hdr->num_sizes = ppd->num_sizes;
+		hdr->num_attrs = num_attrs;
+	}
+	else
+	{
+		Error_Log(LEVEL_ERROR, "Unable to compile PPD file %s\n", szPpdFile);
+		MEMFREE(buf.data);
+	}
+	#undef HDR
+
+	if ( attrs )
+		cups->cupsFreeOptions(num_alloc, attrs);
+	MEMFREE(ppdoption);
+	cups->ppdClose(ppd);
+
+	*psize = buf.len;
+	return buf.data;
+}
+
+// A stale, foreign or damaged image is simply rebuilt
+BOOL PpdCacheValid(const BYTE *image, size_t size, const char *szPpdFile, struct stat *st)
+{
+	const PPDCACHE_HEADER	*hdr = (const PPDCACHE_HEADER *)image;
+	DWORD					i;
+
+	if ( hdr->magic != PPDCACHE_MAGIC || hdr->version != PPDCACHE_VERSION || hdr->size != size ||
+		hdr->ppd_mtime != st->st_mtime || hdr->ppd_size != st->st_size || image[size-1] != '\0' )
+		return FALSE;
+
+	if ( hdr->path >= size || strcmp((const char *)image + hdr->path, szPpdFile) )
+		return FALSE;
+
+	if ( hdr->options + (size_t)hdr->num_options * sizeof(PPDCACHE_OPTION) > size ||
+		hdr->choices + (size_t)hdr->num_choices * sizeof(PPDCACHE_CHOICE) > size ||
+		hdr->sizes + (size_t)hdr->num_sizes * sizeof(PPDCACHE_SIZE) > size ||
+		hdr->attrs + (size_t)hdr->num_attrs * sizeof(PPDCACHE_ATTR) > size )
+		return FALSE;
+
+	for (i=0; i<hdr->num_options; i++)
+	{
+		const PPDCACHE_OPTION	*option = (const PPDCACHE_OPTION *)(image + hdr->options) + i;
+
+		if ( option->keyword >= size || option->first_choice + option->num_choices > hdr->num_choices ||
+			(option->defchoice != PPDCACHE_NONE && option->defchoice >= hdr->num_choices) )
+			return FALSE;
+	}
+	for (i=0; i<hdr->num_choices; i++)
+	{
+		const PPDCACHE_CHOICE	*choice = (const PPDCACHE_CHOICE *)(image + hdr->choices) + i;
+
+		if ( choice->choice >= size || choice->code >= size )
+			return FALSE;
+	}
+	for (i=0; i<hdr->num_sizes; i++)
+	{
+		if ( ((const PPDCACHE_SIZE *)(image + hdr->sizes))[i].name >= size )
+			return FALSE;
+	}
+	for (i=0; i<hdr->num_attrs; i++)
+	{
+		const PPDCACHE_ATTR		*attr = (const PPDCACHE_ATTR *)(image + hdr->attrs) + i;
+
+		if ( attr->name >= size || attr->value >= size )
+			return FALSE;
+	}
+	for (i=0; i<PPDCACHE_NUM_COMMANDS; i++)
+	{
+		if ( (size_t)hdr->commands[i] + hdr->command_lengths[i] > size )
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+void PpdCacheFileName(const char *szPpdFile, char *filename, size_t len)
+{
+	const char		*cachedir;
+	DWORD			hash = 2166136261u;
+
+	if ( (cachedir = getenv("CUPS_CACHEDIR")) == NULL )
+		cachedir = CUPS_CACHEDIR;
+
+	// FNV-1a of the PPD path, one image per queue
+	for ( ; *szPpdFile; szPpdFile++)
+		hash = (hash ^ (BYTE)*szPpdFile) * 16777619u;
+
+	snprintf(filename, len, "%s/tsc-%08x.ppdc", cachedir, hash);
+}
+
+// Written to a temp file and renamed, so a concurrent job either maps the
+// old image or the complete new one. Failing to store is not an error.
+void PpdCacheStore(const char *szPpdFile, const BYTE *image, size_t size)
+{
+	char		filename[1024];
+	char		tempfile[1024];
+	char		*ptr;
+	int			fd;
+
+	PpdCacheFileName(szPpdFile, filename, sizeof(filename));
+	snprintf(tempfile, sizeof(tempfile), "%s", filename);
+	if ( (ptr = strrchr(tempfile, '/')) != NULL )
+		snprintf(ptr + 1, sizeof(tempfile) - (ptr + 1 - tempfile), "tsc-XXXXXX");
+
+	if ( (fd = mkstemp(tempfile)) < 0 )
+	{
+		DebugPrintf("PpdCacheStore: %s - %s\n", tempfile, strerror(errno));
+		return;
+	}
+
+	fchmod(fd, 0644);
+	if ( write(fd, image, size) != size || close(fd) || rename(tempfile, filename) )
+	{
+		DebugPrintf("PpdCacheStore: %s - %s\n", filename, strerror(errno));
+		unlink(tempfile);
+		return;
+	}
+	DebugPrintf("PpdCacheStore: %s, %d bytes\n", filename, (int)size);
+}
@@ -0,0 +1,129 @@
+/*
+ * "ppdcache.h 2021-05-17 15:55:05
+ *
+ *  compiled ppd cache declaration for TSC Printer Driver
+ *
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#ifndef _PPDCACHE_H_
+#define _PPDCACHE_H_
+
+#include "common.h"
+#include "libloader.h"
+
+// The image is what the driver needs from a PPD, flattened so it can be
+// mmap'ed as is. Every string is an offset into the image, tables are
+// stored in PPD order. It is rebuilt whenever the PPD path, mtime or
+// size no longer match the header.
+#define PPDCACHE_MAGIC			0x43505354		// "TSPC"
+#define PPDCACHE_VERSION		2
+#define PPDCACHE_NONE			0xFFFFFFFF
+
+// User command blocks, stored base64 decoded
+#define PPDCACHE_CMD_STARTJOB		0
+#define PPDCACHE_CMD_STARTLABEL		1
+#define PPDCACHE_CMD_ENDLABEL		2
+#define PPDCACHE_CMD_ENDJOB			3
+#define PPDCACHE_NUM_COMMANDS		4
+
+typedef struct _PPDCACHE_HEADER
+{
+	DWORD			magic;					// PPDCACHE_MAGIC
+	DWORD			version;				// PPDCACHE_VERSION
+	DWORD			size;					// Image size in bytes
+	DWORD			path;					// PPD file name
+	long long		ppd_mtime;
+	long long		ppd_size;
+
+	float			custom_max[2];			// Largest custom page size
+	float			custom_min[2];
+
+	DWORD			num_options;			// UI options, groups flattened
+	DWORD			options;
+	DWORD			num_choices;
+	DWORD			choices;
+	DWORD			num_sizes;				// *PaperDimension/*ImageableArea
+	DWORD			sizes;
+	DWORD			num_attrs;				// TscAttrData options
+	DWORD			attrs;
+	DWORD			commands[PPDCACHE_NUM_COMMANDS];
+	DWORD			command_lengths[PPDCACHE_NUM_COMMANDS];
+} PPDCACHE_HEADER;
+
+typedef struct _PPDCACHE_OPTION
+{
+	DWORD			keyword;
+	DWORD			first_choice;			// Index into the choice table
+	DWORD			num_choices;
+	DWORD			defchoice;				// Choice index, PPDCACHE_NONE if none
+} PPDCACHE_OPTION;
+
+typedef struct _PPDCACHE_CHOICE
+{
+	DWORD			choice;
+	DWORD			code;
+} PPDCACHE_CHOICE;
+
+typedef struct _PPDCACHE_SIZE
+{
+	DWORD			name;
+	float			width;
+	float			length;
+	float			left;
+	float			bottom;
+	float			right;
+	float			top;
+} PPDCACHE_SIZE;
+
+typedef struct _PPDCACHE_ATTR
+{
+	DWORD			name;
+	DWORD			value;
+} PPDCACHE_ATTR;
+
+// A job's view of the image, the marks are per job
+typedef struct _PPDCACHE
+{
+	BYTE			*image;					// Read only when mapped
+	size_t			size;
+	BOOL			bMapped;				// mmap'ed, else heap
+	DWORD			*marked;				// Marked choice per option
+	float			custom[2];				// Marked Custom.WxH page size
+	LPBYTE			command[PPDCACHE_NUM_COMMANDS];			// Set by the job, else the image's
+	DWORD			command_length[PPDCACHE_NUM_COMMANDS];
+} PPDCACHE;
+
+#define PPDCACHE_HDR(c)				((const PPDCACHE_HEADER *)(c)->image)
+#define PPDCACHE_STR(c, off)		((const char *)(c)->image + (off))
+#define PPDCACHE_OPT(c, i)			((const PPDCACHE_OPTION *)((c)->image + PPDCACHE_HDR(c)->options) + (i))
+#define PPDCACHE_CHO(c, i)			((const PPDCACHE_CHOICE *)((c)->image + PPDCACHE_HDR(c)->choices) + (i))
+#define PPDCACHE_SZ(c, i)			((const PPDCACHE_SIZE *)((c)->image + PPDCACHE_HDR(c)->sizes) + (i))
+#define PPDCACHE_ATR(c, i)			((const PPDCACHE_ATTR *)((c)->image + PPDCACHE_HDR(c)->attrs) + (i))
+
+PPDCACHE* PpdCacheOpen(const char *szPpdFile, BOOL bStore, CUPSLIB_FUNCTION *cups);
+void PpdCacheClose(PPDCACHE *cache);
+
+int PpdCacheFindOption(PPDCACHE *cache, const char *keyword);
+void PpdCacheMarkDefaults(PPDCACHE *cache);
+void PpdCacheMarkOptions(PPDCACHE *cache, int num_options, cups_option_t *options, CUPSLIB_FUNCTION *cups);
+const char* PpdCacheMarkedChoice(PPDCACHE *cache, const char *keyword);
+const char* PpdCacheChoiceCode(PPDCACHE *cache, const char *keyword, const char *choice);
+BOOL PpdCachePageSize(PPDCACHE *cache, const char *name, float *width, float *length);
+int PpdCacheGetOptions(PPDCACHE *cache, cups_option_t **options, CUPSLIB_FUNCTION *cups);
+const BYTE* PpdCacheCommand(PPDCACHE *cache, int index, DWORD *length);
+BOOL PpdCacheSetCommand(PPDCACHE *cache, int index, const char *szCoded);
+
+#endif	// #ifndef _PPDCACHE_H_
@@ -0,0 +1,47 @@
+/*
+ * "probes.h 2021-05-17 15:55:05
+ *
+ *  static probe declaration for TSC Printer Driver
+ *
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+// USDT probes of provider "tsc", a nop in the code until a tracer attaches.
+// Without <sys/sdt.h> at configure time they compile to nothing.
+//
+//		bpftrace -e 'usdt:/usr/lib/cups/filter/rastertobarcodetspl:tsc:printer_write { @ = hist(arg0); }'
+//
+//	job_start(job)					job_end(pages)
+//	page_decode_start(page)			page_decode_end(page, bytes)
+//	page_emit(page, copy)			printer_write(bytes)
+//	gs_page(page)					gs_close(ok)
+
+#ifdef HAVE_SYS_SDT_H
+	#include <sys/sdt.h>
+
+	#define	TSC_PROBE0(name)				DTRACE_PROBE(tsc, name)
+	#define	TSC_PROBE1(name, a)				DTRACE_PROBE1(tsc, name, a)
+	#define	TSC_PROBE2(name, a, b)			DTRACE_PROBE2(tsc, name, a, b)
+#else
+	#define	TSC_PROBE0(name)				((void)0)
+	#define	TSC_PROBE1(name, a)				((void)0)
+	#define	TSC_PROBE2(name, a, b)			((void)0)
+#endif	// #ifdef HAVE_SYS_SDT_H
+
+#endif	// #ifndef _PROBES_H_
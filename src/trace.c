@@ -0,0 +1,142 @@
+/*
+ * "trace.c 2021-05-17 15:55:05
+ *
+ *  tracing span routines for TSC Printer Driver
+ *
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "debug.h"
+#include "trace.h"
+
+#include <sys/time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+typedef struct _TRACE_EVENT
+{
+	const char		*name;				// String literal
+	TRACETIME		ts;
+	TRACETIME		dur;
+	int				pid;				// Forked children inherit the buffer
+	int				arg;
+} TRACE_EVENT;
+
+static int				s_nState = 0;		// 0 unknown, 1 on, -1 off
+static const char		*s_szFile = NULL;
+static TRACE_EVENT		*s_pEvents = NULL;
+static int				s_nEvents = 0;
+static int				s_nDropped = 0;
+
+static TRACETIME Trace_Now(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (TRACETIME)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static BOOL Trace_Init(void)
+{
+	s_nState = -1;
+	if ( (s_szFile = getenv("TSC_TRACE_FILE")) != NULL && *s_szFile &&
+		(s_pEvents = MEMALLOC(sizeof(TRACE_EVENT) * TRACE_MAX_EVENTS)) != NULL )
+	{
+		s_nState = 1;
+		atexit(Trace_Dump);
+	}
+	return s_nState > 0;
+}
+
+TRACETIME Trace_Begin(void)
+{
+	if ( s_nState < 0 || (s_nState == 0 && !Trace_Init()) )
+		return 0;
+
+	return Trace_Now();
+}
+
+void Trace_End(const char *szName, TRACETIME tStart, int nArg)
+{
+	TRACE_EVENT		*pEvent;
+
+	if ( tStart == 0 )
+		return;
+
+	if ( s_nEvents >= TRACE_MAX_EVENTS )
+	{
+		s_nDropped ++;
+		return;
+	}
+
+	pEvent = &s_pEvents[s_nEvents++];
+	pEvent->name = szName;
+	pEvent->ts = tStart;
+	pEvent->dur = Trace_Now() - tStart;
+	pEvent->pid = getpid();
+	pEvent->arg = nArg;
+}
+
+// Appends this process's spans under a lock, the first writer opens the
+// array. The closing ']' is optional in this format. Children that leave
+// with _exit() have to call it themselves.
+void Trace_Dump(void)
+{
+	int				fd;
+	int				i;
+	int				pid = getpid();
+	FILE			*fp;
+	struct stat		st;
+
+	if ( s_nState <= 0 || s_nEvents == 0 )
+		return;
+
+	if ( (fd = open(s_szFile, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0 )
+	{
+		Error_Log(LEVEL_WARNING, "Unable to write trace file %s: %s\n", s_szFile, strerror(errno));
+		return;
+	}
+	flock(fd, LOCK_EX);
+	if ( (fp = fdopen(fd, "a")) == NULL )
+	{
+		close(fd);
+		return;
+	}
+
+	if ( !fstat(fd, &st) && st.st_size == 0 )
+		fputs("[\n", fp);
+
+	for (i=0; i<s_nEvents; i++)
+	{
+		if ( s_pEvents[i].pid != pid )
+			continue;
+
+		fprintf(fp, "{\"name\":\"%s\",\"cat\":\"tsc\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d",
+			s_pEvents[i].name, s_pEvents[i].ts, s_pEvents[i].dur, pid, pid);
+		if ( s_pEvents[i].arg != TRACE_NO_ARG )
+			fprintf(fp, ",\"args\":{\"page\":%d}", s_pEvents[i].arg);
+		fputs("},\n", fp);
+	}
+	if ( s_nDropped )
+	{
+		Error_Log(LEVEL_DEBUG, "Trace: %d spans dropped, buffer full\n", s_nDropped);
+	}
+
+	// Closing the stream releases the lock
+	fclose(fp);
+	s_nEvents = 0;
+}
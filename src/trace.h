@@ -0,0 +1,53 @@
+/*
+ * "trace.h 2021-05-17 15:55:05
+ *
+ *  tracing span declaration for TSC Printer Driver
+ *
+ *  Copyright (c) 2005, by TSC Printronix Auto ID .
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Spans are kept in memory and appended to $TSC_TRACE_FILE at exit, in the
+// Chrome trace-event JSON array format (chrome://tracing, Perfetto). Every
+// process of the job appends its own, without the variable it costs one
+// getenv() per process.
+//
+//		TRACETIME	t = Trace_Begin();
+//		...
+//		Trace_End("SpoolWrite", t, page);
+
+#define	TRACE_MAX_EVENTS		8192
+#define	TRACE_NO_ARG			-1
+
+typedef long long		TRACETIME;		// us, 0 when tracing is off
+
+TRACETIME Trace_Begin(void);
+void Trace_End(const char *szName, TRACETIME tStart, int nArg);
+void Trace_Dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// #ifndef _TRACE_H_